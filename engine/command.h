@@ -0,0 +1,201 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include "../sys/config.h"
+
+namespace Loud {
+
+// Longest command accepted from any transport. Windows paths top out at
+// 32767 UTF-16 units, which is at most ~96 KiB of UTF-8, but anything past
+// a few KiB is garbage or hostile in practice.
+constexpr size_t MAX_COMMAND_BYTES = 32 * 1024;
+
+// A queue entry or play: argument can name a stem group instead of a file:
+// "stems:" and the files separated by '|', which Windows file names can't contain
+constexpr const char* STEMS_PREFIX = "stems:";
+constexpr size_t MAX_STEMS = 64;
+
+// Furthest position seek: and loop: accept; a day covers the longest audiobooks
+constexpr double MAX_TRACK_SECONDS = 86400;
+
+// One decoded command. Parsing is a pure function of the datagram, so it can
+// be exercised on its own with arbitrary bytes.
+struct Command {
+    enum Type { Stop, Next, Prev, Quit, Play, Queue, Ttfs, Trace, Seek, Loop, Gain, Mute, Unmute, Chapter, Analyze, Legacy, Invalid };
+
+    Type type = Invalid;
+    std::string arg;
+    std::string zone; // From an "@<zone>:" prefix; empty = the first zone
+
+    // Label for the command counters
+    const char* name() const {
+        switch (type) {
+            case Stop:    return "stop";
+            case Next:    return "next";
+            case Prev:    return "prev";
+            case Quit:    return "quit";
+            case Play:    return "play";
+            case Queue:   return "queue";
+            case Ttfs:    return "ttfs";
+            case Trace:   return "trace";
+            case Seek:    return "seek";
+            case Loop:    return "loop";
+            case Gain:    return "gain";
+            case Mute:    return "mute";
+            case Unmute:  return "unmute";
+            case Chapter: return "chapter";
+            case Analyze: return "analyze";
+            case Legacy:  return "legacy";
+            case Invalid: return "invalid";
+        }
+        return "invalid";
+    }
+};
+
+// Paths go to the filesystem and to C APIs, where an embedded NUL would
+// silently cut the name short, and no real path contains control characters
+inline bool isPlausiblePath(const std::string& path) {
+    if (path.empty()) return false;
+    for (unsigned char c : path) {
+        if (c < 0x20 || c == 0x7F) return false;
+    }
+    return true;
+}
+
+inline bool isStemGroup(const std::string& entry) {
+    return entry.rfind(STEMS_PREFIX, 0) == 0;
+}
+
+// Files of a stem group entry, in order
+inline std::vector<std::string> stemPaths(const std::string& entry) {
+    std::vector<std::string> paths;
+    size_t start = std::string(STEMS_PREFIX).size();
+    while (start <= entry.size()) {
+        size_t end = entry.find('|', start);
+        if (end == std::string::npos) end = entry.size();
+        paths.push_back(entry.substr(start, end - start));
+        start = end + 1;
+    }
+    return paths;
+}
+
+// A file path, or a stem group of 1..MAX_STEMS plausible paths
+inline bool isPlausibleEntry(const std::string& entry) {
+    if (!isStemGroup(entry)) return isPlausiblePath(entry);
+    std::vector<std::string> paths = stemPaths(entry);
+    if (paths.size() > MAX_STEMS) return false;
+    for (const auto& path : paths) {
+        if (!isPlausiblePath(path)) return false;
+    }
+    return true;
+}
+
+// Map a raw message (UDP datagram or HTTP /cmd body) to a command.
+// "@<zone>:" in front addresses one zone of a multi-zone daemon, e.g.
+// "@patio:n" (see [zones] in loud.ini). Anything oversized or malformed
+// comes back as Invalid.
+inline Command parseCommand(const std::string& text) {
+    Command command;
+    if (text.size() > MAX_COMMAND_BYTES) return command;
+
+    std::string msg = text;
+    if (!msg.empty() && msg[0] == '@') {
+        size_t colon = msg.find(':');
+        if (colon == std::string::npos || !Config::isZoneId(msg.substr(1, colon - 1))) return command;
+        command.zone = msg.substr(1, colon - 1);
+        msg.erase(0, colon + 1);
+    }
+
+    // Handle empty message - stop playback
+    if (msg.empty()) command.type = Command::Stop;
+    // Handle direct commands
+    else if (msg == "n") command.type = Command::Next;
+    else if (msg == "p") command.type = Command::Prev;
+    else if (msg == "q") command.type = Command::Quit;
+    // Handle prefixed commands
+    else if (msg.rfind("play:", 0) == 0) { command.type = Command::Play; command.arg = msg.substr(5); }
+    else if (msg.rfind("q:", 0) == 0) { command.type = Command::Queue; command.arg = msg.substr(2); }
+    else if (msg.rfind("ttfs:", 0) == 0) { command.type = Command::Ttfs; command.arg = msg.substr(5); }
+    else if (msg.rfind("trace:", 0) == 0) { command.type = Command::Trace; command.arg = msg.substr(6); }
+    else if (msg.rfind("seek:", 0) == 0) { command.type = Command::Seek; command.arg = msg.substr(5); }
+    else if (msg.rfind("loop:", 0) == 0) { command.type = Command::Loop; command.arg = msg.substr(5); }
+    else if (msg.rfind("gain:", 0) == 0) { command.type = Command::Gain; command.arg = msg.substr(5); }
+    else if (msg.rfind("mute:", 0) == 0) { command.type = Command::Mute; command.arg = msg.substr(5); }
+    else if (msg.rfind("unmute:", 0) == 0) { command.type = Command::Unmute; command.arg = msg.substr(7); }
+    else if (msg.rfind("chapter:", 0) == 0) { command.type = Command::Chapter; command.arg = msg.substr(8); }
+    else if (msg.rfind("analyze:", 0) == 0) { command.type = Command::Analyze; command.arg = msg.substr(8); }
+    // Handle legacy direct filepath
+    else { command.type = Command::Legacy; command.arg = msg; }
+
+    bool takesPath = command.type == Command::Play || command.type == Command::Queue || command.type == Command::Legacy;
+    bool takesFile = command.type == Command::Analyze; // A file or folder, never a stem group
+    if ((takesPath && !isPlausibleEntry(command.arg)) || (takesFile && !isPlausiblePath(command.arg))) {
+        command.type = Command::Invalid;
+        command.arg.clear();
+    }
+    return command;
+}
+
+// Seconds argument of trace:/trace?s= and seek:, clamped to 0..max.
+// Empty means the default; false if it isn't a number at all.
+inline bool parseSeconds(const std::string& text, double fallback, double& seconds, double max = 3600) {
+    if (text.empty()) {
+        seconds = fallback;
+        return true;
+    }
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end != text.c_str() + text.size() || !std::isfinite(value)) return false;
+    seconds = value < 0 ? 0 : (value > max ? max : value);
+    return true;
+}
+
+// loop:<start>:<end> in seconds, loop:<start> (to the end of the track),
+// loop:on (the whole track) and loop:off. end is -1 for the end of the track.
+inline bool parseLoop(const std::string& text, bool& enable, double& start, double& end) {
+    enable = text != "off";
+    start = 0;
+    end = -1;
+    if (text == "off" || text == "on") return true;
+
+    size_t colon = text.find(':');
+    if (!parseSeconds(text.substr(0, colon), -1, start, MAX_TRACK_SECONDS) || start < 0) return false;
+    return colon == std::string::npos || parseSeconds(text.substr(colon + 1), -1, end, MAX_TRACK_SECONDS);
+}
+
+// Stem number of mute:/unmute:, and of gain:<stem>:<gain>
+inline bool parseStemIndex(const std::string& text, size_t& index) {
+    if (text.empty() || text.size() > 4 || text.find_first_not_of("0123456789") != std::string::npos) return false;
+    index = static_cast<size_t>(std::strtoul(text.c_str(), nullptr, 10));
+    return index < MAX_STEMS;
+}
+
+// chapter:next, chapter:prev or chapter:<n> counting from 0 as in "chapters"
+// of the status. step is +1/-1 for next/prev and 0 for a chapter number.
+inline bool parseChapter(const std::string& text, int& step, size_t& index) {
+    step = 0;
+    index = 0;
+    if (text == "next") { step = 1; return true; }
+    if (text == "prev") { step = -1; return true; }
+    if (text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos) return false;
+    index = static_cast<size_t>(std::strtoul(text.c_str(), nullptr, 10));
+    return true;
+}
+
+// gain:<stem>:<linear gain>, e.g. gain:2:0.5
+inline bool parseStemGain(const std::string& text, size_t& index, float& gain) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos || !parseStemIndex(text.substr(0, colon), index)) return false;
+    std::string value = text.substr(colon + 1);
+    if (value.empty()) return false;
+    char* end = nullptr;
+    double parsed = std::strtod(value.c_str(), &end);
+    if (end != value.c_str() + value.size() || !std::isfinite(parsed) || parsed < 0) return false;
+    gain = static_cast<float>(parsed);
+    return true;
+}
+
+} // namespace Loud
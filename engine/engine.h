@@ -0,0 +1,1224 @@
+#pragma once
+
+#include "../net/udpr.h"
+#include "../net/http.h"
+#include "../sys/audio.h"
+#include "../sys/metrics.h"
+#include "../sys/trace.h"
+#include "../sys/watchdog.h"
+#include "../sys/ttfs.h"
+#include "../sys/config.h"
+#include "../sys/library.h"
+#include "../sys/analysis.h"
+#include "../sys/shuffle.h"
+#include "../sys/zip.h"
+#include "../sys/memory.h"
+#include "command.h"
+#include <string>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <functional>
+#include <map>
+
+namespace Loud {
+
+// Zone the daemon runs when loud.ini names none
+constexpr const char* DEFAULT_ZONE = "main";
+
+// Per-type command counters; labels are a fixed set so lookups stay cheap
+inline void countCommand(const char* type) {
+    Metrics::counter("loud_commands_total", "Commands received, by type", std::string("type=\"") + type + "\"").add();
+}
+
+// A command that was received but had no effect (missing file, empty queue, error)
+inline void dropCommand(const char* type) {
+    Metrics::counter("loud_commands_dropped_total", "Commands ignored or failed, by type", std::string("type=\"") + type + "\"").add();
+}
+
+// One zone of the daemon: an audio Player on its own output device, with
+// its queue, history and the command handlers (see Engine for the rest).
+//
+// Every command to the zone, whichever thread it comes from (UDP, HTTP, end
+// of track or the host), is serialized by one mutex, so handlers see a
+// consistent queue. Zones don't share state, so they never wait on each other.
+class Zone {
+public:
+    // Throws if the device can't be opened (see Audio::Player)
+    Zone(std::string id, Audio::Context& context, const std::string& device) : zoneId(std::move(id)), player(context, device) {
+        connect();
+    }
+
+    // On channels of a device shared with other zones; throws if they are taken
+    Zone(std::string id, Audio::Context& context, Audio::SharedDevice& device, uint32_t firstChannel, uint32_t channels)
+        : zoneId(std::move(id)), player(context, device, firstChannel, channels) {
+        connect();
+    }
+
+    ~Zone() {
+        player.setOnPlaybackEnd(nullptr);
+        player.setOnTransition(nullptr);
+        player.stop();
+    }
+
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
+
+    const std::string& id() const { return zoneId; }
+
+    // Run one parsed command (its zone has already been picked)
+    void handleCommand(const Command& command) {
+        std::scoped_lock lock(commandMutex);
+        countCommand(command.name());
+
+        switch (command.type) {
+            case Command::Stop:   handleStopCommand(); break;
+            case Command::Next:   handleNextCommand(); break;
+            case Command::Prev:   handlePrevCommand(); break;
+            case Command::Quit:   handleQuitCommand(); break;
+            case Command::Play:   handlePlayCommand(command.arg); break;
+            case Command::Queue:  handleQueueCommand(command.arg); break;
+            case Command::Legacy: handleLegacyCommand(command.arg); break;
+            case Command::Trace:  handleTraceCommand(command.arg); break;
+            case Command::Seek:   handleSeekCommand(command.arg); break;
+            case Command::Loop:   handleLoopCommand(command.arg); break;
+            case Command::Gain:   handleGainCommand(command.arg); break;
+            case Command::Mute:   handleMuteCommand(command.arg, true); break;
+            case Command::Unmute: handleMuteCommand(command.arg, false); break;
+            case Command::Chapter: handleChapterCommand(command.arg); break;
+            case Command::Analyze: handleAnalyzeCommand(command.arg); break;
+            case Command::Ttfs:
+                if (ttfsRun.arm(command.arg)) player.armFirstSound();
+                else dropCommand("ttfs");
+                break;
+            case Command::Invalid:
+                dropCommand("invalid");
+                return;
+        }
+
+        publishState();
+    }
+
+    // Stop and forget the queue, rotation and history (what "q" does to a zone)
+    void reset() {
+        std::scoped_lock lock(commandMutex);
+        handleQuitCommand();
+        publishState();
+    }
+
+    // Housekeeping, every ~100 ms
+    void tick() {
+        finishTtfsRun();
+        followTransitions();
+    }
+
+    // Latest track/queue snapshot as JSON
+    std::string currentState() {
+        std::scoped_lock lock(stateMutex);
+        return stateJson;
+    }
+
+    // Queue length as last published, for the metrics scraper
+    size_t queueLength() const { return publishedQueueLength.load(); }
+
+    // Event stream frame: the state if it changed since the last frame, the
+    // position and chapter, and the meters (HTTP event loop thread only)
+    std::string eventFrame(const std::vector<float>& peaks) {
+        std::string json = "{\"seq\":" + std::to_string(++eventSeq) + ",\"zone\":\"" + HTTP::jsonEscape(zoneId) + "\"";
+
+        uint64_t version = stateVersion.load();
+        if (version != sentVersion) {
+            sentVersion = version;
+            json += ",\"state\":" + currentState();
+        }
+
+        double seconds = double(player.getPosition()) / player.getSampleRate();
+        json += ",\"position\":" + std::to_string(seconds);
+        std::shared_ptr<const Library::TrackInfo> info;
+        {
+            std::scoped_lock lock(stateMutex);
+            info = publishedInfo;
+        }
+        if (info && !info->tags.chapters.empty()) {
+            json += ",\"chapter\":" + std::to_string(Tags::chapterAt(info->tags.chapters, seconds));
+        }
+        json += ",\"meters\":[";
+        for (size_t ch = 0; ch < peaks.size(); ch++) {
+            if (ch > 0) json += ",";
+            json += std::to_string(peaks[ch]);
+        }
+        json += "]}";
+        return json;
+    }
+
+    // Listeners of one of the zone's stream paths; the player only copies
+    // its output for streaming while any path has some (event loop thread only)
+    void setStreamListeners(const std::string& path, size_t listeners) {
+        streamListeners[path] = listeners;
+        size_t total = 0;
+        for (const auto& entry : streamListeners) total += entry.second;
+        player.setStreaming(total > 0);
+    }
+
+    // Send the zone's output to a second device as well (the default one if
+    // device is empty); throws if it can't be opened
+    void mirrorTo(Audio::Context& context, const std::string& device) {
+        ma_device_info info;
+        if (!context.findDevice(device, info)) {
+            throw std::runtime_error("No playback device matching \"" + device + "\"");
+        }
+        mirror = std::make_unique<Audio::Mirror>(context.get(), device.empty() ? nullptr : &info.id,
+                                                 player.getSampleRate(), player.getChannels(), Config::current().mirrorMs);
+        player.setMirror(mirror.get());
+    }
+
+    const Audio::Mirror* getMirror() const { return mirror.get(); }
+
+    Audio::Player& getPlayer() { return player; }
+
+private:
+    std::string zoneId;
+    // Before the player, so it's destroyed after the player's callbacks stop
+    std::unique_ptr<Audio::Mirror> mirror;
+    Audio::Player player;
+
+    // Follow the player's track changes
+    void connect() {
+        // Set up callback to handle end of playback
+        player.setOnPlaybackEnd([this]() {
+            std::scoped_lock lock(commandMutex);
+            if (playingFromQueue && !audioQueue.empty()) {
+                playNextFromQueue();
+            } else {
+                playingFromQueue = false;
+            }
+            publishState();
+        });
+
+        // A beat transition went into the next track (see armTransition)
+        player.setOnTransition([this](const std::string& path) {
+            std::scoped_lock lock(commandMutex);
+            addToHistory(currentlyPlaying);
+            if (!audioQueue.empty() && audioQueue.front() == path) audioQueue.pop_front();
+            currentlyPlaying = path;
+            countPlay(path);
+            currentInfo = Library::index().lookup(path);
+            playingFromQueue = true;
+            refillFromRotation();
+            armTransition();
+            publishState();
+        });
+    }
+
+    // Serializes command handling across UDP, HTTP and end-of-track callbacks
+    std::mutex commandMutex;
+    // Queue for audio files
+    std::deque<std::string> audioQueue;
+    // Folder playing as a weighted rotation (library.shuffle = weighted), if any
+    std::unique_ptr<Shuffle::Rotation> rotation;
+    // Track whether we're currently playing from the queue
+    std::atomic<bool> playingFromQueue{false};
+    // Track what's currently playing for scrobbling
+    std::string currentlyPlaying;
+    // Tags and chapters of currentlyPlaying from the library index (null for stem groups)
+    std::shared_ptr<const Library::TrackInfo> currentInfo;
+    // Current and next track (and mode) the player's transition was last
+    // armed for, so tick() notices queue changes and finished analyses
+    std::string armedFor;
+    std::chrono::steady_clock::time_point lastArmCheck{};
+    // Scrobble history (length limited by library.history_size in loud.ini)
+    std::deque<std::string> playHistory;
+    // Time-to-first-sound run in progress, if any (guarded by commandMutex)
+    Bench::Run ttfsRun;
+
+    // chapter:prev within this far into a chapter goes to the one before
+    static constexpr double CHAPTER_RESTART_SECONDS = 3.0;
+    // Beat grids below this confidence aren't trusted for transitions
+    static constexpr float BEAT_MIN_CONFIDENCE = 0.2f;
+    static constexpr std::chrono::seconds ARM_INTERVAL{1};
+    // Latest track/queue snapshot for the event stream
+    std::mutex stateMutex;
+    std::string stateJson = "{}";
+    std::shared_ptr<const Library::TrackInfo> publishedInfo; // For the chapter in events
+    std::atomic<uint64_t> stateVersion{0};
+    // Queue length as last published, for the metrics scraper
+    std::atomic<size_t> publishedQueueLength{0};
+    // Event stream bookkeeping (HTTP event loop thread only)
+    uint64_t eventSeq = 0;
+    uint64_t sentVersion = 0;
+    std::map<std::string, size_t> streamListeners;
+
+    // Play the next track from the queue, skipping entries that have gone
+    // missing (a loop, so a long run of them can't exhaust the stack)
+    void playNextFromQueue() {
+        TRACE_SCOPE("handler.playNextFromQueue");
+        while (!audioQueue.empty()) {
+            std::string nextTrack = audioQueue.front();
+            audioQueue.pop_front();
+
+            try {
+                if (entryExists(nextTrack)) {
+
+                    // Add current track to history before starting new one
+                    addToHistory(currentlyPlaying);
+
+                    // Update currently playing track
+                    currentlyPlaying = nextTrack;
+
+                    // Play the file
+                    playEntry(nextTrack);
+                    playingFromQueue = true;
+                    refillFromRotation();
+                    return;
+                }
+                // If this file failed, try the next one
+            } catch (const std::exception&) {
+                // Unreadable entry, try the next one
+            }
+        }
+        playingFromQueue = false;
+    }
+
+    // Snapshot the track and queue for event stream listeners (call with commandMutex held)
+    void publishState() {
+        std::string json = "{\"track\":\"" + HTTP::jsonEscape(currentlyPlaying) + "\"";
+        json += ",\"queueLength\":" + std::to_string(audioQueue.size());
+        json += ",\"queue\":[";
+        size_t published = Config::current().publishedQueue;
+        for (size_t i = 0; i < audioQueue.size() && i < published; i++) {
+            if (i > 0) json += ",";
+            json += "\"" + HTTP::jsonEscape(audioQueue[i]) + "\"";
+        }
+        json += "],\"historyLength\":" + std::to_string(playHistory.size());
+        if (rotation) json += ",\"rotation\":" + std::to_string(rotation->size());
+
+        if (currentInfo) {
+            const Tags::Info& tags = currentInfo->tags;
+            if (!tags.title.empty()) json += ",\"title\":\"" + HTTP::jsonEscape(tags.title) + "\"";
+            if (!tags.artist.empty()) json += ",\"artist\":\"" + HTTP::jsonEscape(tags.artist) + "\"";
+            if (!tags.album.empty()) json += ",\"album\":\"" + HTTP::jsonEscape(tags.album) + "\"";
+            if (currentInfo->analysed && currentInfo->beats.bpm > 0) json += ",\"bpm\":" + std::to_string(currentInfo->beats.bpm);
+            if (!tags.chapters.empty()) {
+                json += ",\"chapters\":[";
+                for (size_t i = 0; i < tags.chapters.size(); i++) {
+                    const Tags::Chapter& chapter = tags.chapters[i];
+                    if (i > 0) json += ",";
+                    json += "{\"start\":" + std::to_string(chapter.start) + ",\"end\":" + (chapter.end < 0 ? "null" : std::to_string(chapter.end));
+                    json += ",\"title\":\"" + HTTP::jsonEscape(chapter.title) + "\"}";
+                }
+                json += "]";
+            }
+        }
+
+        double loopStart, loopEnd;
+        if (player.getLoop(loopStart, loopEnd)) {
+            json += ",\"loop\":{\"start\":" + std::to_string(loopStart) + ",\"end\":" + (loopEnd < 0 ? "null" : std::to_string(loopEnd)) + "}";
+        }
+
+        // Stem groups list their stems so gain:/mute: have something to refer to
+        std::vector<Audio::Player::StemState> stems = player.getStems();
+        if (stems.size() > 1) {
+            json += ",\"stems\":[";
+            for (size_t i = 0; i < stems.size(); i++) {
+                if (i > 0) json += ",";
+                json += "{\"path\":\"" + HTTP::jsonEscape(stems[i].path) + "\",\"gain\":" + std::to_string(stems[i].gain);
+                json += std::string(",\"muted\":") + (stems[i].muted ? "true" : "false") + "}";
+            }
+            json += "]";
+        }
+        json += "}";
+        publishedQueueLength = audioQueue.size();
+
+        std::scoped_lock lock(stateMutex);
+        stateJson = json;
+        publishedInfo = currentInfo;
+        stateVersion++;
+    }
+
+    // Handler function implementations
+    void handleStopCommand() {
+        TRACE_SCOPE("handler.stop");
+        player.stop();
+        playingFromQueue = false; // Reset queue state when manually stopped
+    }
+
+    void handleNextCommand() {
+        TRACE_SCOPE("handler.next");
+        if (audioQueue.empty()) {
+            dropCommand("next");
+            return; // Nothing to play next
+        }
+
+        // Play next track from queue regardless of current playback state
+        playNextFromQueue();
+    }
+
+    void handlePrevCommand() {
+        TRACE_SCOPE("handler.prev");
+        if (playHistory.empty()) {
+            dropCommand("prev");
+            return; // No previous tracks
+        }
+
+        // Get previous track from history
+        std::string prevTrack = playHistory.front();
+        playHistory.pop_front();
+
+        // Put current track back at front of queue if it exists
+        if (!currentlyPlaying.empty()) {
+            audioQueue.push_front(currentlyPlaying);
+        }
+
+        // Update currently playing and play it
+        currentlyPlaying = prevTrack;
+        playEntry(prevTrack);
+        playingFromQueue = true;
+    }
+
+    // Record a benchmark run once its first sound is out (or it gave up)
+    void finishTtfsRun() {
+        std::scoped_lock lock(commandMutex);
+        if (!ttfsRun.isArmed()) return;
+
+        uint64_t firstSound = player.getFirstSoundAt();
+        if (firstSound) {
+            ttfsRun.mark(Bench::FirstSound, firstSound);
+            ttfsRun.finish();
+        } else if (ttfsRun.timedOut()) {
+            ttfsRun.finish();
+        }
+    }
+
+    // Dump the last N seconds of trace events as Chrome trace JSON next to the temp files
+    void handleTraceCommand(const std::string& arg) {
+        TRACE_SCOPE("handler.trace");
+        try {
+            double seconds;
+            if (!parseSeconds(arg, 10.0, seconds)) {
+                dropCommand("trace");
+                return;
+            }
+            std::filesystem::path file = std::filesystem::temp_directory_path() / "loud-trace.json";
+            std::ofstream out(file, std::ios::binary);
+            out << Trace::registry().exportChrome(seconds);
+            std::cout << "Trace written to " << file.string() << "\n";
+        } catch (const std::exception&) {
+            dropCommand("trace");
+        }
+    }
+
+    // Exiting the process, if it's a plain "q", is up to the Engine
+    void handleQuitCommand() {
+        TRACE_SCOPE("handler.quit");
+        // Stop any playing audio and clear state
+        player.stop();
+        playingFromQueue = false;
+        audioQueue.clear();
+        rotation.reset();
+        playHistory.clear();
+        currentlyPlaying.clear();
+        currentInfo.reset();
+    }
+
+    void handlePlayCommand(const std::string& filePath) {
+        TRACE_SCOPE("handler.play");
+        ttfsRun.mark(Bench::Dispatch);
+        try {
+            namespace fs = std::filesystem;
+            fs::path path(filePath);
+
+            if (!entryExists(filePath)) {
+                dropCommand("play");
+                return;
+            }
+
+            // Clear the queue when starting with a direct play command
+            audioQueue.clear();
+            rotation.reset();
+
+            if (!isStemGroup(filePath) && (fs::is_directory(path) || Zip::isArchive(filePath))) {
+                // For directories (and ZIP archives), add all files to the queue
+                std::vector<std::string> dirFiles;
+                collectAudioFiles(path, dirFiles);
+
+                if (dirFiles.empty()) {
+                    dropCommand("play");
+                    return;
+                }
+
+                // Shuffle the files (library.shuffle); only the first one is
+                // picked before playback starts. A weighted folder has no
+                // order: it plays as a rotation, one pick at a time.
+                std::string first;
+                std::unique_ptr<Shuffle::Order> order;
+                if (Config::current().shuffle == "weighted") {
+                    rotation = std::make_unique<Shuffle::Rotation>(dirFiles);
+                    first = rotation->pick();
+                } else {
+                    order = std::make_unique<Shuffle::Order>(std::move(dirFiles));
+                    order->next(first);
+                }
+
+                // Save current track to history
+                addToHistory(currentlyPlaying);
+
+                // Update currently playing track
+                currentlyPlaying = first;
+                ttfsRun.mark(Bench::FsChecked);
+
+                // Play first track
+                playEntry(first);
+                ttfsRun.mark(Bench::DecoderReady);
+
+                // Add rest to queue
+                std::string file;
+                while (order && order->next(file) && enqueue(file)) {}
+                refillFromRotation();
+
+                // We're playing from the queue now
+                playingFromQueue = true;
+            } else {
+                // Add current track to history
+                addToHistory(currentlyPlaying);
+
+                // Update currently playing
+                currentlyPlaying = filePath;
+                ttfsRun.mark(Bench::FsChecked);
+
+                // Play the file
+                playEntry(filePath);
+                ttfsRun.mark(Bench::DecoderReady);
+
+                // Since we're creating a new play command, we're now playing from queue
+                playingFromQueue = true;
+            }
+        } catch (const std::exception&) {
+            // Handle exception silently
+            dropCommand("play");
+        }
+    }
+
+    void handleQueueCommand(const std::string& filePath) {
+        TRACE_SCOPE("handler.queue");
+        try {
+            namespace fs = std::filesystem;
+            fs::path path(filePath);
+
+            if (!entryExists(filePath)) {
+                dropCommand("queue");
+                return;
+            }
+
+            if (!isStemGroup(filePath) && (fs::is_directory(path) || Zip::isArchive(filePath))) {
+                // For directories (and ZIP archives), add all files to the queue
+                std::vector<std::string> dirFiles;
+                collectAudioFiles(path, dirFiles);
+
+                if (dirFiles.empty()) {
+                    dropCommand("queue");
+                    return;
+                }
+
+                if (Config::current().shuffle == "weighted") {
+                    // The folder joins the rotation (or starts one)
+                    if (rotation) rotation->add(dirFiles);
+                    else rotation = std::make_unique<Shuffle::Rotation>(dirFiles);
+                    refillFromRotation();
+                } else {
+                    // Shuffle the files (library.shuffle) as they are added to the queue
+                    Shuffle::Order order(std::move(dirFiles));
+                    std::string file;
+                    while (order.next(file) && enqueue(file)) {}
+                }
+
+                // If nothing is currently playing, start playing from queue
+                if (currentlyPlaying.empty()) {
+                    playNextFromQueue();
+                } else {
+                    // If something is already playing, make sure we're in queue mode
+                    playingFromQueue = true;
+                }
+            } else {
+                if (!enqueue(filePath)) {
+                    dropCommand("queue");
+                    return;
+                }
+
+                // If nothing is currently playing, start playing this file
+                if (currentlyPlaying.empty()) {
+                    playNextFromQueue();
+                } else {
+                    // If something is already playing, make sure we're in queue mode
+                    playingFromQueue = true;
+                }
+            }
+        } catch (const std::exception&) {
+            // Handle exception silently
+            dropCommand("queue");
+        }
+    }
+
+    void handleLegacyCommand(const std::string& msg) {
+        TRACE_SCOPE("handler.legacy");
+        try {
+            if (entryExists(msg)) {
+                // Add to history if we're switching tracks
+                addToHistory(currentlyPlaying);
+
+                // Update currently playing
+                currentlyPlaying = msg;
+
+                // Since we're manually playing something, we're not playing from queue
+                playingFromQueue = false;
+            }
+
+            playEntry(msg);
+        } catch (const std::exception&) {
+            // Handle exception silently
+            dropCommand("legacy");
+        }
+    }
+
+    // Jump within the current track, e.g. seek:93.5
+    void handleSeekCommand(const std::string& arg) {
+        TRACE_SCOPE("handler.seek");
+        double seconds;
+        if (arg.empty() || !parseSeconds(arg, 0, seconds, MAX_TRACK_SECONDS) || !player.seek(seconds)) {
+            dropCommand("seek");
+        }
+        armedFor.clear(); // Back before the transition point, or past it
+    }
+
+    // loop:<start>:<end>, loop:<start>, loop:on or loop:off (see parseLoop)
+    void handleLoopCommand(const std::string& arg) {
+        TRACE_SCOPE("handler.loop");
+        bool enable;
+        double start, end;
+        if (!parseLoop(arg, enable, start, end)) {
+            dropCommand("loop");
+        } else if (!enable) {
+            player.clearLoop();
+        } else if (!player.setLoop(start, end)) {
+            dropCommand("loop");
+        }
+    }
+
+    // gain:<stem>:<gain> with linear gain 0..4; stems count from 0 as in "stems" of the status
+    void handleGainCommand(const std::string& arg) {
+        TRACE_SCOPE("handler.gain");
+        size_t stem;
+        float gain;
+        if (!parseStemGain(arg, stem, gain) || !player.setStemGain(stem, gain)) {
+            dropCommand("gain");
+        }
+    }
+
+    void handleMuteCommand(const std::string& arg, bool muted) {
+        TRACE_SCOPE("handler.mute");
+        size_t stem;
+        if (!parseStemIndex(arg, stem) || !player.setStemMuted(stem, muted)) {
+            dropCommand(muted ? "mute" : "unmute");
+        }
+    }
+
+    // chapter:next, chapter:prev (back to the start of the current chapter
+    // first, unless it only just began) or chapter:<n>. The jump is a plain
+    // seek, served from the MP3 seek table once one is built.
+    void handleChapterCommand(const std::string& arg) {
+        TRACE_SCOPE("handler.chapter");
+        int step;
+        size_t target;
+        if (!parseChapter(arg, step, target) || !currentInfo || currentInfo->tags.chapters.empty()) {
+            dropCommand("chapter");
+            return;
+        }
+
+        const std::vector<Tags::Chapter>& chapters = currentInfo->tags.chapters;
+        double position = double(player.getPosition()) / player.getSampleRate();
+        int current = Tags::chapterAt(chapters, position);
+        if (step > 0) {
+            target = static_cast<size_t>(current + 1);
+        } else if (step < 0) {
+            bool justStarted = current >= 0 && position - chapters[current].start < CHAPTER_RESTART_SECONDS;
+            target = static_cast<size_t>(std::max(0, justStarted ? current - 1 : current));
+        }
+
+        if (target >= chapters.size() || !player.seek(chapters[target].start)) {
+            dropCommand("chapter");
+        }
+        armedFor.clear();
+    }
+
+    // analyze:<file or folder>: beat grids for the library index, computed
+    // in the background (a folder is walked recursively, an archive entirely)
+    void handleAnalyzeCommand(const std::string& path) {
+        TRACE_SCOPE("handler.analyze");
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::path target = fs::u8path(path);
+        if (Zip::isArchive(path)) {
+            for (const auto& entry : Zip::audioEntries(path)) Analysis::queue().request(entry);
+        } else if (fs::is_directory(target, ec)) {
+            Analysis::queue().requestTree(path);
+        } else if (Zip::isEntryPath(path) && Zip::exists(path) && Config::current().isAudioFile(path)) {
+            Analysis::queue().request(path);
+        } else if (fs::is_regular_file(target, ec) && Config::current().isAudioFile(path)) {
+            Analysis::queue().request(path);
+        } else {
+            dropCommand("analyze");
+        }
+    }
+
+    // Re-arm the beat transition about once a second (call without commandMutex)
+    void followTransitions() {
+        std::scoped_lock lock(commandMutex);
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastArmCheck < ARM_INTERVAL) return;
+        lastArmCheck = now;
+        armTransition();
+
+        // Show the tempo once the current track's analysis is in
+        if (currentInfo && !currentInfo->analysed) {
+            std::shared_ptr<const Library::TrackInfo> info = Library::index().lookup(currentlyPlaying);
+            if (info && info->analysed) {
+                currentInfo = info;
+                publishState();
+            }
+        }
+    }
+
+    // With [mix] transition = beat, have the player crossfade from the current
+    // track into the front of the queue on matching downbeats (see
+    // planTransition). Tracks that haven't been analysed yet are queued for
+    // analysis ahead of bulk requests, and arming is retried on a later tick.
+    void armTransition() {
+        const Config::Settings& settings = Config::current();
+        std::string next = audioQueue.empty() ? std::string() : audioQueue.front();
+        std::string key = settings.transition + (playingFromQueue ? "\n" : "\r") + currentlyPlaying + "\n" + next;
+        if (key == armedFor) return;
+        if (player.transitionTarget() == currentlyPlaying && !currentlyPlaying.empty()) return; // Still gliding out of the last one
+
+        bool wanted = settings.transition == "beat" && playingFromQueue && !next.empty() && !isStemGroup(currentlyPlaying) && !isStemGroup(next);
+        std::shared_ptr<const Library::TrackInfo> out = wanted ? Library::index().lookup(currentlyPlaying) : nullptr;
+        std::shared_ptr<const Library::TrackInfo> in = wanted ? Library::index().lookup(next) : nullptr;
+        if (!out || !in) {
+            player.cancelTransition();
+            armedFor = key;
+            return;
+        }
+        if (!out->analysed || !in->analysed) {
+            if (!out->analysed) Analysis::queue().request(currentlyPlaying, true);
+            if (!in->analysed) Analysis::queue().request(next, true);
+            player.cancelTransition();
+            return;
+        }
+
+        armedFor = key;
+        double outSeconds, inSeconds, fadeSeconds, rate;
+        if (!planTransition(out->beats, in->beats, settings, outSeconds, inSeconds, fadeSeconds, rate) ||
+            !player.prepareTransition(next, outSeconds, inSeconds, fadeSeconds, rate)) {
+            player.cancelTransition(); // Plain cut at the end of the track
+        }
+    }
+
+    // Fade from the last downbeat of out that leaves room for the whole fade
+    // (transition_beats long) into the first downbeat of in. in is played
+    // faster or slower to match out's tempo, or at double or half its tempo,
+    // if that takes no more than max_stretch; otherwise at its own speed.
+    static bool planTransition(const Beat::Grid& out, const Beat::Grid& in, const Config::Settings& settings,
+                               double& outSeconds, double& inSeconds, double& fadeSeconds, double& rate) {
+        if (out.bpm <= 0 || in.bpm <= 0 || out.duration <= 0 || in.duration <= 0) return false;
+        if (out.confidence < BEAT_MIN_CONFIDENCE || in.confidence < BEAT_MIN_CONFIDENCE) return false;
+
+        rate = 1.0;
+        double closest = settings.maxStretch;
+        for (double octave : {1.0, 2.0, 0.5}) {
+            double candidate = out.bpm / (in.bpm * octave);
+            if (std::fabs(candidate - 1.0) <= closest) {
+                closest = std::fabs(candidate - 1.0);
+                rate = candidate;
+            }
+        }
+
+        fadeSeconds = settings.transitionBeats * out.beatSeconds();
+        double latest = out.duration - fadeSeconds;
+        if (latest < out.firstDownbeat) return false;
+        outSeconds = out.firstDownbeat + std::floor((latest - out.firstDownbeat) / out.barSeconds()) * out.barSeconds();
+        inSeconds = in.firstDownbeat;
+        return inSeconds + fadeSeconds * rate < in.duration;
+    }
+
+    // Queue entries are files (possibly inside a ZIP archive) or stem groups
+    // (see STEMS_PREFIX)
+    static bool entryExists(const std::string& entry) {
+        if (!isStemGroup(entry)) return Zip::exists(entry);
+        for (const auto& path : stemPaths(entry)) {
+            if (!Zip::exists(path)) return false;
+        }
+        return true;
+    }
+
+    // Tags are looked up once playback has started, so a first read of a
+    // big tag doesn't delay the first sound
+    void playEntry(const std::string& entry) {
+        if (isStemGroup(entry)) {
+            player.playStems(stemPaths(entry));
+            currentInfo.reset();
+        } else {
+            player.play(entry);
+            countPlay(entry);
+            currentInfo = Library::index().lookup(entry);
+            // Beat transitions out of this track need its grid
+            if (currentInfo && !currentInfo->analysed && Config::current().transition == "beat") {
+                Analysis::queue().request(entry, true);
+            }
+        }
+        armedFor.clear(); // The player dropped any transition; tick() arms a new one
+    }
+
+    // Append to the queue unless it already holds library.max_queue tracks
+    bool enqueue(const std::string& track) {
+        if (audioQueue.size() >= Config::current().maxQueue) return false;
+        audioQueue.push_back(track);
+        return true;
+    }
+
+    // Keep the rotation's next pick in the queue, so "n" and beat transitions
+    // see it. Only once the queue has run dry: queued tracks go first.
+    void refillFromRotation() {
+        if (rotation && audioQueue.empty() && rotation->size() > 0) enqueue(rotation->pick());
+    }
+
+    // Play statistics for weighted shuffle
+    void countPlay(const std::string& track) {
+        int64_t now = Library::unixSeconds();
+        Library::index().recordPlay(track, now);
+        if (rotation) rotation->played(track, now);
+    }
+
+    // Helper function to add a track to history
+    void addToHistory(const std::string& track) {
+        if (track.empty()) return;
+
+        playHistory.push_front(track);
+        // Keep history size limited
+        if (playHistory.size() > Config::current().historySize) {
+            playHistory.pop_back();
+        }
+    }
+
+    // Helper function to collect audio files from a directory (or a ZIP
+    // archive, whose central directory lists them)
+    static int collectAudioFiles(const std::filesystem::path& dirPath, std::vector<std::string>& outFiles) {
+        static auto& scanDuration = Metrics::histogram("loud_scan_duration_seconds", "Time to scan a directory for audio files");
+        static auto& scannedFiles = Metrics::counter("loud_scan_files_total", "Audio files found by directory scans");
+        Metrics::ScopedTimer scanTimer(scanDuration);
+        int count = 0;
+        namespace fs = std::filesystem;
+
+        if (Zip::isArchive(dirPath.string())) {
+            for (auto& entryPath : Zip::audioEntries(dirPath.string())) {
+                outFiles.push_back(std::move(entryPath));
+                count++;
+            }
+            scannedFiles.add(count);
+            return count;
+        }
+
+        for (const auto& entry : fs::directory_iterator(dirPath)) {
+            if (entry.is_regular_file()) {
+                // Check for audio files
+                std::string entryPath = entry.path().string();
+
+                // Same extension list as the player (library.extensions)
+                if (Config::current().isAudioFile(entryPath)) {
+                    outFiles.push_back(entryPath);
+                    count++;
+                }
+            }
+        }
+
+        scannedFiles.add(count);
+        return count;
+    }
+};
+
+// The whole daemon: one or more zones (see [zones] in loud.ini), each with
+// its own player, queue and output device, plus what they share: the audio
+// context, the library index, the worker pool, one watchdog thread and the
+// UDP/HTTP transports. loud.exe is a thin WinMain around one Engine;
+// benchmarks and other hosts can create their own and call handleCommand()
+// directly, without sockets.
+//
+// Commands pick a zone with an "@<zone>:" prefix; without one they go to
+// the first zone, so single-room setups never notice zones exist.
+class Engine {
+public:
+    struct Options {
+        bool offline = false;   // Render on the null device (see Audio::Player)
+        bool watchdog = true;   // Watch the audio callbacks for stalls
+    };
+
+    // Throws if no zone could open its device
+    explicit Engine(Options options) : offline(options.offline), context(options.offline) {
+        std::vector<Config::Settings::Zone> configured = Config::current().zones;
+        if (configured.empty()) configured.push_back({DEFAULT_ZONE, ""});
+
+        for (const auto& entry : configured) {
+            std::string device = deviceOf(entry);
+            try {
+                if (entry.channels > 0) {
+                    Audio::SharedDevice* shared = sharedDevice(device, configured);
+                    if (!shared) continue; // Already reported
+                    zones.push_back(std::make_unique<Zone>(entry.id, context, *shared, entry.firstChannel, entry.channels));
+                } else {
+                    zones.push_back(std::make_unique<Zone>(entry.id, context, device));
+                }
+            } catch (const std::exception& e) {
+                // One unplugged room shouldn't silence the others
+                std::cerr << "Zone " << entry.id << " disabled: " << e.what() << std::endl;
+            }
+        }
+        if (zones.empty()) {
+            throw std::runtime_error("No zone could open its output device");
+        }
+
+        for (const auto& entry : Config::current().mirrors) {
+            Zone* target = zone(entry.first);
+            if (!target) {
+                std::cerr << "Mirror for unknown zone " << entry.first << " ignored" << std::endl;
+                continue;
+            }
+            try {
+                target->mirrorTo(context, options.offline ? "" : entry.second);
+            } catch (const std::exception& e) {
+                std::cerr << "Mirror of zone " << entry.first << " disabled: " << e.what() << std::endl;
+            }
+        }
+
+        // Log (and dump a trace for) audio stalls instead of failing silently
+        if (options.watchdog) {
+            const Config::Settings& settings = Config::current();
+            Audio::Watchdog::Options watchdogOptions;
+            watchdogOptions.stallThreshold = std::chrono::milliseconds(settings.stallMs);
+            watchdogOptions.decoderThreshold = std::chrono::milliseconds(settings.decoderMs);
+            watchdogOptions.traceSeconds = settings.traceSeconds;
+            watchdogOptions.restartDevice = settings.restartDevice;
+
+            // Zone names only clutter the log when there is just the one
+            std::vector<std::pair<std::string, Audio::Player*>> watched;
+            for (auto& zone : zones) {
+                watched.emplace_back(zones.size() > 1 ? zone->id() : "", &zone->getPlayer());
+            }
+            watchdog = std::make_unique<Audio::Watchdog>(watched, watchdogOptions);
+        }
+    }
+
+    ~Engine() {
+        // Transports first, so no command arrives while the rest goes away
+        if (http) {
+            for (auto& zone : zones) {
+                Metrics::registry().removeGauge("loud_queue_length", zoneLabel(*zone));
+                if (zone->getMirror()) Metrics::registry().removeGauge("loud_mirror_drift_ppm", zoneLabel(*zone));
+            }
+            Metrics::registry().removeGauge("loud_events_dropped_frames");
+            Metrics::registry().removeGauge("loud_stream_evicted_listeners");
+        }
+        http.reset();
+        receiver.reset();
+        watchdog.reset();
+        zones.clear();
+        sharedDevices.clear();
+        Library::index().saveIfDirty(true);
+    }
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    // Listen for commands on the configured UDP port, and serve the HTTP
+    // control surface and WebSocket event stream for browser dashboards
+    void startTransports() {
+        const Config::Settings& settings = Config::current();
+        receiver = std::make_unique<UDP::Receiver>(settings.udpPort, [this](const std::string& msg) {
+            handleCommand(msg);
+        });
+
+        try {
+            http = std::make_unique<HTTP::Server>(settings.httpPort, settings.httpBind, settings.allowOrigin);
+            setupHttp(*http);
+            http->start();
+        } catch (const std::exception& e) {
+            std::cerr << "HTTP server disabled: " << e.what() << std::endl;
+            http.reset();
+        }
+    }
+
+    // Dispatch a single command, whichever transport it arrived on. Returns
+    // the zone that ran it, or nullptr if it named a zone that isn't running.
+    Zone* handleCommand(const std::string& msg) {
+        Command command = parseCommand(msg);
+
+        Zone* target = command.zone.empty() ? zones.front().get() : zone(command.zone);
+        if (!target) {
+            countCommand(command.name());
+            dropCommand("zone");
+            return nullptr;
+        }
+
+        // A plain "q" still means the whole daemon: every zone stops, then
+        // the process exits unless the host takes over
+        if (command.type == Command::Quit && command.zone.empty()) {
+            countCommand(command.name());
+            for (auto& zone : zones) zone->reset();
+            std::function<void()> callback;
+            {
+                std::scoped_lock lock(quitMutex);
+                callback = onQuit;
+            }
+            if (callback) {
+                callback();
+            } else {
+                // quit() exits on the spot and ~Engine never runs
+                Library::index().saveIfDirty(true);
+                zones.front()->getPlayer().quit();
+            }
+            return target;
+        }
+
+        target->handleCommand(command);
+        return target;
+    }
+
+    // Housekeeping the host calls every ~100 ms from its main loop
+    void tick() {
+        for (auto& zone : zones) zone->tick();
+        Library::index().saveIfDirty();
+        Memory::governor().poll();
+    }
+
+    // Latest track/queue snapshot of the first zone as JSON
+    std::string currentState() { return zones.front()->currentState(); }
+
+    // The zone with this id, or nullptr
+    Zone* zone(const std::string& id) {
+        for (auto& zone : zones) {
+            if (zone->id() == id) return zone.get();
+        }
+        return nullptr;
+    }
+
+    const std::vector<std::unique_ptr<Zone>>& getZones() const { return zones; }
+
+    // What "q" does once playback is stopped and the queues cleared. By
+    // default the process exits; embedding hosts can handle it themselves.
+    void setOnQuit(std::function<void()> callback) {
+        std::scoped_lock lock(quitMutex);
+        onQuit = callback;
+    }
+
+    // The first zone's player
+    Audio::Player& getPlayer() { return zones.front()->getPlayer(); }
+
+private:
+    bool offline;
+    Audio::Context context;
+    // Multichannel devices split between zones, by device name; null if it
+    // failed to open. Declared before the zones so they go away after them.
+    std::map<std::string, std::unique_ptr<Audio::SharedDevice>> sharedDevices;
+    std::vector<std::unique_ptr<Zone>> zones;
+    std::unique_ptr<Audio::Watchdog> watchdog;
+    std::unique_ptr<UDP::Receiver> receiver;
+    std::unique_ptr<HTTP::Server> http;
+    std::mutex quitMutex;
+    std::function<void()> onQuit;
+
+    static constexpr int EVENT_INTERVAL_MS = 100;
+
+    // Offline, every zone plays on the one null device
+    std::string deviceOf(const Config::Settings::Zone& entry) const {
+        return offline ? "" : entry.device;
+    }
+
+    // The shared device for zones routed to channels of `device`, opened the
+    // first time with enough channels for all of them; null if it won't open
+    Audio::SharedDevice* sharedDevice(const std::string& device, const std::vector<Config::Settings::Zone>& configured) {
+        auto found = sharedDevices.find(device);
+        if (found != sharedDevices.end()) return found->second.get();
+
+        uint32_t channels = 0;
+        for (const auto& entry : configured) {
+            if (entry.channels > 0 && deviceOf(entry) == device) {
+                channels = std::max(channels, entry.firstChannel + entry.channels);
+            }
+        }
+
+        std::unique_ptr<Audio::SharedDevice> shared;
+        try {
+            shared = std::make_unique<Audio::SharedDevice>(context, device, channels);
+        } catch (const std::exception& e) {
+            std::cerr << "Zones on " << (device.empty() ? "the default device" : device) << " disabled: " << e.what() << std::endl;
+        }
+        return (sharedDevices[device] = std::move(shared)).get();
+    }
+
+    static std::string zoneLabel(const Zone& zone) {
+        return "zone=\"" + zone.id() + "\"";
+    }
+
+    // RIFF header for a stream of unknown length (sizes set to the maximum)
+    static std::string wavStreamHeader(uint32_t sampleRate, uint16_t channels, uint16_t bitsPerSample) {
+        std::string header;
+        auto put32 = [&](uint32_t v) { for (int i = 0; i < 4; i++) header += static_cast<char>((v >> (i * 8)) & 0xFF); };
+        auto put16 = [&](uint16_t v) { for (int i = 0; i < 2; i++) header += static_cast<char>((v >> (i * 8)) & 0xFF); };
+
+        uint16_t blockAlign = channels * bitsPerSample / 8;
+        header += "RIFF";
+        put32(0xFFFFFFFF);
+        header += "WAVEfmt ";
+        put32(16);
+        put16(1); // PCM
+        put16(channels);
+        put32(sampleRate);
+        put32(sampleRate * blockAlign);
+        put16(blockAlign);
+        put16(bitsPerSample);
+        header += "data";
+        put32(0xFFFFFFFF);
+        return header;
+    }
+
+    // Zone a request is for: ?zone=<id>, or the first zone without one
+    Zone* requestZone(const HTTP::Request& request) {
+        std::string id = request.param("zone");
+        return id.empty() ? zones.front().get() : zone(id);
+    }
+
+    // Routes and the event stream tick; everything here runs on the HTTP event loop thread
+    void setupHttp(HTTP::Server& server) {
+        // Same command strings as the UDP protocol, POSTed as the body (GETs
+        // get prefetched and replayed, commands change state); ?zone=<id>
+        // works like an "@<id>:" prefix
+        server.route("/cmd", [this](const HTTP::Request& request) {
+            if (request.method != "POST") {
+                return HTTP::Response{405, "text/plain", "Use POST with the command as body\n", {{"Allow", "POST"}}};
+            }
+            std::string msg = request.body;
+            std::string id = request.param("zone");
+            if (!id.empty() && (msg.empty() || msg[0] != '@')) msg = "@" + id + ":" + msg;
+            Zone* target = handleCommand(msg);
+            if (!target) return HTTP::Response{404, "text/plain", "Unknown zone\n"};
+            return HTTP::Response{200, "application/json", target->currentState()};
+        });
+
+        // The zone's state plus the daemon's memory use per cache (sys/memory.h)
+        server.route("/status", [this](const HTTP::Request& request) {
+            Zone* target = requestZone(request);
+            if (!target) return HTTP::Response{404, "text/plain", "Unknown zone\n"};
+            std::string json = target->currentState();
+            json.insert(json.size() - 1, std::string(json.size() > 2 ? "," : "") + "\"memory\":" + Memory::governor().json());
+            return HTTP::Response{200, "application/json", json};
+        });
+
+        // Every zone with its state, for dashboards that show the whole house
+        server.route("/zones", [this](const HTTP::Request&) {
+            std::string json = "[";
+            for (size_t i = 0; i < zones.size(); i++) {
+                if (i > 0) json += ",";
+                json += "{\"id\":\"" + HTTP::jsonEscape(zones[i]->id()) + "\",\"state\":" + zones[i]->currentState() + "}";
+            }
+            json += "]";
+            return HTTP::Response{200, "application/json", json};
+        });
+
+        // Chrome trace of the last s seconds (default 10)
+        server.route("/trace", [](const HTTP::Request& request) {
+            double seconds;
+            if (!parseSeconds(request.param("s"), 10.0, seconds)) {
+                return HTTP::Response{400, "text/plain", "Bad seconds\n"};
+            }
+            return HTTP::Response{200, "application/json", Trace::registry().exportChrome(seconds)};
+        });
+
+        // Prometheus text exposition
+        for (auto& zone : zones) {
+            Zone* z = zone.get();
+            Metrics::gauge("loud_queue_length", "Tracks waiting in the queue", [z]() { return double(z->queueLength()); }, zoneLabel(*z));
+            if (const Audio::Mirror* mirror = z->getMirror()) {
+                Metrics::gauge("loud_mirror_drift_ppm", "Measured clock drift of a mirror device against its zone", [mirror]() { return mirror->driftPpm(); }, zoneLabel(*z));
+            }
+        }
+        Metrics::gauge("process_resident_memory_bytes", "Resident memory size in bytes", Metrics::residentMemoryBytes);
+        Metrics::gauge("loud_events_dropped_frames", "Event frames skipped for slow WebSocket clients", [&server]() { return double(server.getDroppedFrames()); });
+        Metrics::gauge("loud_stream_evicted_listeners", "Stream listeners disconnected for lagging", [&server]() { return double(server.getEvictedListeners()); });
+        server.route("/metrics", [](const HTTP::Request&) {
+            return HTTP::Response{200, "text/plain; version=0.0.4", Metrics::registry().render()};
+        });
+
+        // Per zone: live output for LAN listeners as an endless 16-bit stereo
+        // WAV, and the event stream. The first zone also keeps the plain
+        // /stream.wav and /events paths.
+        for (size_t i = 0; i < zones.size(); i++) {
+            Zone* z = zones[i].get();
+            std::string base = "/zones/" + z->id();
+            std::vector<std::string> streamPaths = {base + "/stream.wav"};
+            std::vector<std::string> eventPaths = {base + "/events"};
+            if (i == 0) {
+                streamPaths.push_back("/stream.wav");
+                eventPaths.push_back("/events");
+            }
+
+            for (const std::string& path : streamPaths) {
+                Audio::Player& player = z->getPlayer();
+                HTTP::Stream stream;
+                stream.contentType = "audio/wav";
+                stream.header = [&player]() { return wavStreamHeader(player.getSampleRate(), 2, 16); };
+                stream.head = [&player]() { return player.getStreamRing().head(); };
+                stream.peek = [&player](uint64_t cursor, size_t& length) { return player.getStreamRing().peek(cursor, length); };
+                stream.maxLag = player.getStreamRing().maxLag();
+                stream.onListeners = [z, path](size_t listeners) { z->setStreamListeners(path, listeners); };
+                server.stream(path, stream);
+            }
+
+            // New clients get the full state first, then batched updates every tick
+            for (const std::string& path : eventPaths) {
+                server.websocket(path, [z]() {
+                    return "{\"zone\":\"" + HTTP::jsonEscape(z->id()) + "\",\"state\":" + z->currentState() + "}";
+                });
+            }
+
+            eventRoutes.push_back({z, eventPaths});
+        }
+
+        server.onTick(std::chrono::milliseconds(EVENT_INTERVAL_MS), [this, &server]() {
+            for (const auto& route : eventRoutes) {
+                // Meters are reset on read, so take them even when nobody listens
+                std::vector<float> peaks = route.zone->getPlayer().takePeaks();
+                bool listened = false;
+                for (const std::string& path : route.paths) listened = listened || server.clientCount(path) > 0;
+                if (!listened) continue;
+
+                std::string json = route.zone->eventFrame(peaks);
+                for (const std::string& path : route.paths) {
+                    if (server.clientCount(path) > 0) server.broadcast(path, json);
+                }
+            }
+        });
+    }
+
+    // Event stream paths of each zone (set up before the server starts)
+    struct EventRoute {
+        Zone* zone;
+        std::vector<std::string> paths;
+    };
+    std::vector<EventRoute> eventRoutes;
+};
+
+} // namespace Loud
@@ -0,0 +1,644 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include "ws.h"
+#include "../sys/trace.h"
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <errno.h>
+#endif
+
+namespace HTTP {
+
+#ifdef _WIN32
+    using SocketHandle = SOCKET;
+    using PollFd = WSAPOLLFD;
+    const SocketHandle InvalidSocket = INVALID_SOCKET;
+
+    inline int pollSockets(PollFd* fds, size_t count, int timeoutMs) { return WSAPoll(fds, static_cast<ULONG>(count), timeoutMs); }
+    inline void closeSocket(SocketHandle s) { closesocket(s); }
+    inline bool wouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+    inline void setNonBlocking(SocketHandle s) { u_long mode = 1; ioctlsocket(s, FIONBIO, &mode); }
+    const int SendFlags = 0;
+#else
+    using SocketHandle = int;
+    using PollFd = pollfd;
+    const SocketHandle InvalidSocket = -1;
+
+    inline int pollSockets(PollFd* fds, size_t count, int timeoutMs) { return ::poll(fds, count, timeoutMs); }
+    inline void closeSocket(SocketHandle s) { ::close(s); }
+    inline bool wouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+    inline void setNonBlocking(SocketHandle s) { fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK); }
+    const int SendFlags = MSG_NOSIGNAL; // Don't die on SIGPIPE when a browser goes away
+#endif
+
+// Decode %XX escapes and '+' in query strings
+inline std::string urlDecode(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            out += ' ';
+        } else if (s[i] == '%' && i + 2 < s.size() && std::isxdigit((unsigned char)s[i + 1]) && std::isxdigit((unsigned char)s[i + 2])) {
+            out += static_cast<char>(std::stoi(s.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+// Escape a string for embedding in a JSON document
+inline std::string jsonEscape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size() + 2);
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char esc[8];
+                    std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    out += esc;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out;
+}
+
+struct Request {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::map<std::string, std::string> headers; // Keys are lowercased
+    std::string body;
+
+    std::string header(const std::string& name) const {
+        auto it = headers.find(name);
+        return it != headers.end() ? it->second : std::string();
+    }
+
+    // Value of a query string parameter, URL-decoded
+    std::string param(const std::string& name) const {
+        size_t pos = 0;
+        while (pos <= query.size()) {
+            size_t end = query.find('&', pos);
+            if (end == std::string::npos) end = query.size();
+            std::string pair = query.substr(pos, end - pos);
+            size_t eq = pair.find('=');
+            if (urlDecode(pair.substr(0, eq)) == name) {
+                return eq == std::string::npos ? std::string() : urlDecode(pair.substr(eq + 1));
+            }
+            pos = end + 1;
+        }
+        return std::string();
+    }
+};
+
+struct Response {
+    int status = 200;
+    std::string contentType = "text/plain; charset=utf-8";
+    std::string body;
+    std::map<std::string, std::string> headers; // Extra header lines, e.g. Allow for a 405
+};
+
+// Endless byte stream shared by all listeners of an endpoint. The producer
+// publishes into a ring; each listener is sent data straight from it using
+// its own cursor, so the payload is produced once however many listen.
+struct Stream {
+    std::string contentType;
+    std::function<std::string()> header;                                // Sent once before the data
+    std::function<uint64_t()> head;                                     // Bytes produced so far
+    std::function<const uint8_t*(uint64_t cursor, size_t& length)> peek; // Contiguous bytes at cursor
+    uint64_t maxLag = 0;                                                // Listeners further behind are evicted
+    std::function<void(size_t listeners)> onListeners;                  // Listener count changed
+};
+
+// Small single-threaded HTTP/1.1 server with WebSocket endpoints.
+// All sockets are non-blocking and serviced from one event loop thread;
+// route handlers, greetings and tick callbacks run on that thread.
+//
+// The server listens on one IPv4 address (loopback unless told otherwise).
+// Browsers are only let in from allowOrigin: requests that carry an Origin
+// header are refused unless it matches ("*" allows any), and that origin is
+// the one sent back in Access-Control-Allow-Origin. Without one, only
+// clients that send no Origin (curl, scripts, players) get through.
+class Server {
+public:
+    using Handler = std::function<Response(const Request& request)>;
+    using Greeting = std::function<std::string()>;
+    using TickCallback = std::function<void()>;
+
+    // Per-client limits: slow WebSocket clients drop frames instead of buffering
+    static constexpr size_t MAX_PENDING_BYTES = 64 * 1024;
+    static constexpr size_t MAX_REQUEST_BYTES = 16 * 1024;
+    static constexpr size_t MAX_CONNECTIONS = 1024;
+
+    Server(uint16_t port, const std::string& bindAddress = "127.0.0.1", std::string allowOrigin = std::string())
+        : port(port), allowOrigin(std::move(allowOrigin)), running(false) {
+#ifdef _WIN32
+        WSADATA statusData;
+        WSAStartup(MAKEWORD(2,2), &statusData);
+#endif
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == InvalidSocket) {
+            throw std::runtime_error("Failed to create HTTP socket");
+        }
+
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char*>(&opt), sizeof(opt));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr(bindAddress.c_str());
+        if (addr.sin_addr.s_addr == INADDR_NONE && bindAddress != "255.255.255.255") {
+            closeSocket(sock);
+            throw std::runtime_error("Bad HTTP bind address " + bindAddress);
+        }
+
+        if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 64) < 0) {
+            closeSocket(sock);
+            throw std::runtime_error("Failed to bind HTTP socket");
+        }
+
+        setNonBlocking(sock);
+    }
+
+    ~Server() {
+        running = false;
+        if (loopThread.joinable()) loopThread.join();
+        for (auto& c : connections) closeSocket(c->sock);
+        closeSocket(sock);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    // Register a plain request handler (call before start)
+    void route(const std::string& path, Handler handler) {
+        routes[path] = handler;
+    }
+
+    // Register a streaming endpoint (call before start)
+    void stream(const std::string& path, Stream source) {
+        streams[path] = source;
+    }
+
+    // Register a WebSocket endpoint; greeting, if set, is sent to each new client
+    void websocket(const std::string& path, Greeting greeting = nullptr) {
+        sockets[path] = greeting;
+    }
+
+    // Periodic callback on the event loop thread (call before start)
+    void onTick(std::chrono::milliseconds interval, TickCallback callback) {
+        tickInterval = interval;
+        tickCallback = callback;
+    }
+
+    void start() {
+        running = true;
+        loopThread = std::thread([this]() { this->loop(); });
+    }
+
+    // Queue a text message for every client of a WebSocket endpoint.
+    // The frame is encoded once; clients that are too far behind skip it.
+    // Only call from the event loop thread (handlers or tick callback).
+    void broadcast(const std::string& path, const std::string& text) {
+        std::string encoded = WS::frame(WS::Text, text);
+        for (auto& c : connections) {
+            if (c->kind != Kind::WebSocket || c->path != path || c->dead) continue;
+            if (c->out.size() - c->outOffset + encoded.size() > MAX_PENDING_BYTES) {
+                c->droppedFrames++;
+                droppedFrames++;
+                continue;
+            }
+            c->out += encoded;
+        }
+    }
+
+    // Number of connected clients on a WebSocket endpoint (event loop thread only)
+    size_t clientCount(const std::string& path) const {
+        size_t count = 0;
+        for (auto& c : connections) {
+            if (c->kind == Kind::WebSocket && c->path == path && !c->dead) count++;
+        }
+        return count;
+    }
+
+    uint64_t getDroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+    uint64_t getEvictedListeners() const { return evictedListeners.load(std::memory_order_relaxed); }
+
+private:
+    enum class Kind { Http, WebSocket, Stream };
+
+    // Stream listeners are polled at least this often so audio keeps flowing
+    static constexpr int STREAM_POLL_MS = 20;
+
+    struct Connection {
+        SocketHandle sock;
+        Kind kind = Kind::Http;
+        std::string path;
+        std::string in;
+        std::string out;
+        size_t outOffset = 0;
+        bool closeAfterFlush = false;
+        bool dead = false;
+        uint64_t droppedFrames = 0;
+        Stream* stream = nullptr;
+        uint64_t cursor = 0;
+    };
+
+    void loop() {
+        TRACE_THREAD_NAME("http");
+        auto nextTick = std::chrono::steady_clock::now() + tickInterval;
+        std::vector<PollFd> fds;
+
+        while (running) {
+            fds.clear();
+            PollFd listenFd{};
+            listenFd.fd = sock;
+            listenFd.events = POLLIN;
+            fds.push_back(listenFd);
+
+            for (auto& c : connections) {
+                PollFd fd{};
+                fd.fd = c->sock;
+                fd.events = POLLIN;
+                if (c->out.size() > c->outOffset) fd.events |= POLLOUT;
+                if (c->kind == Kind::Stream && c->cursor < c->stream->head()) fd.events |= POLLOUT;
+                fds.push_back(fd);
+            }
+
+            // Wake up for the next tick, but never sleep long so shutdown stays responsive
+            int timeoutMs = 100;
+            if (tickCallback) {
+                auto untilTick = std::chrono::duration_cast<std::chrono::milliseconds>(nextTick - std::chrono::steady_clock::now()).count();
+                timeoutMs = static_cast<int>(std::clamp<long long>(untilTick, 0, 100));
+            }
+            if (listenerCount > 0) timeoutMs = std::min(timeoutMs, STREAM_POLL_MS);
+
+            int ready = pollSockets(fds.data(), fds.size(), timeoutMs);
+            if (ready > 0) {
+                // Only the connections that existed when polling have a slot in fds
+                size_t polled = fds.size() - 1;
+                for (size_t i = 0; i < polled; ++i) {
+                    auto& c = connections[i];
+                    short revents = fds[i + 1].revents;
+                    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                        // Still drain what the peer sent before hanging up
+                        if (revents & POLLIN) readFrom(*c);
+                        if (!(revents & POLLIN)) c->dead = true;
+                    } else {
+                        if (revents & POLLIN) readFrom(*c);
+                        if (revents & POLLOUT) flush(*c);
+                    }
+                }
+
+                if (fds[0].revents & POLLIN) acceptClients();
+            }
+
+            if (tickCallback && std::chrono::steady_clock::now() >= nextTick) {
+                nextTick += tickInterval;
+                // Don't try to catch up after a long stall
+                if (nextTick < std::chrono::steady_clock::now()) nextTick = std::chrono::steady_clock::now() + tickInterval;
+                try {
+                    TRACE_SCOPE("http.tick");
+                    tickCallback();
+                } catch (const std::exception& e) {
+                    std::cerr << "HTTP tick error: " << e.what() << std::endl;
+                }
+            }
+
+            // Push out anything queued this iteration right away
+            for (auto& c : connections) {
+                if (c->dead) continue;
+                if (c->out.size() > c->outOffset) flush(*c);
+                if (c->kind == Kind::Stream && !c->dead) pumpStream(*c);
+            }
+
+            removeDead();
+        }
+    }
+
+    void acceptClients() {
+        while (true) {
+            sockaddr_in from{};
+            socklen_t fromLen = sizeof(from);
+            SocketHandle client = accept(sock, (sockaddr*)&from, &fromLen);
+            if (client == InvalidSocket) break;
+
+            if (connections.size() >= MAX_CONNECTIONS) {
+                closeSocket(client);
+                continue;
+            }
+
+            setNonBlocking(client);
+            int opt = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&opt), sizeof(opt));
+
+            auto c = std::make_unique<Connection>();
+            c->sock = client;
+            connections.push_back(std::move(c));
+        }
+    }
+
+    void readFrom(Connection& c) {
+        char buffer[4096];
+        while (true) {
+            int len = recv(c.sock, buffer, sizeof(buffer), 0);
+            if (len > 0) {
+                c.in.append(buffer, len);
+                continue;
+            }
+            if (len == 0 || !wouldBlock()) c.dead = true;
+            break;
+        }
+
+        if (!c.dead) {
+            if (c.kind == Kind::Http) processHttp(c);
+            else if (c.kind == Kind::WebSocket) processWebSocket(c);
+            else c.in.clear(); // Listeners have nothing to say
+        }
+    }
+
+    void processHttp(Connection& c) {
+        size_t headerEnd = c.in.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) {
+            if (c.in.size() > MAX_REQUEST_BYTES) respond(c, {431, "text/plain", "Request header too large\n"});
+            return;
+        }
+
+        Request request;
+        std::string head = c.in.substr(0, headerEnd);
+        size_t lineEnd = head.find("\r\n");
+        std::string requestLine = head.substr(0, lineEnd);
+
+        size_t sp1 = requestLine.find(' ');
+        size_t sp2 = requestLine.find(' ', sp1 + 1);
+        if (sp1 == std::string::npos || sp2 == std::string::npos) {
+            respond(c, {400, "text/plain", "Bad request\n"});
+            return;
+        }
+        request.method = requestLine.substr(0, sp1);
+        std::string target = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+        size_t q = target.find('?');
+        request.path = target.substr(0, q);
+        if (q != std::string::npos) request.query = target.substr(q + 1);
+
+        size_t pos = lineEnd == std::string::npos ? head.size() : lineEnd + 2;
+        while (pos < head.size()) {
+            size_t end = head.find("\r\n", pos);
+            if (end == std::string::npos) end = head.size();
+            std::string line = head.substr(pos, end - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::string key = line.substr(0, colon);
+                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                size_t valueStart = line.find_first_not_of(' ', colon + 1);
+                request.headers[key] = valueStart == std::string::npos ? std::string() : line.substr(valueStart);
+            }
+            pos = end + 2;
+        }
+
+        // Wait for the whole body before dispatching
+        size_t contentLength = 0;
+        std::string lengthHeader = request.header("content-length");
+        if (!lengthHeader.empty()) {
+            contentLength = std::strtoul(lengthHeader.c_str(), nullptr, 10);
+            if (contentLength > MAX_REQUEST_BYTES) {
+                respond(c, {413, "text/plain", "Request body too large\n"});
+                return;
+            }
+        }
+        if (c.in.size() < headerEnd + 4 + contentLength) return;
+        request.body = c.in.substr(headerEnd + 4, contentLength);
+        c.in.clear();
+
+        // A page from another site could otherwise drive the player (a
+        // form POST needs no preflight) or read the state
+        std::string origin = request.header("origin");
+        if (!origin.empty() && allowOrigin != "*" && origin != allowOrigin) {
+            respond(c, {403, "text/plain", "Origin not allowed\n"});
+            return;
+        }
+
+        // WebSocket upgrade
+        auto ws = sockets.find(request.path);
+        if (ws != sockets.end()) {
+            std::string key = request.header("sec-websocket-key");
+            if (key.empty()) {
+                respond(c, {400, "text/plain", "WebSocket upgrade required\n"});
+                return;
+            }
+            c.out += "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: " + WS::acceptKey(key) + "\r\n\r\n";
+            c.kind = Kind::WebSocket;
+            c.path = request.path;
+            if (ws->second) c.out += WS::frame(WS::Text, ws->second());
+            return;
+        }
+
+        // Streaming listener: headers now, then data straight from the shared ring
+        auto stream = streams.find(request.path);
+        if (stream != streams.end()) {
+            c.out += "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: " + stream->second.contentType + "\r\n"
+                     "Cache-Control: no-cache, no-store\r\n" +
+                     corsHeader() +
+                     "Connection: close\r\n\r\n";
+            if (stream->second.header) c.out += stream->second.header();
+            c.kind = Kind::Stream;
+            c.path = request.path;
+            c.stream = &stream->second;
+            c.cursor = stream->second.head();
+            updateListeners(stream->second, +1);
+            return;
+        }
+
+        auto route = routes.find(request.path);
+        if (route == routes.end()) {
+            respond(c, {404, "text/plain", "Not found\n"});
+            return;
+        }
+
+        try {
+            TRACE_SCOPE("http.route");
+            respond(c, route->second(request));
+        } catch (const std::exception& e) {
+            respond(c, {500, "text/plain", std::string(e.what()) + "\n"});
+        }
+    }
+
+    void processWebSocket(Connection& c) {
+        while (!c.dead && !c.in.empty()) {
+            WS::Opcode opcode;
+            std::string payload;
+            long consumed = WS::parse(c.in, opcode, payload);
+            if (consumed == 0) break;
+            if (consumed < 0) {
+                c.dead = true;
+                break;
+            }
+            c.in.erase(0, consumed);
+
+            if (opcode == WS::Close) {
+                c.out += WS::frame(WS::Close, std::string());
+                c.closeAfterFlush = true;
+            } else if (opcode == WS::Ping) {
+                c.out += WS::frame(WS::Pong, payload);
+            }
+            // Dashboards only listen; any other client messages are ignored
+        }
+    }
+
+    void respond(Connection& c, const Response& response) {
+        c.out += "HTTP/1.1 " + std::to_string(response.status) + " " + statusText(response.status) + "\r\n"
+                 "Content-Type: " + response.contentType + "\r\n"
+                 "Content-Length: " + std::to_string(response.body.size()) + "\r\n" +
+                 corsHeader();
+        for (const auto& [name, value] : response.headers) c.out += name + ": " + value + "\r\n";
+        c.out += "Connection: close\r\n\r\n";
+        c.out += response.body;
+        c.in.clear();
+        c.closeAfterFlush = true;
+    }
+
+    std::string corsHeader() const {
+        return allowOrigin.empty() ? std::string() : "Access-Control-Allow-Origin: " + allowOrigin + "\r\n";
+    }
+
+    void flush(Connection& c) {
+        while (c.outOffset < c.out.size()) {
+            int sent = send(c.sock, c.out.data() + c.outOffset, static_cast<int>(c.out.size() - c.outOffset), SendFlags);
+            if (sent > 0) {
+                c.outOffset += sent;
+                continue;
+            }
+            if (sent < 0 && !wouldBlock()) c.dead = true;
+            break;
+        }
+
+        if (c.outOffset >= c.out.size()) {
+            c.out.clear();
+            c.outOffset = 0;
+            if (c.closeAfterFlush) c.dead = true;
+        } else if (c.outOffset > MAX_PENDING_BYTES) {
+            // Compact so a slow client doesn't keep an ever-growing prefix around
+            c.out.erase(0, c.outOffset);
+            c.outOffset = 0;
+        }
+    }
+
+    // Send a listener whatever the producer has added since its cursor
+    void pumpStream(Connection& c) {
+        // The response header has to go out first
+        if (c.out.size() > c.outOffset) return;
+
+        Stream& stream = *c.stream;
+        while (c.cursor < stream.head()) {
+            if (stream.head() - c.cursor > stream.maxLag) {
+                // Too slow to keep up; its data is about to be overwritten
+                c.dead = true;
+                evictedListeners++;
+                return;
+            }
+
+            size_t length = 0;
+            const uint8_t* data = stream.peek(c.cursor, length);
+            int sent = send(c.sock, reinterpret_cast<const char*>(data), static_cast<int>(length), SendFlags);
+            if (sent > 0) {
+                c.cursor += sent;
+                continue;
+            }
+            if (sent < 0 && !wouldBlock()) c.dead = true;
+            break;
+        }
+    }
+
+    void updateListeners(Stream& stream, int delta) {
+        listenerCount += delta;
+        size_t count = 0;
+        for (auto& c : connections) {
+            if (c->kind == Kind::Stream && c->stream == &stream && !c->dead) count++;
+        }
+        if (stream.onListeners) stream.onListeners(count);
+    }
+
+    void removeDead() {
+        std::vector<Stream*> changed;
+        connections.erase(std::remove_if(connections.begin(), connections.end(), [&](const std::unique_ptr<Connection>& c) {
+            if (c->dead) {
+                closeSocket(c->sock);
+                if (c->kind == Kind::Stream) changed.push_back(c->stream);
+            }
+            return c->dead;
+        }), connections.end());
+
+        for (Stream* stream : changed) updateListeners(*stream, -1);
+    }
+
+    static const char* statusText(int status) {
+        switch (status) {
+            case 200: return "OK";
+            case 400: return "Bad Request";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 413: return "Payload Too Large";
+            case 431: return "Request Header Fields Too Large";
+            case 500: return "Internal Server Error";
+            default:  return "Unknown";
+        }
+    }
+
+    uint16_t port;
+    std::string allowOrigin;
+    SocketHandle sock;
+    std::atomic<bool> running;
+    std::thread loopThread;
+
+    std::map<std::string, Handler> routes;
+    std::map<std::string, Greeting> sockets;
+    std::map<std::string, Stream> streams;
+    size_t listenerCount = 0;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::chrono::milliseconds tickInterval{100};
+    TickCallback tickCallback;
+    std::atomic<uint64_t> droppedFrames{0};
+    std::atomic<uint64_t> evictedListeners{0};
+};
+
+} // namespace HTTP
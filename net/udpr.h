@@ -7,6 +7,7 @@
 #include <stdexcept>
 #include <cstring>
 #include <iostream>
+#include "../sys/trace.h"
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -66,9 +67,12 @@ public:
 
 private:
     void loop() {
+        TRACE_THREAD_NAME("udp");
         while (running) {
+            // Room for the largest possible datagram, so nothing is ever
+            // truncated into a different (shorter) path
             std::string buffer;
-            buffer.resize(1024);
+            buffer.resize(MAX_DATAGRAM);
             sockaddr_in from{};
             socklen_t fromLen = sizeof(from);
 
@@ -76,12 +80,15 @@ private:
                                (sockaddr*)&from, &fromLen);
 
             if (len > 0) {
+                TRACE_SCOPE("udp.dispatch");
                 buffer.resize(len); // trim to actual size
                 callback(buffer);
             } else if (len == -1) {
 #ifdef _WIN32
                 int err = WSAGetLastError();
                 if (err == WSAEINTR) continue;
+                // Oversized datagram or an ICMP error from an earlier peer: drop it, keep listening
+                if (err == WSAEMSGSIZE || err == WSAECONNRESET) continue;
 #else
                 if (errno == EINTR) continue;
 #endif
@@ -99,6 +106,8 @@ private:
 #endif
     }
 
+    static constexpr size_t MAX_DATAGRAM = 65536;
+
     uint16_t port;
     Callback callback;
     std::atomic<bool> running;
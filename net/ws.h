@@ -0,0 +1,155 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+// Minimal WebSocket (RFC 6455) helpers used by the HTTP server:
+// handshake key derivation, server frame encoding and client frame parsing.
+namespace WS {
+
+enum Opcode : uint8_t {
+    Continuation = 0x0,
+    Text         = 0x1,
+    Binary       = 0x2,
+    Close        = 0x8,
+    Ping         = 0x9,
+    Pong         = 0xA
+};
+
+// SHA-1 digest, only needed for the Sec-WebSocket-Accept handshake
+inline std::string sha1(const std::string& input) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    std::string msg = input;
+    uint64_t bitLength = static_cast<uint64_t>(input.size()) * 8;
+    msg.push_back(static_cast<char>(0x80));
+    while (msg.size() % 64 != 56) msg.push_back(0);
+    for (int i = 7; i >= 0; --i) msg.push_back(static_cast<char>((bitLength >> (i * 8)) & 0xFF));
+
+    auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(&msg[chunk + i * 4]);
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+        for (int i = 16; i < 80; ++i) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);           k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                    k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d);  k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                    k = 0xCA62C1D6; }
+            uint32_t temp = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = temp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    std::string digest(20, 0);
+    for (int i = 0; i < 5; ++i) {
+        digest[i * 4 + 0] = static_cast<char>((h[i] >> 24) & 0xFF);
+        digest[i * 4 + 1] = static_cast<char>((h[i] >> 16) & 0xFF);
+        digest[i * 4 + 2] = static_cast<char>((h[i] >> 8) & 0xFF);
+        digest[i * 4 + 3] = static_cast<char>(h[i] & 0xFF);
+    }
+    return digest;
+}
+
+inline std::string base64(const std::string& data) {
+    static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < data.size(); i += 3) {
+        uint32_t n = (uint8_t(data[i]) << 16) | (uint8_t(data[i + 1]) << 8) | uint8_t(data[i + 2]);
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += table[(n >> 6) & 63];
+        out += table[n & 63];
+    }
+    if (i + 1 == data.size()) {
+        uint32_t n = uint8_t(data[i]) << 16;
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += "==";
+    } else if (i + 2 == data.size()) {
+        uint32_t n = (uint8_t(data[i]) << 16) | (uint8_t(data[i + 1]) << 8);
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += table[(n >> 6) & 63];
+        out += '=';
+    }
+    return out;
+}
+
+// Value for the Sec-WebSocket-Accept response header
+inline std::string acceptKey(const std::string& clientKey) {
+    return base64(sha1(clientKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+}
+
+// Encode an unmasked server-to-client frame
+inline std::string frame(Opcode opcode, const std::string& payload) {
+    std::string out;
+    out.push_back(static_cast<char>(0x80 | opcode)); // FIN + opcode
+
+    uint64_t len = payload.size();
+    if (len < 126) {
+        out.push_back(static_cast<char>(len));
+    } else if (len <= 0xFFFF) {
+        out.push_back(static_cast<char>(126));
+        out.push_back(static_cast<char>((len >> 8) & 0xFF));
+        out.push_back(static_cast<char>(len & 0xFF));
+    } else {
+        out.push_back(static_cast<char>(127));
+        for (int i = 7; i >= 0; --i) out.push_back(static_cast<char>((len >> (i * 8)) & 0xFF));
+    }
+
+    out += payload;
+    return out;
+}
+
+// Parse one client frame from the front of buffer.
+// Returns the number of bytes consumed, 0 if the frame is incomplete,
+// or -1 if the frame is malformed (unmasked or oversized).
+inline long parse(const std::string& buffer, Opcode& opcode, std::string& payload, size_t maxPayload = 65536) {
+    if (buffer.size() < 2) return 0;
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer.data());
+    opcode = static_cast<Opcode>(p[0] & 0x0F);
+    bool masked = (p[1] & 0x80) != 0;
+    uint64_t len = p[1] & 0x7F;
+    size_t pos = 2;
+
+    // Clients must mask every frame
+    if (!masked) return -1;
+
+    if (len == 126) {
+        if (buffer.size() < pos + 2) return 0;
+        len = (uint64_t(p[2]) << 8) | p[3];
+        pos += 2;
+    } else if (len == 127) {
+        if (buffer.size() < pos + 8) return 0;
+        len = 0;
+        for (int i = 0; i < 8; ++i) len = (len << 8) | p[2 + i];
+        pos += 8;
+    }
+
+    if (len > maxPayload) return -1;
+    if (buffer.size() < pos + 4 + len) return 0;
+
+    const unsigned char* mask = p + pos;
+    pos += 4;
+
+    payload.resize(static_cast<size_t>(len));
+    for (size_t i = 0; i < len; ++i) {
+        payload[i] = static_cast<char>(p[pos + i] ^ mask[i % 4]);
+    }
+
+    return static_cast<long>(pos + len);
+}
+
+} // namespace WS
@@ -5,7 +5,10 @@
 #include <vector>
 #include <shellapi.h>
 #include <tlhelp32.h>
+#include <cstdlib>
 #include "net/udps.h"
+#include "sys/config.h"
+#include "sys/ttfs.h"
 
 // Note: Console window is hidden by compiling with -mwindows flag
 
@@ -72,7 +75,7 @@ bool waitForLoudReady() {
     for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
         try {
             // Try to open a connection to see if loud is accepting UDP
-            UDP::Socket testSock("127.0.0.1", 7001);
+            UDP::Socket testSock("127.0.0.1", Config::current().udpPort);
             
             // Send an empty message (which just stops playback if something is playing)
             // This is harmless but verifies the connection works
@@ -91,6 +94,10 @@ bool waitForLoudReady() {
 }
 
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
+    // Set by the time-to-first-sound benchmark (ttfs.exe) to its spawn time
+    const char* ttfsSpawn = std::getenv(Bench::SPAWN_ENV);
+    uint64_t clientStart = Bench::wallMicros();
+
     try {
         bool justStarted = false;
         
@@ -105,8 +112,10 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
             waitForLoudReady();
         }
         
+        uint64_t daemonReady = Bench::wallMicros();
+
         // Create socket
-        UDP::Socket sock("127.0.0.1", 7001);
+        UDP::Socket sock("127.0.0.1", Config::current().udpPort);
         
         // Get first command line argument, skipping program name
         std::string arg;
@@ -127,17 +136,33 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
             LocalFree(szArglist);
         }
         
+        // "@<zone>:" in front of the argument sends the command to that zone
+        std::string zone;
+        if (arg.size() > 1 && arg[0] == '@') {
+            size_t colon = arg.find(':');
+            if (colon != std::string::npos) {
+                zone = arg.substr(0, colon + 1);
+                arg = arg.substr(colon + 1);
+            }
+        }
+
         // Handle command based on argument
         if (arg.empty()) {
-            sock.send("q"); // Quit on empty command
+            sock.send(zone + "q"); // Quit on empty command (just the zone, if one is given)
             Sleep(250);    // Short wait for quit
         } else if (arg == "n") {
-            sock.send("n"); // Next track
+            sock.send(zone + "n"); // Next track
         } else if (arg == "p") {
-            sock.send("p"); // Previous track
+            sock.send(zone + "p"); // Previous track
         } else {
+            // Hand our timestamps to the daemon just ahead of the command being measured
+            if (ttfsSpawn) {
+                sock.send(zone + "ttfs:" + std::string(ttfsSpawn) + "," + std::to_string(clientStart) + "," +
+                          std::to_string(daemonReady) + "," + std::to_string(Bench::wallMicros()));
+            }
+
             // Everything else is a file path
-            sock.send("play:" + arg);
+            sock.send(zone + "play:" + arg);
         }
 
     } catch (const std::exception&) {
@@ -1,7 +1,10 @@
 x86_64-w64-mingw32-windres playloud/play.rc -O coff -o playloud/play.res
 g++ -Wall -Wno-narrowing playloud/play.res -std=c++17 -O0 -pipe play.cpp -o play.exe -lws2_32 -mwindows
 g++ -Wall -Wno-narrowing playloud/play.res -std=c++17 -O0 -pipe q.cpp -o q.exe -lws2_32 -mwindows
-g++ -Wall -Wno-narrowing playloud/play.res -std=c++17 -O0 -pipe loud.cpp -o loud.exe -lws2_32 -mwindows
+:: miniaudio is compiled once, optimized; delete sys\miniaudio.o after changing sys\miniaudio.c or sys\miniaudio_config.h
+if not exist sys\miniaudio.o gcc -O2 -pipe -c sys/miniaudio.c -o sys/miniaudio.o
+g++ -Wall -Wno-narrowing playloud/play.res -std=c++17 -O0 -pipe loud.cpp sys/miniaudio.o -o loud.exe -lws2_32 -mwindows
+g++ -Wall -Wno-narrowing -std=c++17 -O2 -pipe ttfs.cpp -o ttfs.exe -lws2_32
 ::g++ loud.cpp playloud/play.res -std=c++17 -o loud.exe -lws2_32 -mwindows -I./net -I./sys
 ::g++ play.cpp playloud/play.res -std=c++17 -o play.exe -lws2_32 -mwindows -I./net -I./sys
 ::g++ q.cpp playloud/play.res -std=c++17 -o q.exe -lws2_32 -mwindows -I./net -I./sys
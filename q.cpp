@@ -6,6 +6,7 @@
 #include <shellapi.h>
 #include <tlhelp32.h>
 #include "net/udps.h"
+#include "sys/config.h"
 
 // Note: Console window is hidden by compiling with -mwindows flag
 
@@ -72,7 +73,7 @@ bool waitForLoudReady() {
     for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
         try {
             // Try to open a connection to see if loud is accepting UDP
-            UDP::Socket testSock("127.0.0.1", 7001);
+            UDP::Socket testSock("127.0.0.1", Config::current().udpPort);
             
             // Send an empty message (which just stops playback if something is playing)
             // This is harmless but verifies the connection works
@@ -106,7 +107,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
         }
         
         // Create socket
-        UDP::Socket sock("127.0.0.1", 7001);
+        UDP::Socket sock("127.0.0.1", Config::current().udpPort);
         
         // Get first command line argument, skipping program name
         std::string arg;
@@ -127,15 +128,25 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
             LocalFree(szArglist);
         }
         
+        // "@<zone>:" in front of the argument sends the command to that zone
+        std::string zone;
+        if (arg.size() > 1 && arg[0] == '@') {
+            size_t colon = arg.find(':');
+            if (colon != std::string::npos) {
+                zone = arg.substr(0, colon + 1);
+                arg = arg.substr(colon + 1);
+            }
+        }
+
         // Handle command based on argument
         if (arg.empty()) {
-            sock.send(""); // Stop playback
+            sock.send(zone); // Stop playback
         } else if (arg == "q") {
-            sock.send("q"); // Quit
+            sock.send(zone + "q"); // Quit
             Sleep(1000);   // Wait for quit
         } else {
             // Everything else is added to queue
-            sock.send("q:" + arg);
+            sock.send(zone + "q:" + arg);
         }
 
     } catch (const std::exception&) {
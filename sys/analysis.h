@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include "audio.h"
+#include "beat.h"
+#include "library.h"
+#include "pool.h"
+#include "metrics.h"
+#include "trace.h"
+#include "config.h"
+
+// Beat analysis in the background (see sys/beat.h), for the next track in
+// the queue or for a whole library overnight (analyze:<folder>). Files wait
+// in a queue of their own, and only a few run on the shared worker pool at
+// a time, so seek-table builds and other pool tasks never end up behind
+// thousands of queued tracks. Grids are stored in the library index.
+namespace Analysis {
+
+constexpr size_t READ_FRAMES = 4096;
+
+// Decode a file at Beat::SAMPLE_RATE, mixed down to mono, and analyse it.
+// Files longer than Beat::MAX_SECONDS get no grid. False if the file can't
+// be decoded.
+inline bool analyseFile(const std::string& path, Beat::Grid& grid) {
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, Beat::SAMPLE_RATE);
+    ma_decoder decoder;
+    ma_result result;
+    if (Zip::isEntryPath(path)) {
+        result = ma_decoder_init_vfs(Zip::vfs(), path.c_str(), &config, &decoder);
+    } else {
+        #ifdef _WIN32
+        std::wstring widePath = Audio::utf8_to_wstring(path);
+        if (!widePath.empty()) {
+            result = ma_decoder_init_file_w(widePath.c_str(), &config, &decoder);
+        } else {
+            result = ma_decoder_init_file(path.c_str(), &config, &decoder);
+        }
+        #else
+        result = ma_decoder_init_file(path.c_str(), &config, &decoder);
+        #endif
+    }
+    if (result != MA_SUCCESS) return false;
+
+    Beat::FlushDenormals flush;
+    Beat::Analyzer analyzer;
+    std::vector<float> samples(READ_FRAMES);
+    bool complete = true;
+    while (true) {
+        ma_uint64 framesRead = 0;
+        {
+            TRACE_SCOPE("decoder.read");
+            ma_decoder_read_pcm_frames(&decoder, samples.data(), READ_FRAMES, &framesRead);
+        }
+        if (framesRead == 0) break;
+        if (!analyzer.push(samples.data(), static_cast<size_t>(framesRead))) {
+            complete = false;
+            break;
+        }
+    }
+    ma_decoder_uninit(&decoder);
+
+    if (complete) {
+        TRACE_SCOPE("analysis.grid");
+        grid = analyzer.finish();
+    } else {
+        grid = Beat::Grid{}; // Too long to beat-match; its end is never reached
+    }
+    return true;
+}
+
+class Queue {
+public:
+    Queue() {
+        Metrics::gauge("loud_analysis_pending", "Files waiting for or in beat analysis", [this]() { return double(pending()); });
+    }
+
+    // Analyse a file unless the index has a grid for this version of it.
+    // urgent goes ahead of bulk requests (the next track of the play queue).
+    void request(const std::string& path, bool urgent = false) {
+        {
+            std::scoped_lock lock(mutex);
+            if (!known.insert(path).second) {
+                // Already waiting (or running): only move it up
+                auto it = std::find(waiting.begin(), waiting.end(), path);
+                if (urgent && it != waiting.end()) {
+                    waiting.erase(it);
+                    waiting.push_front(path);
+                }
+                return;
+            }
+            if (urgent) waiting.push_front(path);
+            else waiting.push_back(path);
+        }
+        pump();
+    }
+
+    // Every audio file under a folder (library.extensions), including those
+    // inside ZIP archives, walked on the pool
+    void requestTree(const std::string& directory) {
+        Work::pool().submit([this, directory]() {
+            TRACE_SCOPE("analysis.walk");
+            namespace fs = std::filesystem;
+            size_t queued = 0;
+            std::error_code ec;
+            fs::recursive_directory_iterator it(fs::u8path(directory), fs::directory_options::skip_permission_denied, ec);
+            for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+                std::error_code fileError;
+                if (!it->is_regular_file(fileError)) continue;
+                std::string path = it->path().u8string();
+                if (Zip::isArchive(path)) {
+                    for (const auto& entry : Zip::audioEntries(path)) {
+                        request(entry);
+                        queued++;
+                    }
+                    continue;
+                }
+                if (!Config::current().isAudioFile(path)) continue;
+                request(path);
+                queued++;
+            }
+            std::cout << "Analysis: " << queued << " files queued from " << directory << "\n";
+        });
+    }
+
+    // Waiting plus running
+    size_t pending() {
+        std::scoped_lock lock(mutex);
+        return known.size();
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<std::string> waiting;
+    std::set<std::string> known;  // Waiting or running
+    size_t running = 0;
+
+    // One worker is left for interactive work (stem decoding, seek tables)
+    static size_t limit() {
+        size_t workers = Work::pool().size();
+        return workers > 1 ? workers - 1 : 1;
+    }
+
+    // Start waiting files while there are free slots
+    void pump() {
+        std::vector<std::string> starting;
+        {
+            std::scoped_lock lock(mutex);
+            while (running < limit() && !waiting.empty()) {
+                starting.push_back(waiting.front());
+                waiting.pop_front();
+                running++;
+            }
+        }
+        for (const auto& path : starting) {
+            Work::pool().submit([this, path]() { run(path); });
+        }
+    }
+
+    void run(const std::string& path) {
+        analyse(path);
+        {
+            std::scoped_lock lock(mutex);
+            running--;
+            known.erase(path);
+        }
+        pump();
+    }
+
+    static void analyse(const std::string& path) {
+        static auto& trackDuration = Metrics::histogram("loud_analysis_seconds", "Time to decode and beat-analyse one file");
+        static auto& tracks = Metrics::counter("loud_analysis_tracks_total", "Files beat-analysed");
+        static auto& audioSeconds = Metrics::counter("loud_analysis_audio_seconds_total", "Seconds of audio beat-analysed");
+        static auto& failures = Metrics::counter("loud_analysis_failures_total", "Files beat analysis couldn't decode");
+
+        uint64_t size;
+        int64_t mtime;
+        if (!Library::stamp(path, size, mtime)) return;
+        std::shared_ptr<const Library::TrackInfo> info = Library::index().lookup(path);
+        if (info && info->analysed && info->size == size && info->mtime == mtime) return;
+
+        TRACE_SCOPE("analysis.track");
+        Beat::Grid grid;
+        {
+            Metrics::ScopedTimer timer(trackDuration);
+            if (!analyseFile(path, grid)) {
+                failures.add();
+                std::cerr << "Analysis: can't decode " << path << "\n";
+            }
+        }
+        // Undecodable and overlong files are stored too, so they aren't tried again
+        Library::index().storeAnalysis(path, size, mtime, grid);
+        tracks.add();
+        audioSeconds.add(static_cast<uint64_t>(grid.duration));
+    }
+};
+
+// Never destroyed: pool tasks still refer to it while static destructors run
+inline Queue& queue() {
+    static Queue* instance = new Queue();
+    return *instance;
+}
+
+} // namespace Analysis
@@ -12,18 +12,39 @@
 #include <fstream>
 #include <cstdlib>  // For std::exit
 #include <functional> // For std::function
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <cctype>
 #ifdef _WIN32
 #include <windows.h> // For ExitProcess
 #include <stringapiset.h> // For UTF-8 conversion
 #endif
-#define MINIAUDIO_IMPLEMENTATION
-#include "miniaudio.h"
+#include "miniaudio_config.h"
+#include "miniaudio.h" // Implementation compiled separately in miniaudio.c
+#include "ring.h"
+#include "metrics.h"
+#include "trace.h"
+#include "ttfs.h"
+#include "config.h"
+#include "mix.h"
+#include "pool.h"
+#include "library.h"
+#include "shuffle.h"
+#include "pcmcache.h"
+#include "mp3seek.h"
+#include "mirror.h"
+#include "zip.h"
 
 namespace Audio {
 
 // Helper function for UTF-8 path handling
 #ifdef _WIN32
-std::wstring utf8_to_wstring(const std::string& str) {
+inline std::wstring utf8_to_wstring(const std::string& str) {
     if (str.empty()) return std::wstring();
     
     // First, get the required buffer size
@@ -37,67 +58,298 @@ std::wstring utf8_to_wstring(const std::string& str) {
 }
 #endif
 
-class Player {
+// miniaudio context the players open their devices in. The daemon shares
+// one between all its zones, so the backend (on WASAPI its COM setup and
+// device notification thread) and the device list exist once per process.
+// offline uses miniaudio's null backend: same timing, no sound card.
+class Context {
 public:
-    // Define the type for the end of playback callback
-    using PlaybackEndCallback = std::function<void()>;
-    
-    Player() {
-        config = ma_device_config_init(ma_device_type_playback);
-        config.playback.format = ma_format_f32;
-        
-        // Auto-detect system channels instead of hardcoding to stereo
-        ma_device_info* pPlaybackDeviceInfos;
-        ma_uint32 playbackDeviceCount;
-        ma_context context;
-        
-        if (ma_context_init(NULL, 0, NULL, &context) != MA_SUCCESS) {
-            // Fall back to stereo if we can't initialize context
-            config.playback.channels = 2;
-        } else {
-            if (ma_context_get_devices(&context, &pPlaybackDeviceInfos, &playbackDeviceCount, NULL, NULL) != MA_SUCCESS) {
-                // Fall back to stereo if we can't get device info
-                config.playback.channels = 2;
-            } else if (playbackDeviceCount > 0) {
-                // Get default device channels
-                ma_device_id defaultDeviceId = pPlaybackDeviceInfos[0].id;
-                ma_device_info deviceInfo;
-                
-                if (ma_context_get_device_info(&context, ma_device_type_playback, &defaultDeviceId, &deviceInfo) == MA_SUCCESS) {
-                    // Use system channels count, or fall back to stereo if unable to get specific info
-                    if (deviceInfo.nativeDataFormatCount > 0) {
-                        // Use channels from the first native format
-                        config.playback.channels = deviceInfo.nativeDataFormats[0].channels;
-                        std::cout << "Detected " << deviceInfo.nativeDataFormats[0].channels << " system audio channels\n";
-                    } else {
-                        // Default to stereo if no native format info available
-                        config.playback.channels = 2;
-                        std::cout << "No channel info detected, defaulting to stereo\n";
-                    }
-                } else {
-                    config.playback.channels = 2;
-                }
-            } else {
-                config.playback.channels = 2;
+    explicit Context(bool offline = false) {
+        ma_backend nullBackend = ma_backend_null;
+        if (ma_context_init(offline ? &nullBackend : NULL, offline ? 1 : 0, NULL, &context) != MA_SUCCESS) {
+            throw std::runtime_error("Failed to initialize audio context");
+        }
+    }
+
+    ~Context() {
+        ma_context_uninit(&context);
+    }
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    ma_context* get() { return &context; }
+
+    // Playback device whose name contains `name` (ignoring case), or the
+    // default device for an empty name. False if nothing matches.
+    bool findDevice(const std::string& name, ma_device_info& found) {
+        std::scoped_lock lock(mutex);
+        ma_device_info* devices;
+        ma_uint32 count;
+        if (ma_context_get_devices(&context, &devices, &count, NULL, NULL) != MA_SUCCESS || count == 0) return false;
+
+        std::string wanted = lowercase(name);
+        for (ma_uint32 i = 0; i < count; i++) {
+            bool match = wanted.empty() ? devices[i].isDefault != 0 : lowercase(devices[i].name).find(wanted) != std::string::npos;
+            if (match) {
+                found = devices[i];
+                return true;
             }
-            
-            ma_context_uninit(&context);
         }
-        
-        config.sampleRate = 44100;
+        if (!wanted.empty()) return false;
+        found = devices[0]; // No device flagged as the default
+        return true;
+    }
+
+private:
+    ma_context context;
+    std::mutex mutex; // Device enumeration isn't thread-safe
+
+    static std::string lowercase(std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return text;
+    }
+};
+
+// One multichannel output device split between several players, e.g. an
+// 8-output interface serving four stereo zones. Each player renders its
+// own channels (see Player(SharedDevice&, ...)) from its own decode-ahead
+// ring, with its own volume, meters and transitions; one device callback
+// runs them all in turn on the device's clock, so the zones never drift
+// apart and there is one audio thread instead of one per zone.
+class SharedDevice {
+public:
+    // Fills `frames` frames of `channels`-channel audio for one attached output
+    using RenderCallback = void (*)(void* user, float* out, ma_uint32 frames);
+
+    // Open the device whose name contains deviceName (the default device if
+    // empty) with at least `channels` channels. Throws if it has fewer.
+    SharedDevice(Context& context, const std::string& deviceName, ma_uint32 channels) : context(context) {
+        ma_device_info deviceInfo;
+        if (!context.findDevice(deviceName, deviceInfo)) {
+            throw std::runtime_error("No playback device matching \"" + deviceName + "\"");
+        }
+        deviceId = deviceInfo.id;
+
+        // Native channel count if there is one (0 = any), so the backend doesn't remix
+        ma_uint32 native = 0;
+        if (ma_context_get_device_info(context.get(), ma_device_type_playback, &deviceId, &deviceInfo) == MA_SUCCESS &&
+            deviceInfo.nativeDataFormatCount > 0) {
+            native = deviceInfo.nativeDataFormats[0].channels;
+        }
+        if (native != 0 && native < channels) {
+            throw std::runtime_error(std::string(deviceInfo.name) + " has " + std::to_string(native) + " channels, zones need " + std::to_string(channels));
+        }
+
+        const Config::Settings& settings = Config::current();
+        config = ma_device_config_init(ma_device_type_playback);
+        config.playback.format = ma_format_f32;
+        config.playback.channels = native ? native : channels;
+        config.playback.pDeviceID = &deviceId;
+        config.sampleRate = settings.sampleRate;
+        config.periodSizeInMilliseconds = settings.periodMs;
+        config.performanceProfile = settings.latency == "conservative" ? ma_performance_profile_conservative : ma_performance_profile_low_latency;
         config.dataCallback = dataCallback;
         config.pUserData = this;
 
-        if (ma_device_init(NULL, &config, &device) != MA_SUCCESS) {
+        if (ma_device_init(context.get(), &config, &device) != MA_SUCCESS) {
             throw std::runtime_error("Failed to initialize audio device");
         }
+        scratch.resize(size_t(SCRATCH_FRAMES) * device.playback.channels);
+        std::cout << "Sharing audio device " << deviceInfo.name << ", " << device.playback.channels << " channels\n";
 
-        ma_device_start(&device);
+        if (ma_device_start(&device) != MA_SUCCESS) {
+            ma_device_uninit(&device);
+            throw std::runtime_error("Failed to start audio device");
+        }
+    }
+
+    ~SharedDevice() {
+        while (restarting.load()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ma_device_uninit(&device);
+    }
+
+    SharedDevice(const SharedDevice&) = delete;
+    SharedDevice& operator=(const SharedDevice&) = delete;
+
+    // Route `render` into channels first .. first + count - 1 (from 0).
+    // Throws if they are taken or the device doesn't have them.
+    void attach(ma_uint32 first, ma_uint32 count, RenderCallback render, void* user) {
+        std::scoped_lock lock(mutex);
+        if (count == 0 || first + count > device.playback.channels) {
+            throw std::runtime_error("Channels " + std::to_string(first + 1) + "-" + std::to_string(first + count) +
+                                     " are not on a " + std::to_string(device.playback.channels) + "-channel device");
+        }
+        Output* free = nullptr;
+        for (auto& output : outputs) {
+            if (!output.user.load()) {
+                if (!free) free = &output;
+            } else if (first < output.first + output.count && output.first < first + count) {
+                throw std::runtime_error("Channels " + std::to_string(first + 1) + "-" + std::to_string(first + count) + " are already in use");
+            }
+        }
+        if (!free) throw std::runtime_error("Too many outputs on one device");
+
+        free->first = first;
+        free->count = count;
+        free->render = render;
+        free->user.store(user); // Publishes the fields above to the callback
+    }
+
+    // Stop calling `user`'s callback. Once this returns it won't run again.
+    void detach(void* user) {
+        std::scoped_lock lock(mutex);
+        for (auto& output : outputs) {
+            if (output.user.load() == user) output.user.store(nullptr);
+        }
+        // A callback that started before still has it; wait for that one
+        while (inCallback.load()) std::this_thread::yield();
+    }
+
+    ma_uint32 getSampleRate() const { return device.sampleRate; }
+    ma_uint32 getPeriodFrames() const { return device.playback.internalPeriodSizeInFrames; }
+
+    bool isRunning() const {
+        return !restarting.load(std::memory_order_relaxed) && ma_device_is_started(&device) == MA_TRUE;
+    }
+
+    // Reopen the device on a helper thread (see Player::restartDevice); the
+    // outputs stay attached and carry on where they were
+    void restart() {
+        bool expected = false;
+        if (!restarting.compare_exchange_strong(expected, true)) return;
+
+        std::thread([this]() {
+            std::cerr << "Restarting shared audio device\n";
+            ma_device_uninit(&device);
+            if (ma_device_init(context.get(), &config, &device) != MA_SUCCESS || ma_device_start(&device) != MA_SUCCESS) {
+                std::cerr << "Failed to restart audio device\n";
+            }
+            restarting = false;
+        }).detach();
+    }
+
+private:
+    struct Output {
+        std::atomic<void*> user{nullptr}; // Free while null
+        ma_uint32 first = 0;
+        ma_uint32 count = 0;
+        RenderCallback render = nullptr;
+    };
+
+    // Bigger periods are rendered in pieces of this
+    static constexpr ma_uint32 SCRATCH_FRAMES = 8192;
+    static constexpr size_t MAX_OUTPUTS = 16;
+
+    Context& context;
+    ma_device_id deviceId;
+    ma_device_config config;
+    ma_device device;
+    std::mutex mutex; // attach/detach; the callback never takes it
+    Output outputs[MAX_OUTPUTS];
+    std::atomic<bool> inCallback{false};
+    std::atomic<bool> restarting{false};
+    std::vector<float> scratch; // One output's channels (audio thread only)
+
+    // Each output renders into the scratch buffer in its own layout, then
+    // goes into its channels of the device frame; unrouted channels stay silent
+    static void dataCallback(ma_device* device, void* out, const void* in, ma_uint32 frames) {
+        SharedDevice* self = static_cast<SharedDevice*>(device->pUserData);
+        self->inCallback.store(true);
+
+        float* output = static_cast<float*>(out);
+        ma_uint32 channels = device->playback.channels;
+        std::memset(output, 0, size_t(frames) * channels * sizeof(float));
+
+        for (auto& slot : self->outputs) {
+            void* user = slot.user.load();
+            if (!user) continue;
+
+            for (ma_uint32 done = 0; done < frames;) {
+                ma_uint32 count = std::min(frames - done, SCRATCH_FRAMES);
+                slot.render(user, self->scratch.data(), count);
+
+                const float* source = self->scratch.data();
+                float* target = output + size_t(done) * channels + slot.first;
+                for (ma_uint32 i = 0; i < count; ++i) {
+                    for (ma_uint32 ch = 0; ch < slot.count; ++ch) target[ch] = source[ch];
+                    source += slot.count;
+                    target += channels;
+                }
+                done += count;
+            }
+        }
+
+        self->inCallback.store(false);
+    }
+};
+
+class Player {
+public:
+    // Define the type for the end of playback callback
+    using PlaybackEndCallback = std::function<void()>;
+    // Told which file a prepared transition went into (see prepareTransition)
+    using TransitionCallback = std::function<void(const std::string&)>;
+
+    // What the audio callback and the decode thread are doing, for stall diagnostics
+    enum class Phase : int { Idle, Callback, Decode, Transition };
+
+    struct Health {
+        uint64_t heartbeat;      // Bumped by every device callback
+        Phase phase;             // Device callback
+        uint64_t phaseNanos;     // Time spent in the current phase
+        Phase decoderPhase;      // Decode thread
+        uint64_t decoderNanos;   // Time spent in the decoder's current phase
+        uint64_t bufferedFrames; // Decoded audio waiting in the ring
+        bool running;            // Device started, so the heartbeat should be moving
+    };
+
+    // One file of the current track, for status output
+    struct StemState {
+        std::string path;
+        float gain;
+        bool muted;
+    };
+    
+    // offline renders on miniaudio's null backend: same timing, no sound card.
+    // Used for benchmarks and machines without audio hardware.
+    explicit Player(bool offline = false) : ownedContext(std::make_unique<Context>(offline)), context(*ownedContext) {
+        open("");
+    }
+
+    // Play on the device whose name contains deviceName (the default device
+    // if empty), opened in a context shared with other players. Throws if
+    // there is no such device or it won't open.
+    Player(Context& context, const std::string& deviceName) : context(context) {
+        open(deviceName);
+    }
+
+    // Play on `channels` channels of a shared device, starting at
+    // firstChannel (from 0). Throws if they aren't free (see SharedDevice).
+    Player(Context& context, SharedDevice& output, ma_uint32 firstChannel, ma_uint32 channels) : context(context), shared(&output) {
+        deviceRate = output.getSampleRate();
+        deviceChannels = channels;
+        startDecoding();
+        try {
+            output.attach(firstChannel, channels, sharedCallback, this);
+        } catch (...) {
+            decoding = false;
+            wake.notify_one();
+            decodeThread.join();
+            throw;
+        }
+        std::cout << "Using channels " << firstChannel + 1 << "-" << firstChannel + channels << " of a shared device\n";
     }
 
     ~Player() {
+        // Let an in-flight device restart finish before tearing down
+        while (restarting.load()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (shared) shared->detach(this);
+        decoding = false;
+        wake.notify_one();
+        if (decodeThread.joinable()) decodeThread.join();
         stop();
-        ma_device_uninit(&device);
+        if (!shared) ma_device_uninit(&device);
     }
 
     // Play a file or directory
@@ -114,23 +366,28 @@ public:
         fs::path p(path);
         
         try {
-            if (fs::exists(p) && fs::is_directory(p)) {
-                // Play directory
-                for (const auto& entry : fs::directory_iterator(p)) {
-                    if (entry.is_regular_file() && isAudioFile(entry.path().string())) {
-                        playlist.push_back(entry.path().string());
+            bool archive = Zip::isArchive(path);
+            if (archive || (fs::exists(p) && fs::is_directory(p))) {
+                // Play directory (a ZIP archive plays like one)
+                if (archive) {
+                    playlist = Zip::audioEntries(path);
+                } else {
+                    for (const auto& entry : fs::directory_iterator(p)) {
+                        if (entry.is_regular_file() && isAudioFile(entry.path().string())) {
+                            playlist.push_back(entry.path().string());
+                        }
                     }
                 }
 
                 if (!playlist.empty()) {
                     std::cout << "Playing " << playlist.size() << " tracks from directory\n";
-                    std::shuffle(playlist.begin(), playlist.end(), std::mt19937{std::random_device{}()});
+                    Shuffle::arrange(playlist);
                     playlistIndex = 0;
                     currentPath = playlist[playlistIndex];
                     loadFromFile(currentPath);
                 } else {
                     std::cout << "No audio files found in directory: " << path << "\n";
-                    paused = true; // Set paused to prevent callback access to non-existent decoder
+                    paused = true; // Nothing to play until the next command
                     return;
                 }
             } else {
@@ -145,7 +402,11 @@ public:
             loadFromFile(currentPath);
         }
 
+        // Armed under the lock so the old track can't trip the probe
+        if (firstSoundRequested.exchange(false)) firstSoundArmed.store(true, std::memory_order_relaxed);
+
         paused = false;
+        startTrack();
     }
 
     // Play from memory buffer
@@ -154,17 +415,183 @@ public:
         stop_nolock();
         
         buffer = raw;
-        decoder = std::make_unique<ma_decoder>();
+        ma_decoder* decoder = new ma_decoder;
+        ma_decoder_config decoderConfig = decoderConfigFor();
         
-        if (ma_decoder_init_memory(buffer.data(), buffer.size(), NULL, decoder.get()) != MA_SUCCESS) {
-            decoder.reset();
+        if (ma_decoder_init_memory(buffer.data(), buffer.size(), &decoderConfig, decoder) == MA_SUCCESS) {
+            addStem(DecoderPtr(decoder), "");
+        } else {
+            delete decoder;
         }
         
         paused = false;
+        startTrack();
     }
 
-    void pause() {
+    // Play several files as one track (multitrack stems), mixed sample for
+    // sample from the first frame on. They are decoded in lockstep, block by
+    // block, on the worker pool once there are PARALLEL_STEMS or more.
+    // Nothing plays if any of them fails to open.
+    void playStems(const std::vector<std::string>& paths) {
         std::scoped_lock lock(mutex);
+        stop_nolock();
+
+        playlist.clear();
+        playlistIndex = 0;
+        {
+            TRACE_SCOPE("player.loadStems");
+            Metrics::ScopedTimer openTimer(trackOpenDuration);
+            std::vector<DecoderPtr> opened(paths.size());
+            forEachStem(paths.size(), [&](size_t index) { opened[index] = openDecoder(paths[index]); });
+
+            for (size_t i = 0; i < paths.size(); i++) {
+                if (!opened[i]) {
+                    std::cerr << "Stem group not played, failed to open: " << paths[i] << "\n";
+                    stems.clear();
+                    return;
+                }
+                addStem(std::move(opened[i]), paths[i]);
+            }
+            currentPath = paths.empty() ? "" : paths.front();
+            std::cout << "Playing " << stems.size() << " stems, " << deviceChannels << " channels at " << deviceRate << " Hz\n";
+        }
+
+        if (firstSoundRequested.exchange(false)) firstSoundArmed.store(true, std::memory_order_relaxed);
+
+        paused = false;
+        startTrack();
+    }
+
+    // Jump to a position in the current track. Every stem seeks to the same
+    // frame, so a group stays sample-aligned. False if nothing is loaded.
+    bool seek(double seconds) {
+        std::scoped_lock lock(mutex);
+        if (stems.empty()) return false;
+
+        TRACE_SCOPE("player.seek");
+        abandonTransition();
+        Metrics::ScopedTimer seekTimer(seekDuration);
+        ma_uint64 frame = static_cast<ma_uint64>(std::llround(std::max(0.0, seconds) * deviceRate));
+        seekStems(frame);
+        startTrack(frame);
+        return true;
+    }
+
+    // Gain (0..4, linear) and mute of one stem of the current track, counted
+    // from 0 in load order; a plain file is stem 0. Audio already decoded
+    // ahead is decoded again, so the change is heard within a few periods.
+    bool setStemGain(size_t index, float gain) {
+        std::scoped_lock lock(mutex);
+        if (index >= stems.size()) return false;
+        stems[index].gain = std::clamp(gain, 0.0f, MAX_STEM_GAIN);
+        retake();
+        return true;
+    }
+
+    bool setStemMuted(size_t index, bool muted) {
+        std::scoped_lock lock(mutex);
+        if (index >= stems.size()) return false;
+        stems[index].muted = muted;
+        retake();
+        return true;
+    }
+
+    // Repeat [start, end) of the current track with no gap; end < 0 loops
+    // to the end of the track. The decode thread seeks back to start ahead of
+    // time and crossfades the seam over LOOP_FADE_MS, so the callback never
+    // sees the boundary. False if nothing is loaded or the region is too short.
+    bool setLoop(double startSeconds, double endSeconds) {
+        std::scoped_lock lock(mutex);
+        if (stems.empty()) return false;
+
+        ma_uint64 start = static_cast<ma_uint64>(std::llround(std::max(0.0, startSeconds) * deviceRate));
+        ma_uint64 end = endSeconds < 0 ? trackLength() : static_cast<ma_uint64>(std::llround(endSeconds * deviceRate));
+        if (end != FrameRing::NONE && (end <= start || end - start < 2 * loopFadeFrames())) return false;
+        if (transition && transition->started) return false; // Mid-crossfade there's no one track to loop
+
+        looping = true;
+        loopStart = start;
+        loopEnd = end;
+        retake(); // Audio already decoded past the new loop end is decoded again
+        return true;
+    }
+
+    void clearLoop() {
+        std::scoped_lock lock(mutex);
+        if (!looping) return;
+        looping = false;
+        retake();
+    }
+
+    // Loop region in seconds, end -1 when it runs to the end of the track
+    bool getLoop(double& start, double& end) {
+        std::scoped_lock lock(mutex);
+        if (!looping) return false;
+        start = double(loopStart) / deviceRate;
+        end = loopEnd == FrameRing::NONE ? -1.0 : double(loopEnd) / deviceRate;
+        return true;
+    }
+
+    // Crossfade into another file instead of playing this track to its end:
+    // from outSeconds of the current track, over fadeSeconds, into inSeconds
+    // of the file. During the fade the file plays at rate times its normal
+    // speed (varispeed, so the pitch moves with it) to match the tempos,
+    // then glides back to normal speed over as long again. Replaces a
+    // transition that hasn't started yet. False if the current track is a
+    // stem group or has been decoded past outSeconds, or the file won't open.
+    bool prepareTransition(const std::string& path, double outSeconds, double inSeconds, double fadeSeconds, double rate) {
+        TRACE_SCOPE("player.prepareTransition");
+        ma_uint64 fade = static_cast<ma_uint64>(std::llround(fadeSeconds * deviceRate));
+        if (!(rate >= MIN_TRANSITION_RATE && rate <= MAX_TRANSITION_RATE) || fade == 0 || outSeconds < 0 || inSeconds < 0) return false;
+
+        // The file's decoder makes deviceRate / rate frames per second of
+        // audio and the device plays deviceRate of them: rate times the speed.
+        // Its resampler has to exist for the speed to glide back later.
+        ma_uint32 stretchedRate = static_cast<ma_uint32>(std::llround(deviceRate / rate));
+        DecoderPtr decoder = openDecoder(path, stretchedRate);
+        if (decoder && stretchedRate != deviceRate && !decoder->converter.hasResampler) {
+            decoder = openDecoder(path, ++stretchedRate); // The file's own rate; one hertz off makes no audible difference
+        }
+        if (!decoder) return false;
+        ma_uint64 inFrame = static_cast<ma_uint64>(std::llround(inSeconds * deviceRate));
+        if (ma_decoder_seek_to_pcm_frame(decoder.get(), static_cast<ma_uint64>(std::llround(inSeconds * stretchedRate))) != MA_SUCCESS) return false;
+
+        std::scoped_lock lock(mutex);
+        ma_uint64 outFrame = static_cast<ma_uint64>(std::llround(outSeconds * deviceRate));
+        if (stems.size() != 1 || (transition && transition->started) || decodedFrame > outFrame) return false;
+
+        transition = std::make_unique<Transition>();
+        transition->path = path;
+        transition->incoming = makeStem(std::move(decoder), path);
+        transition->outFrame = outFrame;
+        transition->inFrame = inFrame;
+        transition->fadeFrames = fade;
+        transition->glideFrames = stretchedRate == deviceRate ? 0 : fade;
+        transition->rate = double(deviceRate) / stretchedRate;
+        std::cout << "Transition to " << path << " armed at " << outSeconds << " s, " << fadeSeconds << " s fade at x" << transition->rate << "\n";
+        return true;
+    }
+
+    // Drop a prepared transition that hasn't started; the track then plays to its end
+    void cancelTransition() {
+        std::scoped_lock lock(mutex);
+        if (transition && !transition->started) transition.reset();
+    }
+
+    // File of the prepared or running transition, empty if there is none
+    std::string transitionTarget() {
+        std::scoped_lock lock(mutex);
+        return transition ? transition->path : std::string();
+    }
+
+    std::vector<StemState> getStems() {
+        std::scoped_lock lock(mutex);
+        std::vector<StemState> result;
+        for (const auto& stem : stems) result.push_back(StemState{stem.path, stem.gain, stem.muted});
+        return result;
+    }
+
+    void pause() {
         paused = true;
     }
 
@@ -180,6 +607,7 @@ public:
         playlistIndex = (playlistIndex + 1) % playlist.size();
         currentPath = playlist[playlistIndex];
         loadFromFile(currentPath);
+        startTrack();
     }
 
     void prev() {
@@ -193,10 +621,10 @@ public:
 
         currentPath = playlist[playlistIndex];
         loadFromFile(currentPath);
+        startTrack();
     }
 
     void setVolume(float v) {
-        std::scoped_lock lock(mutex);
         volume = std::clamp(v, 0.0f, 1.0f);
     }
 
@@ -208,7 +636,8 @@ public:
         stop();
         
         // Uninitialize audio device before exit to ensure a clean shutdown
-        ma_device_uninit(&device);
+        if (shared) shared->detach(this);
+        else ma_device_uninit(&device);
         
         // Force exit the application with success code
         #ifdef _WIN32
@@ -219,328 +648,1163 @@ public:
         #endif
     }
 
-    // Set callback for when playback reaches the end of a track
+    // Set callback for when playback reaches the end of a track.
+    // It runs on the decode thread once the last frame has been played.
     void setOnPlaybackEnd(PlaybackEndCallback callback) {
         std::scoped_lock lock(mutex);
         onPlaybackEndCallback = callback;
     }
 
+    // Set callback for when the device starts playing the crossfade of a
+    // prepared transition. It runs on the decode thread; the file then is the
+    // current track and no end-of-playback callback comes for the old one.
+    void setOnTransition(TransitionCallback callback) {
+        std::scoped_lock lock(mutex);
+        onTransitionCallback = callback;
+    }
+
+    // Snapshot of the audio thread's liveness, readable from any thread
+    Health health() const {
+        uint64_t now = Trace::nanoseconds();
+        uint64_t since = phaseSince.load(std::memory_order_relaxed);
+        uint64_t decoderSince = decodePhaseSince.load(std::memory_order_relaxed);
+        return Health{
+            heartbeat.load(std::memory_order_relaxed),
+            static_cast<Phase>(phase.load(std::memory_order_relaxed)),
+            since && now > since ? now - since : 0,
+            static_cast<Phase>(decodePhase.load(std::memory_order_relaxed)),
+            decoderSince && now > decoderSince ? now - decoderSince : 0,
+            ring->buffered(),
+            shared ? shared->isRunning() : !restarting.load(std::memory_order_relaxed) && ma_device_is_started(&device) == MA_TRUE
+        };
+    }
+
+    static const char* phaseName(Phase p) {
+        switch (p) {
+            case Phase::Idle:       return "idle";
+            case Phase::Callback:   return "callback";
+            case Phase::Decode:     return "decode";
+            case Phase::Transition: return "transition";
+        }
+        return "unknown";
+    }
+
+    // Tear down and reopen the output device on a helper thread, so a caller
+    // such as the watchdog never blocks on a stuck callback. At most one
+    // restart runs at a time. A shared device is reopened for all its players.
+    void restartDevice() {
+        if (shared) {
+            shared->restart();
+            return;
+        }
+        bool expected = false;
+        if (!restarting.compare_exchange_strong(expected, true)) return;
+
+        std::thread([this]() {
+            std::cerr << "Restarting audio device\n";
+            // Blocks until a stuck callback finally returns
+            ma_device_uninit(&device);
+            if (ma_device_init(deviceContext(), &config, &device) != MA_SUCCESS || ma_device_start(&device) != MA_SUCCESS) {
+                std::cerr << "Failed to restart audio device\n";
+            }
+            restarting = false;
+        }).detach();
+    }
+
+    // Time-to-first-sound probe: the next play() arms it, and the first
+    // callback after that which outputs anything above silence records its
+    // wall-clock time (see sys/ttfs.h)
+    void armFirstSound() {
+        firstSoundAt.store(0, std::memory_order_relaxed);
+        firstSoundRequested.store(true, std::memory_order_relaxed);
+    }
+
+    uint64_t getFirstSoundAt() const {
+        return firstSoundAt.load(std::memory_order_acquire);
+    }
+
+    // Position in the current track of what the device is playing, in
+    // device frames, following seeks and loops (not from the audio thread)
+    ma_uint64 getPosition() {
+        std::scoped_lock lock(mutex);
+        pruneSegments();
+        return trackPositionAt(ring->playedPosition());
+    }
+
+    ma_uint32 getSampleRate() const { return deviceRate; }
+    ma_uint32 getChannels() const { return deviceChannels; }
+
+    // 16-bit stereo copy of the output for network listeners. The audio thread
+    // converts and writes it once per callback, but only while streaming is on.
+    const BroadcastRing& getStreamRing() const { return streamRing; }
+
+    void setStreaming(bool enabled) {
+        streaming.store(enabled, std::memory_order_relaxed);
+    }
+
+    // Play the same output on a second device (see sys/mirror.h). The mirror
+    // has to outlive the player, or at least its device callbacks.
+    void setMirror(Mirror* target) {
+        mirror.store(target, std::memory_order_release);
+    }
+
+    // Peak level per output channel since the previous call, then reset the meters.
+    // The audio thread only stores into atomics, so readers never block it.
+    std::vector<float> takePeaks() {
+        ma_uint32 channels = std::min<ma_uint32>(deviceChannels, MAX_METER_CHANNELS);
+        std::vector<float> result(channels);
+        for (ma_uint32 ch = 0; ch < channels; ++ch) {
+            result[ch] = peaks[ch].exchange(0.0f, std::memory_order_relaxed);
+        }
+        return result;
+    }
+
 private:
+    std::unique_ptr<Context> ownedContext; // Players made without a shared context
+    Context& context;
+    SharedDevice* shared = nullptr;        // Device the player is routed into, if not its own
+    ma_device_id deviceId;                 // Of a device picked by name
     ma_device_config config;
-    ma_device device;
+    ma_device device;                      // Own device (unused when shared)
+    ma_uint32 deviceRate = 0;              // Frames the player renders: rate and channel count
+    ma_uint32 deviceChannels = 0;
+
+    ma_context* deviceContext() {
+        return context.get();
+    }
+
+    void open(const std::string& deviceName) {
+        config = ma_device_config_init(ma_device_type_playback);
+        config.playback.format = ma_format_f32;
+
+        // Auto-detect system channels instead of hardcoding to stereo
+        ma_device_info deviceInfo;
+        if (!context.findDevice(deviceName, deviceInfo)) {
+            if (!deviceName.empty()) throw std::runtime_error("No playback device matching \"" + deviceName + "\"");
+            config.playback.channels = 2; // Nothing listed; let the backend pick
+        } else {
+            // A named device is opened by id; the default one is left to the
+            // backend, so it follows the system default
+            if (!deviceName.empty()) {
+                deviceId = deviceInfo.id;
+                config.playback.pDeviceID = &deviceId;
+                std::cout << "Using audio device " << deviceInfo.name << "\n";
+            }
+            if (ma_context_get_device_info(context.get(), ma_device_type_playback, &deviceInfo.id, &deviceInfo) == MA_SUCCESS &&
+                deviceInfo.nativeDataFormatCount > 0) {
+                // Use channels from the first native format
+                config.playback.channels = deviceInfo.nativeDataFormats[0].channels;
+                std::cout << "Detected " << deviceInfo.nativeDataFormats[0].channels << " system audio channels\n";
+            } else {
+                // Default to stereo if no native format info available
+                config.playback.channels = 2;
+                std::cout << "No channel info detected, defaulting to stereo\n";
+            }
+        }
+
+        const Config::Settings& settings = Config::current();
+        config.sampleRate = settings.sampleRate;
+        config.periodSizeInMilliseconds = settings.periodMs;
+        config.performanceProfile = settings.latency == "conservative" ? ma_performance_profile_conservative : ma_performance_profile_low_latency;
+        config.dataCallback = dataCallback;
+        config.pUserData = this;
+
+        if (ma_device_init(deviceContext(), &config, &device) != MA_SUCCESS) {
+            throw std::runtime_error("Failed to initialize audio device");
+        }
+        deviceRate = device.sampleRate;
+        deviceChannels = device.playback.channels;
+        startDecoding();
+
+        ma_device_start(&device);
+    }
+
+    // Ring, scratch buffers and decode thread, once the output layout is known
+    void startDecoding() {
+        const Config::Settings& settings = Config::current();
+        for (auto& peak : peaks) peak.store(0.0f);
+
+        // The ring holds frames already in the device layout, plus room for a fast start
+        ma_uint64 prefetchFrames = ma_uint64(settings.prefetchMs) * deviceRate / 1000;
+        ring = std::make_unique<FrameRing>(static_cast<size_t>(prefetchFrames + FAST_START_FRAMES), deviceChannels);
+        mapScratch.resize(DECODE_BLOCK_FRAMES * deviceChannels);
+        seamScratch.resize(loopFadeFrames() * deviceChannels);
+        decodeThread = std::thread([this]() { this->decodeLoop(); });
+    }
+
+    // Guards the stems and playlist. Commands and the decode thread take it;
+    // the device callback never does.
     std::mutex mutex;
 
-    std::unique_ptr<ma_decoder> decoder;
+    // Decoders are opened by ma_decoder_init_*, so they need uninit as well as delete
+    struct DecoderDeleter {
+        std::shared_ptr<PcmCache::MappedFile> backing; // Memory the decoder reads, if not a file of its own
+
+        void operator()(ma_decoder* decoder) const {
+            ma_decoder_uninit(decoder);
+            delete decoder;
+        }
+    };
+    using DecoderPtr = std::unique_ptr<ma_decoder, DecoderDeleter>;
+
+    // One decoder of the current track. A plain file is a group of one stem;
+    // every stem is read for the same frames in each block, so a group can't drift.
+    struct Stem {
+        DecoderPtr decoder;
+        std::string path;
+        float gain = 1.0f;
+        bool muted = false;
+        float appliedGain = 1.0f;    // Gain the last mixed block ended on
+        bool atEnd = false;          // Shorter stems go silent until the longest one ends
+        ma_uint64 framesRead = 0;    // In the current block
+        std::vector<float> decoded;  // Decoder layout
+        std::vector<float> mapped;   // Device layout
+        bool wantsSeekTable = false; // Long MP3 without a seek table bound yet (see sys/mp3seek.h)
+    };
+    static constexpr size_t PARALLEL_STEMS = 3;          // Fewer stems decode on the decode thread alone
+    static constexpr double MIN_TRANSITION_RATE = 0.5;
+    static constexpr double MAX_TRANSITION_RATE = 2.0;
+    static constexpr ma_uint64 GAIN_RAMP_FRAMES = 256;   // Gain changes fade over ~6 ms
+    static constexpr float MAX_STEM_GAIN = 4.0f;
+
+    // Without a seek table miniaudio seeks in an MP3 by decoding every frame
+    // up to the target (~35 ms per MB, 20 s to the end of a 10-hour book).
+    // Building a table only parses frame headers, about 20 times faster, so
+    // files this big get one in the background as soon as they are opened,
+    // with a point about every second at 128 kbit/s.
+    static constexpr uint64_t SEEK_TABLE_MIN_BYTES = 1024 * 1024;
+    static constexpr uint64_t SEEK_TABLE_BYTES_PER_POINT = 16 * 1024;
+    static constexpr uint32_t MAX_SEEK_TABLE_POINTS = 65535;
+
+    std::vector<Stem> stems;
     std::vector<std::string> playlist;
     std::vector<uint8_t> buffer;
     size_t playlistIndex = 0;
     std::string currentPath;
     
-    float volume = 1.0f;
-    bool paused = false;
+    std::atomic<float> volume{1.0f};
+    std::atomic<bool> paused{false};
     PlaybackEndCallback onPlaybackEndCallback;
 
+    // Decode-ahead: the decode thread keeps the ring full except for
+    // FAST_START_FRAMES (at least prefetch_ms from the config), and the callback
+    // only copies them out. The spare room lets play() put the first periods of
+    // a new track in without waiting for the callback to drain the old one.
+    static constexpr ma_uint64 FAST_START_FRAMES = 4096;  // Upper bound for the synchronous first decode
+    static constexpr ma_uint64 DECODE_BLOCK_FRAMES = 1024;
+    static constexpr std::chrono::milliseconds DECODE_IDLE{5};
+    std::unique_ptr<FrameRing> ring;
+    std::thread decodeThread;
+    std::atomic<bool> decoding{true};
+    std::condition_variable wake;
+    std::vector<float> mapScratch;     // Mixed stems, device layout
+    bool decoderAtEnd = false;
+    ma_uint64 decodedFrame = 0;        // Track position of the next frame to decode
+
+    // Where the ring's audio jumps within the track (track starts, seeks,
+    // loop seams), oldest first; positions in between run on linearly
+    struct Segment {
+        uint64_t ringStart;
+        ma_uint64 trackStart;
+    };
+    std::deque<Segment> segments;
+
+    // Loop region of the current track; loopEnd NONE loops wherever the track runs out
+    static constexpr ma_uint32 LOOP_FADE_MS = 5;
+    bool looping = false;
+    ma_uint64 loopStart = 0;
+    ma_uint64 loopEnd = FrameRing::NONE;
+    std::vector<float> seamScratch;    // Loop end, before the crossfade
+
+    // Crossfade into the next file (prepareTransition). Armed until the
+    // decode reaches outFrame; there the file becomes the current track and
+    // the old one fades out under it, then the speed glides back to 1.
+    struct Transition {
+        std::string path;
+        Stem incoming;               // Until the fade starts
+        Stem outgoing;               // From then on
+        ma_uint64 outFrame = 0;      // Where the fade starts in the old track
+        ma_uint64 inFrame = 0;       // And in the new one
+        ma_uint64 fadeFrames = 0;
+        ma_uint64 glideFrames = 0;
+        ma_uint64 written = 0;       // Frames since the fade started
+        double rate = 1.0;           // Speed of the new track during the fade
+        double position = 0;         // New track position (device frames at normal speed)
+        bool started = false;
+
+        // Speed for the block starting now, and frames until it changes stage
+        double speed() const {
+            if (written < fadeFrames) return rate;
+            return rate + (1.0 - rate) * double(written - fadeFrames) / double(glideFrames);
+        }
+        ma_uint64 stageLeft() const {
+            return written < fadeFrames ? fadeFrames - written : fadeFrames + glideFrames - written;
+        }
+    };
+    std::unique_ptr<Transition> transition;
+    std::string takeoverPath;               // Fade written to the ring, owner not told yet
+    uint64_t takeoverAt = FrameRing::NONE;  // Ring position where it starts
+    TransitionCallback onTransitionCallback;
+    uint64_t trackEnd = FrameRing::NONE;                  // Ring position where the current track ends
+    std::atomic<uint64_t> endReachedAt{FrameRing::NONE};  // Set by the callback once it plays up to an end
+    std::atomic<bool> trackActive{false};                 // Ring should have audio; running dry is an underrun
+
+    // Status for meters and now-playing listeners, written by the audio thread
+    static constexpr ma_uint32 MAX_METER_CHANNELS = 8;
+    std::atomic<float> peaks[MAX_METER_CHANNELS];
+
+    // About 6 seconds of 44.1 kHz 16-bit stereo
+    static constexpr size_t STREAM_RING_BYTES = 1 << 20;
+    BroadcastRing streamRing{STREAM_RING_BYTES};
+    std::atomic<bool> streaming{false};
+    std::atomic<Mirror*> mirror{nullptr};
+
+    // Instrumentation (shared by all players through the metrics registry)
+    Metrics::Histogram& callbackDuration = Metrics::histogram("loud_callback_duration_seconds", "Time spent in the audio device callback");
+    Metrics::Histogram& decodeDuration = Metrics::histogram("loud_decode_block_seconds", "Time to decode one block of PCM frames");
+    Metrics::Histogram& trackOpenDuration = Metrics::histogram("loud_track_open_seconds", "Time to open a track and initialize its decoder");
+    Metrics::Histogram& seekDuration = Metrics::histogram("loud_seek_seconds", "Time to seek and decode the first periods after the new position");
+    Metrics::Histogram& fastStartDuration = Metrics::histogram("loud_fast_start_seconds", "Time to decode the first periods of a track before play returns");
+    Metrics::Counter& xruns = Metrics::counter("loud_xruns_total", "Device callbacks that arrived more than two periods late");
+    Metrics::Counter& underruns = Metrics::counter("loud_underruns_total", "Device callbacks that found the decode-ahead ring short of audio");
+    std::chrono::steady_clock::time_point lastCallback;
+    double lastPeriodSeconds = 0;
+
+    // Liveness for the watchdog
+    std::atomic<uint64_t> heartbeat{0};
+    std::atomic<int> phase{static_cast<int>(Phase::Idle)};
+    std::atomic<uint64_t> phaseSince{0};
+    std::atomic<int> decodePhase{static_cast<int>(Phase::Idle)};
+    std::atomic<uint64_t> decodePhaseSince{0};
+    std::atomic<bool> restarting{false};
+
+    std::atomic<bool> firstSoundRequested{false};
+    std::atomic<bool> firstSoundArmed{false};
+    std::atomic<uint64_t> firstSoundAt{0};
+
+    void setPhase(Phase p) {
+        phase.store(static_cast<int>(p), std::memory_order_relaxed);
+        phaseSince.store(Trace::nanoseconds(), std::memory_order_relaxed);
+    }
+
+    void setDecodePhase(Phase p) {
+        decodePhase.store(static_cast<int>(p), std::memory_order_relaxed);
+        decodePhaseSince.store(Trace::nanoseconds(), std::memory_order_relaxed);
+    }
+
+    // Marks the callback idle however it returns
+    struct PhaseGuard {
+        Player* player;
+        ~PhaseGuard() {
+            player->setPhase(Phase::Idle);
+        }
+    };
+
     void stop_nolock() {
-        decoder.reset();
+        trackActive = false;
+        stems.clear();
+        transition.reset();
+        takeoverPath.clear();
+        looping = false;
+        ring->flush();
+        trackEnd = FrameRing::NONE;
+        decoderAtEnd = false;
         buffer.clear();
         currentPath.clear();
         paused = false;
     }
 
+    // Frames decoded synchronously before a command returns: a period or two
+    ma_uint64 fastStartFrames() const {
+        ma_uint32 period = shared ? shared->getPeriodFrames() : device.playback.internalPeriodSizeInFrames;
+        return std::min<ma_uint64>(period ? period * 2 : DECODE_BLOCK_FRAMES, FAST_START_FRAMES);
+    }
+
+    // Fast start: drop whatever the old track left in the ring and decode
+    // the first period or two of the new one (from track frame `from`) right
+    // here, so the very next callback has audio. The decode thread fills the
+    // rest in the background.
+    void startTrack(ma_uint64 from = 0) {
+        ring->flush();
+        segments.clear();
+        segments.push_back(Segment{ring->writePosition(), from});
+        trackEnd = FrameRing::NONE;
+        decoderAtEnd = false;
+        decodedFrame = from;
+
+        if (!stems.empty()) {
+            TRACE_SCOPE("player.fastStart");
+            Metrics::ScopedTimer fastStartTimer(fastStartDuration);
+            decodeFrames(fastStartFrames());
+            trackActive = true;
+        }
+
+        wake.notify_one();
+    }
+
+    // Decode again what's queued but not played yet (after a gain, mute or
+    // loop change): take it back from the ring, seek every stem to where it
+    // started and refill the first periods at once. What the device may be
+    // reading right now stays, and the gain ramp hides the seam.
+    void retake() {
+        // What's queued of a crossfade mixes two tracks; let it play out
+        if (stems.empty() || (transition && transition->started)) return;
+        TRACE_SCOPE("player.retake");
+        ma_uint64 keep = fastStartFrames();
+        size_t dropped = ring->rewind(static_cast<size_t>(keep));
+        if (dropped == 0) return; // Played out already, new gains apply to what's left
+
+        uint64_t from = ring->writePosition();
+        decodedFrame = trackPositionAt(from);
+        while (!segments.empty() && segments.back().ringStart >= from) segments.pop_back();
+        segments.push_back(Segment{from, decodedFrame});
+        seekStems(decodedFrame);
+        trackEnd = FrameRing::NONE; // rewind() dropped the end marker with the frames
+        decoderAtEnd = false;
+        decodeFrames(keep);
+        wake.notify_one();
+    }
+
+    // Track position of a ring position, from the segment it falls in
+    ma_uint64 trackPositionAt(uint64_t ringPos) const {
+        for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+            if (it->ringStart <= ringPos) return it->trackStart + (ringPos - it->ringStart);
+        }
+        return segments.empty() ? 0 : segments.front().trackStart;
+    }
+
+    // Forget segments the device has played past (keeps the current one)
+    void pruneSegments() {
+        uint64_t played = ring->playedPosition();
+        while (segments.size() > 1 && segments[1].ringStart <= played) segments.pop_front();
+    }
+
+    void seekStems(ma_uint64 frame) {
+        for (Stem& stem : stems) {
+            if (stem.wantsSeekTable) bindSeekTable(stem);
+            // A position past the end of a shorter stem leaves it silent
+            stem.atEnd = ma_decoder_seek_to_pcm_frame(stem.decoder.get(), frame) != MA_SUCCESS;
+        }
+    }
+
+    // Run fn for each stem index, on the worker pool for larger groups
+    void forEachStem(size_t count, const std::function<void(size_t)>& fn) {
+        if (count >= PARALLEL_STEMS) {
+            Work::pool().parallelFor(count, fn);
+        } else {
+            for (size_t i = 0; i < count; i++) fn(i);
+        }
+    }
+
+    // Decode up to count frames into the ring (mutex held)
+    void decodeFrames(ma_uint64 count) {
+        ma_uint64 fade = loopFadeFrames();
+
+        while (count > 0 && !decoderAtEnd) {
+            bool loopEndKnown = looping && loopEnd != FrameRing::NONE;
+
+            // Loops turn around on this thread, well before the device gets there
+            if (loopEndKnown && decodedFrame + fade >= loopEnd) {
+                if (!writeLoopSeam()) break;
+                count -= std::min(count, fade);
+                continue;
+            }
+
+            // A prepared transition starts exactly at its frame (loops win)
+            bool armed = transition && !transition->started && !looping;
+            if (armed && decodedFrame == transition->outFrame) {
+                beginTransition();
+                armed = false;
+            }
+
+            ma_uint64 wanted = std::min(count, DECODE_BLOCK_FRAMES);
+            if (loopEndKnown) wanted = std::min(wanted, loopEnd - fade - decodedFrame);
+            if (armed && decodedFrame < transition->outFrame) wanted = std::min(wanted, transition->outFrame - decodedFrame);
+            ma_uint64 framesRead;
+            if (transition && transition->started) {
+                wanted = std::min(wanted, transition->stageLeft());
+                framesRead = writeTransitionBlock(wanted);
+            } else {
+                framesRead = decodeBlock(wanted);
+                ring->write(mapScratch.data(), static_cast<size_t>(framesRead));
+                decodedFrame += framesRead;
+            }
+            count -= std::min(count, wanted);
+
+            if (framesRead < wanted) {
+                if (looping && decodedFrame > loopStart) {
+                    // Track ran out before the loop end: carry on from the loop
+                    // start right after its last frame (gap-free, no fade)
+                    seekStems(loopStart);
+                    decodedFrame = loopStart;
+                    segments.push_back(Segment{ring->writePosition(), loopStart});
+                    continue;
+                }
+                looping = false; // Loop starts past the end, nothing to repeat
+                decoderAtEnd = true;
+                trackEnd = ring->markEnd();
+            }
+        }
+    }
+
+    // Decode and mix one block of every stem into mapScratch; returns the
+    // frames read by the longest stem
+    ma_uint64 decodeBlock(ma_uint64 wanted) {
+        ma_uint64 framesRead = 0;
+        {
+            Metrics::ScopedTimer decodeTimer(decodeDuration);
+            setDecodePhase(Phase::Decode);
+            framesRead = readStems(wanted);
+            setDecodePhase(Phase::Idle);
+        }
+
+        TRACE_SCOPE("dsp.stemMix");
+        mixStems(framesRead);
+        return framesRead;
+    }
+
+    ma_uint64 loopFadeFrames() const {
+        return ma_uint64(deviceRate) * LOOP_FADE_MS / 1000;
+    }
+
+    // Loop seam: crossfade the last fade frames before the loop end into the
+    // fade frames just before the loop start, then carry on from the loop
+    // start, so the loop is exactly loopEnd - loopStart long. A loop starting
+    // within a fade of the track start fades into its first frames instead.
+    // False if the ring has no room for the seam yet.
+    bool writeLoopSeam() {
+        ma_uint64 fade = loopFadeFrames();
+        if (ring->writable() < fade) return false;
+        TRACE_SCOPE("player.loopSeam");
+        ma_uint32 channels = deviceChannels;
+        size_t samples = static_cast<size_t>(fade * channels);
+
+        ma_uint64 tailRead = decodeBlock(fade);
+        std::copy(mapScratch.begin(), mapScratch.begin() + tailRead * channels, seamScratch.begin());
+        std::fill(seamScratch.begin() + tailRead * channels, seamScratch.begin() + samples, 0.0f);
+
+        ma_uint64 head = loopStart >= fade ? loopStart - fade : loopStart;
+        seekStems(head);
+        ma_uint64 headRead = decodeBlock(fade);
+        std::fill(mapScratch.begin() + headRead * channels, mapScratch.begin() + samples, 0.0f);
+
+        // Raised-cosine fade; the two gains always add up to one
+        for (ma_uint64 frame = 0; frame < fade; frame++) {
+            float in = 0.5f - 0.5f * std::cos(3.14159265f * (float(frame) + 0.5f) / float(fade));
+            for (ma_uint32 channel = 0; channel < channels; channel++) {
+                size_t i = static_cast<size_t>(frame * channels + channel);
+                mapScratch[i] = seamScratch[i] * (1.0f - in) + mapScratch[i] * in;
+            }
+        }
+
+        pruneSegments();
+        segments.push_back(Segment{ring->writePosition(), head});
+        ring->write(mapScratch.data(), static_cast<size_t>(fade));
+        decodedFrame = head + fade;
+        return true;
+    }
+
+    // Swap the prepared file in as the current track at this point of the
+    // ring; the old one keeps decoding for the fade
+    void beginTransition() {
+        TRACE_SCOPE("player.beginTransition");
+        Transition& t = *transition;
+        t.outgoing = std::move(stems[0]);
+        stems.clear();
+        stems.push_back(std::move(t.incoming));
+        t.started = true;
+        t.position = double(t.inFrame);
+        currentPath = t.path;
+        decodedFrame = t.inFrame;
+
+        pruneSegments();
+        segments.push_back(Segment{ring->writePosition(), t.inFrame});
+        takeoverPath = t.path;
+        takeoverAt = ring->writePosition();
+    }
+
+    // One block of a running transition: the new track at its current speed
+    // with the old one fading out under it (equal-power, as the two are
+    // unrelated recordings). Returns the frames of the new track read.
+    ma_uint64 writeTransitionBlock(ma_uint64 wanted) {
+        Transition& t = *transition;
+        double speed = setStemSpeed(stems[0], t.speed());
+        if (speed != 1.0) {
+            // Off normal speed, track position and ring position part ways
+            pruneSegments();
+            segments.push_back(Segment{ring->writePosition(), static_cast<ma_uint64>(std::llround(t.position))});
+        }
+        ma_uint64 framesRead = decodeBlock(wanted);
+
+        if (t.written < t.fadeFrames) {
+            TRACE_SCOPE("dsp.crossfade");
+            const Config::Settings& settings = Config::current();
+            MixGains gains{settings.centerGain, settings.lfeGain, settings.rearGain};
+            Stem& old = t.outgoing;
+            readStem(old, framesRead, gains);
+            float oldGain = old.muted ? 0.0f : old.gain;
+            ma_uint32 channels = deviceChannels;
+            for (ma_uint64 frame = 0; frame < framesRead; frame++) {
+                float x = (float(t.written + frame) + 0.5f) / float(t.fadeFrames);
+                float in = std::sin(1.57079633f * x);
+                float out = frame < old.framesRead ? std::cos(1.57079633f * x) * oldGain : 0.0f;
+                for (ma_uint32 channel = 0; channel < channels; channel++) {
+                    size_t i = static_cast<size_t>(frame * channels + channel);
+                    mapScratch[i] = mapScratch[i] * in + old.mapped[i] * out;
+                }
+            }
+        }
+
+        ring->write(mapScratch.data(), static_cast<size_t>(framesRead));
+        t.written += framesRead;
+        t.position += double(framesRead) * speed;
+        decodedFrame = static_cast<ma_uint64>(std::llround(t.position));
+
+        if (framesRead < wanted || t.written >= t.fadeFrames + t.glideFrames) {
+            // Back at normal speed (or the new track ran out): carry on as usual
+            setStemSpeed(stems[0], 1.0);
+            segments.push_back(Segment{ring->writePosition(), decodedFrame});
+            transition.reset();
+        }
+        return framesRead;
+    }
+
+    // A seek during a transition: if the device hasn't reached the fade yet,
+    // the old track is still the one playing and gets the seek. One
+    // that hasn't started still applies afterwards.
+    void abandonTransition() {
+        if (!transition || !transition->started) return;
+        if (ring->playedPosition() < takeoverAt) {
+            stems.clear();
+            stems.push_back(std::move(transition->outgoing));
+            currentPath = stems[0].path;
+            takeoverPath.clear();
+        } else {
+            setStemSpeed(stems[0], 1.0);
+        }
+        transition.reset();
+    }
+
+    // Play a stem at speed times normal by retuning its resampler; returns
+    // the speed actually set (output rates are whole hertz)
+    double setStemSpeed(Stem& stem, double speed) {
+        ma_decoder* decoder = stem.decoder.get();
+        ma_uint32 rate = static_cast<ma_uint32>(std::llround(deviceRate / speed));
+        if (decoder->converter.hasResampler && decoder->outputSampleRate != rate) {
+            // Seeks and lengths are computed from outputSampleRate, so it follows along
+            ma_data_converter_set_rate(&decoder->converter, decoder->converter.sampleRateIn, rate);
+            decoder->outputSampleRate = rate;
+        }
+        return double(deviceRate) / decoder->outputSampleRate;
+    }
+
+    // Frames in the current track (the longest stem), NONE if a decoder can't tell
+    ma_uint64 trackLength() {
+        ma_uint64 longest = 0;
+        for (Stem& stem : stems) {
+            ma_uint64 length = 0;
+            if (ma_decoder_get_length_in_pcm_frames(stem.decoder.get(), &length) != MA_SUCCESS || length == 0) {
+                return FrameRing::NONE;
+            }
+            longest = std::max(longest, length);
+        }
+        return longest;
+    }
+
+    // Read the same block from every stem and map it to the device layout.
+    // Returns the frames read by the longest stem; shorter ones pad with silence.
+    ma_uint64 readStems(ma_uint64 wanted) {
+        // Gains come from one config snapshot, so a reload never splits a block
+        const Config::Settings& settings = Config::current();
+        MixGains gains{settings.centerGain, settings.lfeGain, settings.rearGain};
+
+        forEachStem(stems.size(), [&](size_t index) { readStem(stems[index], wanted, gains); });
+
+        ma_uint64 longest = 0;
+        for (const Stem& stem : stems) longest = std::max(longest, stem.framesRead);
+        return longest;
+    }
+
+    // Decode a block of one stem and map it to the device layout (stem.mapped)
+    void readStem(Stem& stem, ma_uint64 wanted, const MixGains& gains) {
+        stem.framesRead = 0;
+        if (stem.atEnd) return;
+        {
+            TRACE_SCOPE("decoder.read");
+            ma_decoder_read_pcm_frames(stem.decoder.get(), stem.decoded.data(), wanted, &stem.framesRead);
+        }
+        if (stem.framesRead < wanted) stem.atEnd = true;
+
+        TRACE_SCOPE("dsp.channelMap");
+        mapChannels(stem.decoded.data(), stem.decoder->outputChannels, stem.mapped.data(), deviceChannels, stem.framesRead, gains);
+    }
+
+    // Sum the stems into mapScratch. A stem whose gain changed fades to the
+    // new one over GAIN_RAMP_FRAMES so the step doesn't click.
+    void mixStems(ma_uint64 frameCount) {
+        ma_uint32 channels = deviceChannels;
+        float* out = mapScratch.data();
+
+        // Plain file at unity gain: nothing to mix
+        if (stems.size() == 1 && stems[0].appliedGain == 1.0f && !stems[0].muted && stems[0].gain == 1.0f) {
+            std::memcpy(out, stems[0].mapped.data(), frameCount * channels * sizeof(float));
+            return;
+        }
+
+        std::memset(out, 0, frameCount * channels * sizeof(float));
+        for (Stem& stem : stems) {
+            const float* in = stem.mapped.data();
+            float target = stem.muted ? 0.0f : stem.gain;
+            ma_uint64 ramp = stem.appliedGain == target ? 0 : std::min(GAIN_RAMP_FRAMES, stem.framesRead);
+
+            for (ma_uint64 frame = 0; frame < ramp; frame++) {
+                float gain = stem.appliedGain + (target - stem.appliedGain) * float(frame + 1) / float(ramp);
+                for (ma_uint32 channel = 0; channel < channels; channel++) {
+                    out[frame * channels + channel] += in[frame * channels + channel] * gain;
+                }
+            }
+            stem.appliedGain = target;
+
+            if (target == 0.0f) continue;
+            for (size_t i = ramp * channels; i < stem.framesRead * channels; i++) {
+                out[i] += in[i] * target;
+            }
+        }
+    }
+
+    // Keeps the ring topped up and hands finished tracks on to the
+    // end-of-playback handling, all off the audio thread
+    void decodeLoop() {
+        TRACE_THREAD_NAME("decode");
+        while (decoding.load(std::memory_order_relaxed)) {
+            bool finished = false;
+            bool worked = false;
+            std::string takeover;
+            TransitionCallback onTakeover;
+            {
+                std::scoped_lock lock(mutex);
+                if (!takeoverPath.empty() && ring->playedPosition() >= takeoverAt) {
+                    // The device is into the crossfade: the new track has begun
+                    takeover.swap(takeoverPath);
+                    onTakeover = onTransitionCallback;
+                }
+                uint64_t reached = endReachedAt.load(std::memory_order_acquire);
+                if (trackEnd != FrameRing::NONE && reached == trackEnd) {
+                    // Every frame of the track has been played
+                    trackEnd = FrameRing::NONE;
+                    trackActive = false;
+                    finished = true;
+                } else if (!stems.empty() && !decoderAtEnd) {
+                    // One block per lock, so a play command never waits long
+                    size_t room = ring->writable();
+                    if (room > FAST_START_FRAMES) {
+                        decodeFrames(std::min<ma_uint64>(room - FAST_START_FRAMES, DECODE_BLOCK_FRAMES));
+                        worked = true;
+                    }
+                }
+            }
+
+            // Called without the lock, like the end-of-playback callback
+            if (onTakeover) {
+                TRACE_SCOPE("audio.takeover");
+                onTakeover(takeover);
+            }
+
+            if (finished) {
+                TRACE_SCOPE("audio.transition");
+                setDecodePhase(Phase::Transition);
+                finishTrack();
+                setDecodePhase(Phase::Idle);
+            } else if (!worked) {
+                std::unique_lock lock(mutex);
+                wake.wait_for(lock, DECODE_IDLE);
+            }
+        }
+    }
+
+    // The current track has played out: let the owner pick what comes next,
+    // or advance through our own directory playlist
+    void finishTrack() {
+        PlaybackEndCallback callback;
+        {
+            std::scoped_lock lock(mutex);
+            callback = onPlaybackEndCallback;
+        }
+
+        // Called without the lock, since it usually starts another track
+        if (callback) {
+            callback();
+            return;
+        }
+
+        std::scoped_lock lock(mutex);
+        if (playlist.size() <= 1) return;
+
+        playlistIndex = (playlistIndex + 1) % playlist.size();
+        currentPath = playlist[playlistIndex];
+
+        // Check if the file exists before creating a new decoder
+        if (!Zip::exists(currentPath)) {
+            std::cerr << "Next track file not found: " << currentPath << "\n";
+
+            // Try each track in the playlist until we find one that exists
+            bool foundValid = false;
+            for (size_t i = 0; i < playlist.size(); i++) {
+                playlistIndex = (playlistIndex + 1) % playlist.size();
+                currentPath = playlist[playlistIndex];
+
+                if (Zip::exists(currentPath)) {
+                    foundValid = true;
+                    break;
+                }
+            }
+
+            if (!foundValid) {
+                std::cerr << "No valid tracks found in playlist\n";
+                stems.clear();
+                return;
+            }
+        }
+
+        loadFromFile(currentPath);
+        startTrack();
+    }
+
     void loadFromFile(const std::string& path) {
-        decoder = std::make_unique<ma_decoder>();
-        
-        // Check if path exists before attempting to decode
-        namespace fs = std::filesystem;
-        if (!fs::exists(path)) {
+        TRACE_SCOPE("player.loadFromFile");
+        Metrics::ScopedTimer openTimer(trackOpenDuration);
+        stems.clear();
+        transition.reset();
+        takeoverPath.clear();
+        looping = false;
+
+        if (DecoderPtr decoder = openDecoder(path)) {
+            std::cout << "Playing: " << path << "\n";
+            std::cout << "  Channels: " << decoder->outputChannels << " -> " << deviceChannels
+                      << ", Sample rate: " << deviceRate << " Hz\n";
+            addStem(std::move(decoder), path);
+        }
+    }
+
+    // Null (after logging why) if the file is missing or can't be decoded.
+    // sampleRate 0 decodes at the device rate, from the decoded track cache
+    // when it has the file (see sys/pcmcache.h).
+    DecoderPtr openDecoder(const std::string& path, ma_uint32 sampleRate = 0) const {
+        // Check if path exists (on disk or in an archive) before attempting to decode
+        if (!Zip::exists(path)) {
             std::cerr << "File not found: " << path << "\n";
-            decoder.reset();
-            return;
+            return nullptr;
         }
         
-        // Get the current device channel count for proper channel mapping
-        ma_uint32 deviceChannels = device.playback.channels;
-        
-        // Configure decoder to match output device settings
-        ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, deviceChannels, device.sampleRate);
-        
+        ma_decoder_config decoderConfig = decoderConfigFor(sampleRate);
+        if (sampleRate == 0) {
+            if (DecoderPtr cached = openCached(path, decoderConfig)) return cached;
+            if (PcmCache::cache().claim(path, deviceRate)) {
+                ma_uint32 rate = deviceRate;
+                Work::pool().submit([path, rate]() { buildCacheEntry(path, rate); });
+            }
+        }
+
+        ma_decoder* decoder = new ma_decoder;
+        if (initDecoderFile(path, decoderConfig, decoder) != MA_SUCCESS) {
+            std::cerr << "Failed to load: " << path << "\n";
+            delete decoder;
+            return nullptr;
+        }
+        return DecoderPtr(decoder);
+    }
+
+    static ma_result initDecoderFile(const std::string& path, const ma_decoder_config& decoderConfig, ma_decoder* decoder) {
+        // Entries of ZIP archives are read (and inflated) in place
+        if (Zip::isEntryPath(path)) {
+            return ma_decoder_init_vfs(Zip::vfs(), path.c_str(), &decoderConfig, decoder);
+        }
+
         // Handle paths with Unicode characters
-        ma_result result;
         #ifdef _WIN32
         // On Windows, convert UTF-8 to wide string for proper Unicode support
         std::wstring widePath = utf8_to_wstring(path);
         if (!widePath.empty()) {
-            result = ma_decoder_init_file_w(widePath.c_str(), &decoderConfig, decoder.get());
-        } else {
-            // Fallback to direct path if conversion failed
-            result = ma_decoder_init_file(path.c_str(), &decoderConfig, decoder.get());
+            return ma_decoder_init_file_w(widePath.c_str(), &decoderConfig, decoder);
         }
+        // Fallback to direct path if conversion failed
+        return ma_decoder_init_file(path.c_str(), &decoderConfig, decoder);
         #else
         // On other platforms, standard UTF-8 path should work
-        result = ma_decoder_init_file(path.c_str(), &decoderConfig, decoder.get());
+        return ma_decoder_init_file(path.c_str(), &decoderConfig, decoder);
         #endif
-        
-        if (result != MA_SUCCESS) {
-            std::cerr << "Failed to load: " << path << "\n";
-            decoder.reset();
+    }
+
+    // A decoder over the mapped cache entry of the file, null on a miss.
+    // Format, channels and rate already match, so nothing is converted.
+    static DecoderPtr openCached(const std::string& path, const ma_decoder_config& decoderConfig) {
+        std::shared_ptr<PcmCache::MappedFile> mapped = PcmCache::cache().open(path, decoderConfig.sampleRate);
+        if (!mapped) return nullptr;
+        ma_decoder_config cachedConfig = decoderConfig;
+        ma_decoding_backend_vtable* backends[] = { PcmPack::backend() }; // Packed entries
+        cachedConfig.ppCustomBackendVTables = backends;
+        cachedConfig.customBackendCount = 1;
+        ma_decoder* decoder = new ma_decoder;
+        if (ma_decoder_init_memory(mapped->data(), mapped->size(), &cachedConfig, decoder) != MA_SUCCESS) {
+            delete decoder;
+            return nullptr;
+        }
+        return DecoderPtr(decoder, DecoderDeleter{ mapped });
+    }
+
+    // Decode a whole file at the device rate into the cache (worker pool).
+    // Same decoder settings as playback, so the entry is bit for bit what
+    // playing the file would have produced.
+    static void buildCacheEntry(const std::string& path, ma_uint32 sampleRate) {
+        TRACE_SCOPE("player.buildCacheEntry");
+        ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 0, sampleRate);
+        ma_decoder decoder;
+        if (initDecoderFile(path, decoderConfig, &decoder) != MA_SUCCESS) {
+            PcmCache::cache().store(path, sampleRate, 1, [](float*, size_t) { return size_t(0); }); // Releases the claim
+            return;
+        }
+        PcmCache::cache().store(path, sampleRate, decoder.outputChannels, [&decoder](float* frames, size_t capacity) {
+            ma_uint64 framesRead = 0;
+            ma_decoder_read_pcm_frames(&decoder, frames, capacity, &framesRead);
+            return static_cast<size_t>(framesRead);
+        });
+        ma_decoder_uninit(&decoder);
+    }
+
+    void addStem(DecoderPtr decoder, const std::string& path) {
+        stems.push_back(makeStem(std::move(decoder), path));
+    }
+
+    Stem makeStem(DecoderPtr decoder, const std::string& path) const {
+        Stem stem;
+        stem.decoded.resize(DECODE_BLOCK_FRAMES * decoder->outputChannels);
+        stem.mapped.resize(DECODE_BLOCK_FRAMES * deviceChannels);
+        stem.decoder = std::move(decoder);
+        stem.path = path;
+        stem.wantsSeekTable = loud_mp3_is_mp3(stem.decoder.get()) && requestSeekTable(path);
+        return stem;
+    }
+
+    // False if the MP3 is too short to need a seek table. Otherwise a build
+    // is queued, unless the index has the table already.
+    static bool requestSeekTable(const std::string& path) {
+        uint64_t size;
+        int64_t mtime;
+        if (path.empty() || !Library::stamp(path, size, mtime) || size < SEEK_TABLE_MIN_BYTES) return false;
+        if (Library::index().claimSeekTable(path)) {
+            Work::pool().submit([path]() { buildSeekTable(path); });
+        }
+        return true;
+    }
+
+    // Scan the file's frame headers once with a decoder of our own (no audio
+    // is decoded) and store the result in the library index
+    static std::vector<Library::SeekPoint> buildSeekTable(const std::string& path) {
+        TRACE_SCOPE("player.buildSeekTable");
+        static auto& buildDuration = Metrics::histogram("loud_seek_table_build_seconds", "Time to build an MP3 seek table");
+        Metrics::ScopedTimer buildTimer(buildDuration);
+        uint64_t size;
+        int64_t mtime;
+        if (!Library::stamp(path, size, mtime)) return {};
+
+        ma_uint32 capacity = static_cast<ma_uint32>(std::clamp<uint64_t>(size / SEEK_TABLE_BYTES_PER_POINT, 1, MAX_SEEK_TABLE_POINTS));
+        std::vector<loud_mp3_seek_point> found(capacity);
+        ma_uint32 count = 0;
+        if (Zip::isEntryPath(path)) {
+            // Scanned through the archive's vfs; the byte offsets are within the entry
+            ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 0, 0);
+            ma_decoder decoder;
+            if (initDecoderFile(path, decoderConfig, &decoder) == MA_SUCCESS) {
+                count = loud_mp3_scan_seek_table(&decoder, found.data(), capacity);
+                ma_decoder_uninit(&decoder);
+            }
         } else {
-            std::cout << "Playing: " << path << "\n";
-            std::cout << "  Channels: " << deviceChannels << ", Sample rate: " << device.sampleRate << " Hz\n";
+            #ifdef _WIN32
+            std::wstring widePath = utf8_to_wstring(path);
+            count = loud_mp3_build_seek_table(path.c_str(), widePath.empty() ? NULL : widePath.c_str(), found.data(), capacity);
+            #else
+            count = loud_mp3_build_seek_table(path.c_str(), NULL, found.data(), capacity);
+            #endif
         }
+
+        std::vector<Library::SeekPoint> points;
+        for (ma_uint32 i = 0; i < count; i++) {
+            points.push_back(Library::SeekPoint{found[i].byteOffset, found[i].frame, found[i].mp3FramesToDiscard, found[i].pcmFramesToDiscard});
+        }
+        Library::index().storeSeekTable(path, points);
+        if (!points.empty()) std::cout << "Seek table ready (" << points.size() << " points): " << path << "\n";
+        return points;
+    }
+
+    // Before a long MP3's first seek. If the background build hasn't stored
+    // the table yet, waiting for it (or building it here when it never got
+    // queued) still beats seeking without one.
+    void bindSeekTable(Stem& stem) {
+        stem.wantsSeekTable = false; // One try per open
+        Library::Index& index = Library::index();
+        std::vector<Library::SeekPoint> points;
+        if (!index.loadSeekTable(stem.path, points)) {
+            index.awaitSeekTable(stem.path);
+            if (!index.loadSeekTable(stem.path, points)) points = buildSeekTable(stem.path);
+        }
+        if (points.empty()) return;
+
+        std::vector<loud_mp3_seek_point> table;
+        table.reserve(points.size());
+        for (const auto& point : points) {
+            table.push_back(loud_mp3_seek_point{point.byteOffset, point.frame, point.mp3FramesToDiscard, point.pcmFramesToDiscard});
+        }
+        if (!loud_mp3_bind_seek_table(stem.decoder.get(), table.data(), static_cast<ma_uint32>(table.size()))) {
+            std::cerr << "Failed to use seek table: " << stem.path << "\n";
+        }
+    }
+
+    // Float at the device rate (or sampleRate), but in the file's own channel
+    // layout: mapChannels() does the up/downmix, with the configured gains
+    ma_decoder_config decoderConfigFor(ma_uint32 sampleRate = 0) const {
+        return ma_decoder_config_init(ma_format_f32, 0, sampleRate ? sampleRate : deviceRate);
     }
 
     // Check if file is a supported audio format
     bool isAudioFile(const std::string& path) {
-        auto pos = path.find_last_of(".");
-        if (pos == std::string::npos) return false;
-        
-        std::string ext = path.substr(pos + 1);
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        
-        static const std::vector<std::string> audioExts = {
-            "mp3", "wav", "ogg", "flac", "aac", "wma", "m4a", "aiff", "opus"
-        };
-        
-        return std::find(audioExts.begin(), audioExts.end(), ext) != audioExts.end();
+        return Config::current().isAudioFile(path);
     }
 
     static void dataCallback(ma_device* device, void* out, const void* in, ma_uint32 frames) {
-        Player* self = static_cast<Player*>(device->pUserData);
-        std::scoped_lock lock(self->mutex);
+        static_cast<Player*>(device->pUserData)->render(static_cast<float*>(out), frames);
+    }
 
-        if (!self->decoder || self->paused) {
-            std::memset(out, 0, frames * ma_get_bytes_per_frame(device->playback.format, device->playback.channels));
-            return;
-        }
+    // The same for a player on a shared device, which mixes it into its channels
+    static void sharedCallback(void* user, float* out, ma_uint32 frames) {
+        static_cast<Player*>(user)->render(out, frames);
+    }
 
-        // Create a temporary buffer for initial decoded data
-        // Most audio files are stereo, so we'll read in stereo format first
-        const ma_uint32 tempChannels = 2; // Most audio files are stereo
-        float tempBuffer[4096 * tempChannels]; // 4096 frames should be enough for a chunk
-        ma_uint64 framesRead;
+    // Fill one period of output. Only copies from the decode-ahead ring and
+    // touches atomics: decoding, file I/O and track changes all happen on the
+    // decode thread.
+    void render(float* outputBuffer, ma_uint32 frames) {
+        checkXrun(frames, deviceRate);
+        Metrics::ScopedTimer callbackTimer(callbackDuration);
 
-        // Read from decoder in its native channel count
-        ma_uint32 decoderChannels = self->decoder->outputChannels;
-        if (frames * decoderChannels > sizeof(tempBuffer) / sizeof(float)) {
-            frames = sizeof(tempBuffer) / sizeof(float) / decoderChannels;
+        thread_local bool traceNamed = false;
+        if (!traceNamed) {
+            TRACE_THREAD_NAME("audio");
+            traceNamed = true;
         }
+        TRACE_SCOPE("audio.callback");
 
-        ma_decoder_read_pcm_frames(self->decoder.get(), tempBuffer, frames, &framesRead);
+        heartbeat.fetch_add(1, std::memory_order_relaxed);
+        PhaseGuard phaseGuard{this};
+        setPhase(Phase::Callback);
 
-        // Map the audio channels properly to the output device
-        float* outputBuffer = reinterpret_cast<float*>(out);
-        ma_uint32 outputChannels = device->playback.channels;
+        ma_uint32 outputChannels = deviceChannels;
+        ma_uint64 framesRead = 0;
 
-        // Clear output buffer first
-        std::memset(out, 0, frames * ma_get_bytes_per_frame(device->playback.format, outputChannels));
+        if (!paused.load(std::memory_order_relaxed)) {
+            TRACE_SCOPE("audio.ringRead");
+            bool flushed = false; // The position follows the ring by itself (see getPosition)
+            framesRead = ring->read(outputBuffer, frames, flushed);
 
-        // Upmix/downmix channels
-        for (ma_uint64 frame = 0; frame < framesRead; frame++) {
-            if (decoderChannels == 1 && outputChannels >= 1) {
-                // Mono to multi-channel (duplicate to all channels)
-                float sample = tempBuffer[frame];
-                for (ma_uint32 channel = 0; channel < outputChannels; channel++) {
-                    outputBuffer[frame * outputChannels + channel] = sample;
-                }
-            }
-            else if (decoderChannels == 2 && outputChannels >= 2) {
-                // Stereo to multi-channel (common case)
-                float leftSample = tempBuffer[frame * 2];
-                float rightSample = tempBuffer[frame * 2 + 1];
-                
-                // Front left and right (first two channels)
-                outputBuffer[frame * outputChannels + 0] = leftSample; // Front Left
-                outputBuffer[frame * outputChannels + 1] = rightSample; // Front Right
-                
-                // Handle 5.1, 7.1, etc.
-                if (outputChannels >= 6) {
-                    // Center = (left+right)/2 with slight attenuation to prevent clipping
-                    outputBuffer[frame * outputChannels + 2] = (leftSample + rightSample) * 0.7f;
-                    
-                    // LFE (subwoofer) - low frequencies only, reduce volume
-                    outputBuffer[frame * outputChannels + 3] = (leftSample + rightSample) * 0.3f;
-                    
-                    // Surround/rear channels - lower volume to prevent overwhelming sound
-                    if (outputChannels >= 5) {
-                        outputBuffer[frame * outputChannels + 4] = leftSample * 0.5f; // Rear Left
-                        if (outputChannels >= 6) {
-                            outputBuffer[frame * outputChannels + 5] = rightSample * 0.5f; // Rear Right
-                        }
-                    }
-                }
-            }
-            else if (decoderChannels >= 2 && outputChannels >= 1) {
-                // Multi-channel to fewer channels - simple downmix
-                for (ma_uint32 outChannel = 0; outChannel < outputChannels; outChannel++) {
-                    float sum = 0;
-                    for (ma_uint32 inChannel = 0; inChannel < decoderChannels; inChannel++) {
-                        sum += tempBuffer[frame * decoderChannels + inChannel];
-                    }
-                    outputBuffer[frame * outputChannels + outChannel] = sum / decoderChannels;
+            if (framesRead < frames) {
+                uint64_t end = ring->reachedEnd();
+                if (end != FrameRing::NONE) {
+                    // The decode thread notices on its next pass and moves on
+                    endReachedAt.store(end, std::memory_order_release);
+                } else if (trackActive.load(std::memory_order_relaxed)) {
+                    underruns.add();
                 }
             }
         }
 
+        // Fill remainder with silence if needed
+        if (framesRead < frames) {
+            std::memset(outputBuffer + framesRead * outputChannels, 0, (frames - framesRead) * outputChannels * sizeof(float));
+        }
+
         // Apply volume if needed
-        if (self->volume != 1.0f) {
-            size_t count = framesRead * outputChannels;
-            for (size_t i = 0; i < count; ++i) {
-                outputBuffer[i] *= self->volume;
+        {
+            TRACE_SCOPE("dsp.volume");
+            float gain = volume.load(std::memory_order_relaxed);
+            if (gain != 1.0f) {
+                size_t count = framesRead * outputChannels;
+                for (size_t i = 0; i < count; ++i) {
+                    outputBuffer[i] *= gain;
+                }
             }
         }
 
-        // Auto-advance to next track if this one ended and we have a playlist
-        if (framesRead < frames) {
-            // Call user-defined callback if set
-            bool handledByCallback = false;
-            if (self->onPlaybackEndCallback) {
-                // Make a local copy of the callback to avoid issues if it's modified during execution
-                auto callback = self->onPlaybackEndCallback;
-                
-                // Release the lock while calling the callback to avoid deadlocks
-                self->mutex.unlock();
-                callback();
-                self->mutex.lock();
-                
-                // The callback has handled the end of playback
-                handledByCallback = true;
+        // Whole period, silence included, so the mirror's clock keeps running
+        if (Mirror* target = mirror.load(std::memory_order_acquire)) {
+            TRACE_SCOPE("dsp.mirror");
+            target->push(outputBuffer, frames);
+        }
+
+        {
+            TRACE_SCOPE("dsp.meters");
+            updateMeters(outputBuffer, framesRead, outputChannels);
+        }
+
+        if (firstSoundArmed.load(std::memory_order_relaxed)) {
+            probeFirstSound(outputBuffer, framesRead * outputChannels);
+        }
+
+        // Keeps stream listeners fed even with silence so their clocks don't stall
+        if (streaming.load(std::memory_order_relaxed)) {
+            TRACE_SCOPE("dsp.streamTap");
+            tapStream(outputBuffer, frames, outputChannels);
+        }
+    }
+
+    // Convert the output to 16-bit stereo and publish it to the stream ring
+    void tapStream(const float* samples, ma_uint64 frameCount, ma_uint32 channels) {
+        int16_t chunk[512 * 2];
+        ma_uint64 done = 0;
+        while (done < frameCount) {
+            ma_uint64 count = std::min<ma_uint64>(512, frameCount - done);
+            for (ma_uint64 i = 0; i < count; ++i) {
+                const float* frame = samples + (done + i) * channels;
+                float left = frame[0];
+                float right = channels > 1 ? frame[1] : frame[0];
+                chunk[i * 2]     = static_cast<int16_t>(std::clamp(left, -1.0f, 1.0f) * 32767.0f);
+                chunk[i * 2 + 1] = static_cast<int16_t>(std::clamp(right, -1.0f, 1.0f) * 32767.0f);
             }
-            
-            // Only proceed with built-in playlist handling if callback didn't handle it
-            if (!handledByCallback && !self->playlist.empty() && self->playlist.size() > 1) {
-                self->playlistIndex = (self->playlistIndex + 1) % self->playlist.size();
-                self->currentPath = self->playlist[self->playlistIndex];
-                
-                // Check if the file exists before creating a new decoder
-                namespace fs = std::filesystem;
-                if (!fs::exists(self->currentPath)) {
-                    std::cerr << "Next track file not found: " << self->currentPath << "\n";
-                    
-                    // Try to find the next valid track in playlist
-                    bool foundValid = false;
-                    
-                    // Try each track in the playlist until we find one that exists
-                    for (size_t i = 0; i < self->playlist.size(); i++) {
-                        self->playlistIndex = (self->playlistIndex + 1) % self->playlist.size();
-                        self->currentPath = self->playlist[self->playlistIndex];
-                        
-                        if (fs::exists(self->currentPath)) {
-                            foundValid = true;
-                            break;
-                        }
-                    }
-                    
-                    // If no valid tracks found, reset the decoder and return silence
-                    if (!foundValid) {
-                        std::cerr << "No valid tracks found in playlist\n";
-                        self->decoder.reset();
-                        
-                        // Fill the rest of the buffer with silence
-                        std::memset(out, 0, frames * ma_get_bytes_per_frame(device->playback.format, device->playback.channels));
-                        return;
-                    }
-                }
-                
-                // Create a new decoder for the next file
-                auto oldDecoder = std::move(self->decoder);
-                self->decoder = std::make_unique<ma_decoder>();
-                
-                // Get current device parameters for proper channel mapping
-                ma_uint32 deviceChannels = device->playback.channels;
-                ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, deviceChannels, device->sampleRate);
-                
-                // Load next track with UTF-8 support
-                ma_result result;
-                #ifdef _WIN32
-                // On Windows, convert UTF-8 to wide string for proper Unicode support
-                std::wstring widePath = utf8_to_wstring(self->currentPath);
-                if (!widePath.empty()) {
-                    result = ma_decoder_init_file_w(widePath.c_str(), &decoderConfig, self->decoder.get());
-                } else {
-                    // Fallback to direct path if conversion failed
-                    result = ma_decoder_init_file(self->currentPath.c_str(), &decoderConfig, self->decoder.get());
-                }
-                #else
-                result = ma_decoder_init_file(self->currentPath.c_str(), &decoderConfig, self->decoder.get());
-                #endif
-                
-                if (result == MA_SUCCESS) {
-                    std::cout << "Next track: " << self->currentPath << "\n";
-                    std::cout << "  Channels: " << deviceChannels << ", Sample rate: " << device->sampleRate << " Hz\n";
-                    
-                    // Fill remainder of buffer with beginning of new track using the same channel mapping logic
-                    if (framesRead < frames) {
-                        // Clear remainder of buffer first
-                        size_t offsetBytes = framesRead * ma_get_bytes_per_frame(device->playback.format, outputChannels);
-                        size_t remainingBytes = (frames - framesRead) * ma_get_bytes_per_frame(device->playback.format, outputChannels);
-                        std::memset(static_cast<char*>(out) + offsetBytes, 0, remainingBytes);
-                        
-                        // Read and map channels for the new track
-                        ma_uint64 additionalFramesRead;
-                        decoderChannels = self->decoder->outputChannels;
-                        
-                        float additionalTempBuffer[4096 * 8]; // Support up to 8 channels for reading
-                        ma_uint64 remainingFrames = frames - framesRead;
-                        if (remainingFrames * decoderChannels > sizeof(additionalTempBuffer) / sizeof(float)) {
-                            remainingFrames = sizeof(additionalTempBuffer) / sizeof(float) / decoderChannels;
-                        }
-                        
-                        ma_decoder_read_pcm_frames(self->decoder.get(), additionalTempBuffer, remainingFrames, &additionalFramesRead);
-                        
-                        // Map additional frames
-                        for (ma_uint64 frame = 0; frame < additionalFramesRead; frame++) {
-                            if (decoderChannels == 1 && outputChannels >= 1) {
-                                // Mono to multi-channel
-                                float sample = additionalTempBuffer[frame];
-                                for (ma_uint32 channel = 0; channel < outputChannels; channel++) {
-                                    outputBuffer[(framesRead + frame) * outputChannels + channel] = sample;
-                                }
-                            }
-                            else if (decoderChannels == 2 && outputChannels >= 2) {
-                                // Stereo to multi-channel
-                                float leftSample = additionalTempBuffer[frame * 2];
-                                float rightSample = additionalTempBuffer[frame * 2 + 1];
-                                
-                                outputBuffer[(framesRead + frame) * outputChannels + 0] = leftSample;
-                                outputBuffer[(framesRead + frame) * outputChannels + 1] = rightSample;
-                                
-                                if (outputChannels >= 6) {
-                                    outputBuffer[(framesRead + frame) * outputChannels + 2] = (leftSample + rightSample) * 0.7f;
-                                    outputBuffer[(framesRead + frame) * outputChannels + 3] = (leftSample + rightSample) * 0.3f;
-                                    
-                                    if (outputChannels >= 5) {
-                                        outputBuffer[(framesRead + frame) * outputChannels + 4] = leftSample * 0.5f;
-                                        if (outputChannels >= 6) {
-                                            outputBuffer[(framesRead + frame) * outputChannels + 5] = rightSample * 0.5f;
-                                        }
-                                    }
-                                }
-                            }
-                            else if (decoderChannels >= 2 && outputChannels >= 1) {
-                                // Multi-channel to fewer channels
-                                for (ma_uint32 outChannel = 0; outChannel < outputChannels; outChannel++) {
-                                    float sum = 0;
-                                    for (ma_uint32 inChannel = 0; inChannel < decoderChannels; inChannel++) {
-                                        sum += additionalTempBuffer[frame * decoderChannels + inChannel];
-                                    }
-                                    outputBuffer[(framesRead + frame) * outputChannels + outChannel] = sum / decoderChannels;
-                                }
-                            }
-                        }
-                        
-                        framesRead += additionalFramesRead;
-                    }
-                } else {
-                    self->decoder.reset();
-                }
+            streamRing.write(chunk, count * 2 * sizeof(int16_t));
+            done += count;
+        }
+    }
+
+    // Count an xrun when the device comes back much later than the previous period
+    void checkXrun(ma_uint32 frames, ma_uint32 sampleRate) {
+        auto now = std::chrono::steady_clock::now();
+        if (lastPeriodSeconds > 0) {
+            double gap = std::chrono::duration<double>(now - lastCallback).count();
+            if (gap > lastPeriodSeconds * 2) xruns.add();
+        }
+        lastCallback = now;
+        lastPeriodSeconds = double(frames) / sampleRate;
+    }
+
+    void probeFirstSound(const float* samples, ma_uint64 count) {
+        for (ma_uint64 i = 0; i < count; ++i) {
+            if (std::fabs(samples[i]) > 1e-4f) {
+                firstSoundAt.store(Bench::wallMicros(), std::memory_order_release);
+                firstSoundArmed.store(false, std::memory_order_relaxed);
+                return;
             }
         }
+    }
 
-        // Fill remainder with silence if needed
-        if (framesRead < frames) {
-            size_t offsetBytes = framesRead * ma_get_bytes_per_frame(device->playback.format, device->playback.channels);
-            size_t remainingBytes = (frames - framesRead) * ma_get_bytes_per_frame(device->playback.format, device->playback.channels);
-            std::memset(static_cast<char*>(out) + offsetBytes, 0, remainingBytes);
+    // Track the peak of each output channel for level meters
+    void updateMeters(const float* samples, ma_uint64 frameCount, ma_uint32 channels) {
+        ma_uint32 metered = std::min(channels, MAX_METER_CHANNELS);
+        for (ma_uint32 ch = 0; ch < metered; ++ch) {
+            float peak = 0.0f;
+            for (ma_uint64 frame = 0; frame < frameCount; ++frame) {
+                peak = std::max(peak, std::fabs(samples[frame * channels + ch]));
+            }
+            if (peak > peaks[ch].load(std::memory_order_relaxed)) {
+                peaks[ch].store(peak, std::memory_order_relaxed);
+            }
         }
     }
 };
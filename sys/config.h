@@ -0,0 +1,441 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#ifdef _WIN32
+#include <windows.h> // For GetModuleFileNameW
+#endif
+
+// Settings for the daemon and the clients, read from loud.ini next to the
+// executables (or the file named by LOUD_CONFIG). Every key is optional and
+// falls back to the built-in default below.
+//
+// The daemon watches the file and reloads it on change. A reload parses and
+// validates into a fresh Settings object and only then publishes it with a
+// single atomic pointer store, so readers (including the audio and decode
+// threads) always see either the old settings or the new ones, never a mix.
+// Replaced objects are kept alive, so a reference from current() never dangles.
+namespace Config {
+
+struct Settings {
+    // [transport]
+    int udpPort = 7001;
+    int httpPort = 7002;
+    std::string httpBind = "127.0.0.1"; // Address the HTTP server listens on, 0.0.0.0 = every interface
+    std::string allowOrigin;            // Web page origin allowed to use the HTTP API, "*" = any, "" = none
+
+    // [audio] (apply on restart)
+    uint32_t sampleRate = 44100;
+    uint32_t periodMs = 0;              // 0 = backend default
+    std::string latency = "low";        // low | conservative
+    uint32_t prefetchMs = 600;          // Decoded audio kept ahead of the device
+    uint32_t mirrorMs = 50;             // How far a mirror device plays behind its zone ([mirrors])
+
+    // [mix] gains used when spreading stereo over surround layouts
+    float centerGain = 0.7f;
+    float lfeGain = 0.3f;
+    float rearGain = 0.5f;
+    std::string transition = "cut";     // cut | beat: crossfade queued tracks on their downbeats
+    uint32_t transitionBeats = 16;      // Length of a beat crossfade, in beats of the outgoing track
+    float maxStretch = 0.03f;           // Largest tempo change to match beats (0.03 = 3%), 0 = never
+
+    // [library]
+    std::vector<std::string> extensions = { "mp3", "wav", "ogg", "flac", "aac", "wma", "m4a", "aiff", "opus" };
+    size_t historySize = 20;
+    size_t maxQueue = 100000;           // Further q: commands are dropped
+    size_t publishedQueue = 50;         // Queue entries included in status/events
+    std::string indexDir;               // Tags and seek tables (restart), "" = loud-index in the temp directory
+    std::string shuffle = "smart";      // smart | random | weighted: order of folders played or queued
+    uint32_t shuffleSpacing = 5;        // smart: tracks between two by the same artist or from the same album
+    float recentHours = 12;             // weighted: a played track is back to 63% of its chance after this long
+
+    // [cache] decoded copies of heavily played tracks
+    std::string cacheDir;               // (restart) "" = pcm in the index directory
+    uint32_t cacheSizeMb = 8192;        // Disk budget, least recently played go first; 0 = off
+    uint32_t cacheMinPlays = 3;         // Plays (counting this one) before a track is cached
+    bool cacheCompress = true;          // Pack entries losslessly (sys/pcmpack.h) instead of plain float WAV
+
+    // [memory] budget for in-memory caches (sys/memory.h)
+    uint32_t memoryBudgetMb = 0;        // Resident size above which caches are shrunk; 0 = none
+    uint32_t memoryPressurePercent = 10; // Shrink when memory stalls exceed this (Linux PSI avg10); 0 = ignore pressure
+
+    // [zones] (apply on restart) players run by one daemon, each on its own
+    // device with its own queue; commands pick one with "@<id>:" (see
+    // engine/engine.h). No zones = one zone "main" on the default device.
+    // "device @ 3-4" puts a zone on channels 3 and 4 of a multichannel
+    // device; zones routed to the same device share it (Audio::SharedDevice).
+    struct Zone {
+        std::string id;
+        std::string device;             // Part of the output device name, "" = default device
+        uint32_t firstChannel = 0;      // From 0, with channels > 0
+        uint32_t channels = 0;          // 0 = the whole device, opened for this zone alone
+
+        bool operator==(const Zone& other) const {
+            return id == other.id && device == other.device && firstChannel == other.firstChannel && channels == other.channels;
+        }
+        bool operator!=(const Zone& other) const { return !(*this == other); }
+    };
+    std::vector<Zone> zones;
+
+    // [mirrors] (apply on restart) zone id = second device playing the same
+    // program, kept in step by drift-compensating resampling (sys/mirror.h)
+    std::map<std::string, std::string> mirrors;
+
+    // [watchdog] (apply on restart)
+    uint32_t stallMs = 500;
+    uint32_t decoderMs = 200;
+    double traceSeconds = 2.0;
+    bool restartDevice = false;
+
+    // [workers] (apply on restart)
+    uint32_t workerThreads = 0;         // Shared worker pool, 0 = one per core but one
+
+    // [config]
+    uint32_t reloadMs = 1000;           // How often the file is checked for changes
+
+    // Case-insensitive check against the extension list
+    bool isAudioFile(const std::string& path) const {
+        auto pos = path.find_last_of(".");
+        if (pos == std::string::npos) return false;
+
+        std::string ext = path.substr(pos + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return std::find(extensions.begin(), extensions.end(), ext) != extensions.end();
+    }
+};
+
+inline std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+// Whole-string number parsing with range checks; false if out of range or malformed
+template <typename T>
+bool parseNumber(const std::string& text, T& out, double min, double max) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end != text.c_str() + text.size() || !(value >= min && value <= max)) return false;
+    out = static_cast<T>(value);
+    return true;
+}
+
+// Zone ids: 1-32 of a-z, 0-9, '-' and '_' (keys are lowercased)
+inline bool isZoneId(const std::string& text) {
+    if (text.empty() || text.size() > 32) return false;
+    for (unsigned char c : text) {
+        if (!std::islower(c) && !std::isdigit(c) && c != '-' && c != '_') return false;
+    }
+    return true;
+}
+
+// A [zones] value: "device name" or "device name @ first-last" (channels
+// from 1, up to 8 per zone, e.g. "@ 3-4"; "@ 5" is a single channel)
+inline bool parseZone(const std::string& value, Settings::Zone& zone) {
+    size_t at = value.rfind('@');
+    zone.device = value.substr(0, at);
+    while (!zone.device.empty() && std::isspace(static_cast<unsigned char>(zone.device.back()))) zone.device.pop_back();
+    zone.firstChannel = 0;
+    zone.channels = 0;
+    if (at == std::string::npos) return true;
+
+    std::string range = value.substr(at + 1);
+    range.erase(std::remove_if(range.begin(), range.end(), [](unsigned char c) { return std::isspace(c); }), range.end());
+    size_t dash = range.find('-');
+    uint32_t first, last;
+    if (!parseNumber(range.substr(0, dash), first, 1, 64)) return false;
+    if (dash == std::string::npos) last = first;
+    else if (!parseNumber(range.substr(dash + 1), last, first, first + 7)) return false;
+    zone.firstChannel = first - 1;
+    zone.channels = last - first + 1;
+    return true;
+}
+
+// Dotted IPv4 address, e.g. 127.0.0.1
+inline bool isIPv4(const std::string& text) {
+    std::stringstream parts(text);
+    std::string part;
+    int count = 0;
+    while (std::getline(parts, part, '.')) {
+        uint32_t octet;
+        if (part.empty() || part.size() > 3 || !std::all_of(part.begin(), part.end(), [](unsigned char c) { return std::isdigit(c); }) ||
+            !parseNumber(part, octet, 0, 255)) return false;
+        count++;
+    }
+    return count == 4 && text.back() != '.';
+}
+
+inline bool parseBool(const std::string& text, bool& out) {
+    if (text == "1" || text == "true" || text == "yes" || text == "on") { out = true; return true; }
+    if (text == "0" || text == "false" || text == "no" || text == "off") { out = false; return true; }
+    return false;
+}
+
+// Parse INI text on top of `settings`. Unknown keys and bad values are
+// reported in errors (with line numbers) and make the whole parse fail.
+inline bool parse(const std::string& text, Settings& settings, std::vector<std::string>& errors) {
+    using Setter = std::function<bool(Settings&, const std::string&)>;
+    auto number = [](auto member, double min, double max) {
+        return Setter([=](Settings& s, const std::string& v) { return parseNumber(v, s.*member, min, max); });
+    };
+    static const std::map<std::string, Setter> keys = {
+        { "transport.udp_port",      number(&Settings::udpPort, 1, 65535) },
+        { "transport.http_port",     number(&Settings::httpPort, 1, 65535) },
+        { "transport.http_bind",     [](Settings& s, const std::string& v) { s.httpBind = v; return isIPv4(v); } },
+        { "transport.allow_origin",  [](Settings& s, const std::string& v) { s.allowOrigin = v; return true; } },
+        { "audio.sample_rate",       number(&Settings::sampleRate, 8000, 384000) },
+        { "audio.period_ms",         number(&Settings::periodMs, 0, 500) },
+        { "audio.prefetch_ms",       number(&Settings::prefetchMs, 50, 10000) },
+        { "audio.mirror_ms",         number(&Settings::mirrorMs, 10, 500) },
+        { "audio.latency",           [](Settings& s, const std::string& v) {
+                                         s.latency = v;
+                                         return v == "low" || v == "conservative";
+                                     } },
+        { "mix.center_gain",         number(&Settings::centerGain, 0, 2) },
+        { "mix.lfe_gain",            number(&Settings::lfeGain, 0, 2) },
+        { "mix.rear_gain",           number(&Settings::rearGain, 0, 2) },
+        { "mix.transition",          [](Settings& s, const std::string& v) {
+                                         s.transition = v;
+                                         return v == "cut" || v == "beat";
+                                     } },
+        { "mix.transition_beats",    number(&Settings::transitionBeats, 1, 128) },
+        { "mix.max_stretch",         number(&Settings::maxStretch, 0, 0.1) },
+        { "library.extensions",      [](Settings& s, const std::string& v) {
+                                         s.extensions.clear();
+                                         std::stringstream list(v);
+                                         std::string ext;
+                                         while (std::getline(list, ext, ',')) {
+                                             ext = trim(ext);
+                                             if (!ext.empty() && ext[0] == '.') ext.erase(0, 1);
+                                             std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                                             if (!ext.empty()) s.extensions.push_back(ext);
+                                         }
+                                         return !s.extensions.empty();
+                                     } },
+        { "library.history_size",    number(&Settings::historySize, 0, 100000) },
+        { "library.max_queue",       number(&Settings::maxQueue, 1, 10000000) },
+        { "library.published_queue", number(&Settings::publishedQueue, 0, 10000) },
+        { "library.index_dir",       [](Settings& s, const std::string& v) { s.indexDir = v; return true; } },
+        { "library.shuffle",         [](Settings& s, const std::string& v) {
+                                         s.shuffle = v;
+                                         return v == "smart" || v == "random" || v == "weighted";
+                                     } },
+        { "library.shuffle_spacing", number(&Settings::shuffleSpacing, 0, 1000) },
+        { "library.recent_hours",    number(&Settings::recentHours, 0.01, 8760) },
+        { "cache.dir",               [](Settings& s, const std::string& v) { s.cacheDir = v; return true; } },
+        { "cache.size_mb",           number(&Settings::cacheSizeMb, 0, 16 * 1024 * 1024) },
+        { "cache.min_plays",         number(&Settings::cacheMinPlays, 1, 1000000) },
+        { "cache.compress",          [](Settings& s, const std::string& v) { return parseBool(v, s.cacheCompress); } },
+        { "memory.budget_mb",        number(&Settings::memoryBudgetMb, 0, 16 * 1024 * 1024) },
+        { "memory.pressure_percent", number(&Settings::memoryPressurePercent, 0, 100) },
+        { "watchdog.stall_ms",       number(&Settings::stallMs, 50, 60000) },
+        { "watchdog.decoder_ms",     number(&Settings::decoderMs, 10, 60000) },
+        { "watchdog.trace_seconds",  number(&Settings::traceSeconds, 0, 60) },
+        { "watchdog.restart_device", [](Settings& s, const std::string& v) { return parseBool(v, s.restartDevice); } },
+        { "workers.threads",         number(&Settings::workerThreads, 0, 64) },
+        { "config.reload_ms",        number(&Settings::reloadMs, 100, 3600000) },
+    };
+
+    std::stringstream in(text);
+    std::string line, section;
+    int lineNumber = 0;
+    size_t errorsBefore = errors.size();
+
+    while (std::getline(in, line)) {
+        lineNumber++;
+        line = trim(line.substr(0, line.find_first_of(";#"))); // Comments run to the end of the line
+        if (line.empty()) continue;
+
+        if (line.front() == '[') {
+            if (line.back() != ']') {
+                errors.push_back("line " + std::to_string(lineNumber) + ": unterminated section");
+                continue;
+            }
+            section = trim(line.substr(1, line.size() - 2));
+            std::transform(section.begin(), section.end(), section.begin(), ::tolower);
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            errors.push_back("line " + std::to_string(lineNumber) + ": expected key = value");
+            continue;
+        }
+
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        std::string name = section + "." + key;
+
+        // [zones] keys are the zone ids: id = device name [@ channels]
+        if (section == "zones") {
+            bool taken = std::any_of(settings.zones.begin(), settings.zones.end(), [&](const Settings::Zone& z) { return z.id == key; });
+            Settings::Zone zone;
+            zone.id = key;
+            if (!isZoneId(key) || taken) {
+                errors.push_back("line " + std::to_string(lineNumber) + ": invalid or repeated zone id " + key);
+            } else if (!parseZone(value, zone)) {
+                errors.push_back("line " + std::to_string(lineNumber) + ": bad channels for zone " + key + " (device @ first-last)");
+            } else {
+                settings.zones.push_back(zone);
+            }
+            continue;
+        }
+
+        // [mirrors] keys are zone ids too: id = device name
+        if (section == "mirrors") {
+            if (!isZoneId(key) || settings.mirrors.count(key)) {
+                errors.push_back("line " + std::to_string(lineNumber) + ": invalid or repeated zone id " + key);
+            } else {
+                settings.mirrors[key] = value;
+            }
+            continue;
+        }
+
+        auto it = keys.find(name);
+        if (it == keys.end()) {
+            errors.push_back("line " + std::to_string(lineNumber) + ": unknown setting " + name);
+        } else if (!it->second(settings, value)) {
+            errors.push_back("line " + std::to_string(lineNumber) + ": invalid value for " + name + ": " + value);
+        }
+    }
+
+    if (settings.udpPort == settings.httpPort) {
+        errors.push_back("transport.udp_port and transport.http_port must differ");
+    }
+
+    return errors.size() == errorsBefore;
+}
+
+// loud.ini next to the running executable, unless LOUD_CONFIG says otherwise
+inline std::string defaultPath() {
+    if (const char* env = std::getenv("LOUD_CONFIG")) return env;
+#ifdef _WIN32
+    wchar_t module[MAX_PATH];
+    DWORD length = GetModuleFileNameW(NULL, module, MAX_PATH);
+    if (length > 0 && length < MAX_PATH) {
+        return (std::filesystem::path(module).parent_path() / "loud.ini").u8string();
+    }
+#endif
+    return "loud.ini";
+}
+
+class Store {
+public:
+    explicit Store(std::string path) : path(std::move(path)) {
+        versions.push_back(std::make_unique<Settings>());
+        active.store(versions.back().get(), std::memory_order_release);
+        reload();
+    }
+
+    ~Store() {
+        watching = false;
+        if (watcher.joinable()) watcher.join();
+    }
+
+    // Settings in effect; the reference stays valid for the life of the program
+    const Settings& current() const {
+        return *active.load(std::memory_order_acquire);
+    }
+
+    // Re-read the file. Invalid files are reported and leave the current settings alone.
+    bool reload() {
+        std::scoped_lock lock(mutex);
+        namespace fs = std::filesystem;
+
+        std::error_code ec;
+        fs::path file = fs::u8path(path);
+        lastWrite = fs::last_write_time(file, ec);
+        if (ec) return false; // No file: keep the defaults
+
+        std::ifstream in(file, std::ios::binary);
+        std::stringstream text;
+        text << in.rdbuf();
+
+        auto next = std::make_unique<Settings>();
+        std::vector<std::string> errors;
+        if (!parse(text.str(), *next, errors)) {
+            for (const auto& error : errors) std::cerr << "Config: " << path << ": " << error << "\n";
+            std::cerr << "Config: keeping previous settings\n";
+            return false;
+        }
+
+        const Settings& previous = current();
+        if (versions.size() > 1) {
+            if (next->udpPort != previous.udpPort || next->httpPort != previous.httpPort ||
+                next->httpBind != previous.httpBind || next->allowOrigin != previous.allowOrigin ||
+                next->sampleRate != previous.sampleRate || next->periodMs != previous.periodMs ||
+                next->latency != previous.latency || next->prefetchMs != previous.prefetchMs ||
+                next->mirrorMs != previous.mirrorMs || next->mirrors != previous.mirrors ||
+                next->stallMs != previous.stallMs || next->decoderMs != previous.decoderMs ||
+                next->traceSeconds != previous.traceSeconds || next->restartDevice != previous.restartDevice ||
+                next->workerThreads != previous.workerThreads || next->indexDir != previous.indexDir ||
+                next->cacheDir != previous.cacheDir || next->zones != previous.zones) {
+                std::cout << "Config: transport, audio, zone, mirror, watchdog, worker, index and cache directory changes apply after a restart\n";
+            }
+            std::cout << "Config: reloaded " << path << "\n";
+        }
+
+        // Readers holding the old version keep a valid object
+        versions.push_back(std::move(next));
+        active.store(versions.back().get(), std::memory_order_release);
+        return true;
+    }
+
+    // Poll the file's modification time on a background thread and reload on change
+    void watch() {
+        if (watching.exchange(true)) return;
+        watcher = std::thread([this]() {
+            while (watching) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(current().reloadMs));
+                std::error_code ec;
+                auto stamp = std::filesystem::last_write_time(std::filesystem::u8path(path), ec);
+                bool changed;
+                {
+                    std::scoped_lock lock(mutex);
+                    changed = !ec && stamp != lastWrite;
+                }
+                if (changed) reload();
+            }
+        });
+    }
+
+    const std::string& file() const { return path; }
+
+private:
+    std::string path;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Settings>> versions; // Never freed, see current()
+    std::atomic<const Settings*> active{nullptr};
+    std::filesystem::file_time_type lastWrite{};
+    std::atomic<bool> watching{false};
+    std::thread watcher;
+};
+
+inline Store& store() {
+    static Store instance(defaultPath());
+    return instance;
+}
+
+inline const Settings& current() {
+    return store().current();
+}
+
+} // namespace Config
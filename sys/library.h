@@ -0,0 +1,447 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "tags.h"
+#include "beat.h"
+#include "config.h"
+#include "zip.h"
+#include "memory.h"
+
+// What the daemon knows about files it has played: tags and chapters (see
+// sys/tags.h), beat grids (sys/beat.h, filled in by sys/analysis.h), play
+// counts and seek tables for long MP3s. Entries are keyed by path and
+// checked against the file's size and modification time, so an edited file
+// is read again. The index lives in library.index_dir:
+//   tracks.tsv        one line per file, rewritten at most every few seconds
+//   seek/*.bin        one seek table per file version, written once
+namespace Library {
+
+struct TrackInfo {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    Tags::Info tags;
+    bool analysed = false;  // beats is valid (a bpm of 0 still means "analysed, no beat")
+    Beat::Grid beats;
+    uint32_t plays = 0;     // Times started, kept when the file changes
+    int64_t lastPlayed = 0; // Unix seconds, 0 = never
+};
+
+inline int64_t unixSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Where decoding can restart inside an MP3 (mirrors ma_dr_mp3_seek_point)
+struct SeekPoint {
+    uint64_t byteOffset = 0;
+    uint64_t frame = 0;
+    uint16_t mp3FramesToDiscard = 0;
+    uint16_t pcmFramesToDiscard = 0;
+};
+
+// Size and modification time; false if the file can't be stat'ed. An entry
+// of a ZIP archive has its own size and the archive's time.
+inline bool stamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+    if (Zip::isEntryPath(path)) return Zip::stamp(path, size, mtime);
+    std::error_code ec;
+    std::filesystem::path file = std::filesystem::u8path(path);
+    size = std::filesystem::file_size(file, ec);
+    if (ec) return false;
+    auto time = std::filesystem::last_write_time(file, ec);
+    if (ec) return false;
+    mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+// Fields are tab-separated, chapters ';'-separated with ','-separated parts
+inline std::string escapeField(const std::string& text) {
+    std::string out;
+    for (unsigned char c : text) {
+        if (c == '%' || c == '\t' || c == '\n' || c == '\r' || c == ';' || c == ',') {
+            char hex[4];
+            std::snprintf(hex, sizeof(hex), "%%%02X", c);
+            out += hex;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out;
+}
+
+inline std::string unescapeField(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 2 < text.size()) {
+            out += static_cast<char>(std::strtol(text.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        } else {
+            out += text[i];
+        }
+    }
+    return out;
+}
+
+inline std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(separator, start);
+        if (end == std::string::npos) end = text.size();
+        parts.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return parts;
+}
+
+class Index {
+public:
+    explicit Index(std::string directory) : directory(std::filesystem::u8path(directory)) {}
+
+    // library.index_dir, or its default
+    const std::filesystem::path& root() const { return directory; }
+
+    // Tags of a file, read on first use and whenever the file changes.
+    // Null if the file can't be stat'ed.
+    std::shared_ptr<const TrackInfo> lookup(const std::string& path) {
+        uint64_t size;
+        int64_t mtime;
+        if (!stamp(path, size, mtime)) return nullptr;
+
+        {
+            std::scoped_lock lock(mutex);
+            loadOnce();
+            auto it = tracks.find(path);
+            if (it != tracks.end() && it->second->size == size && it->second->mtime == mtime) return it->second;
+        }
+
+        // File I/O outside the lock; two callers racing here just read twice
+        auto info = std::make_shared<TrackInfo>();
+        info->path = path;
+        info->size = size;
+        info->mtime = mtime;
+        Tags::read(path, info->tags);
+
+        std::scoped_lock lock(mutex);
+        auto& entry = tracks[path];
+        if (entry) {
+            info->plays = entry->plays;
+            info->lastPlayed = entry->lastPlayed;
+        }
+        entry = info;
+        dirty = true;
+        return info;
+    }
+
+    // Whatever the index holds for a path, without touching the file: no
+    // stat, no tag read, so it may be stale. Null if the path isn't indexed.
+    std::shared_ptr<const TrackInfo> peek(const std::string& path) {
+        std::scoped_lock lock(mutex);
+        loadOnce();
+        auto it = tracks.find(path);
+        return it != tracks.end() ? it->second : nullptr;
+    }
+
+    // Attach a beat grid computed from the file version (size, mtime). It is
+    // dropped if the file has changed since.
+    void storeAnalysis(const std::string& path, uint64_t size, int64_t mtime, const Beat::Grid& grid) {
+        std::shared_ptr<const TrackInfo> current = lookup(path);
+        if (!current || current->size != size || current->mtime != mtime) return;
+
+        auto info = std::make_shared<TrackInfo>(*current);
+        info->analysed = true;
+        info->beats = grid;
+
+        std::scoped_lock lock(mutex);
+        tracks[path] = info;
+        dirty = true;
+    }
+
+    // One more play of a file, at unix time `when`
+    void recordPlay(const std::string& path, int64_t when) {
+        std::shared_ptr<const TrackInfo> current = lookup(path);
+        if (!current) return;
+
+        auto info = std::make_shared<TrackInfo>(*current);
+        info->plays++;
+        info->lastPlayed = when;
+
+        std::scoped_lock lock(mutex);
+        tracks[path] = info;
+        dirty = true;
+    }
+
+    // Seek table stored for this version of the file, false if there's none yet
+    bool loadSeekTable(const std::string& path, std::vector<SeekPoint>& points) {
+        std::filesystem::path file;
+        if (!seekTableFile(path, file)) return false;
+
+        std::ifstream in(file, std::ios::binary);
+        char magic[4];
+        uint32_t count = 0;
+        if (!in.read(magic, 4) || std::memcmp(magic, SEEK_MAGIC, 4) != 0) return false;
+        if (!in.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > MAX_SEEK_POINTS) return false;
+
+        points.resize(count);
+        for (SeekPoint& point : points) {
+            in.read(reinterpret_cast<char*>(&point.byteOffset), sizeof(point.byteOffset));
+            in.read(reinterpret_cast<char*>(&point.frame), sizeof(point.frame));
+            in.read(reinterpret_cast<char*>(&point.mp3FramesToDiscard), sizeof(point.mp3FramesToDiscard));
+            in.read(reinterpret_cast<char*>(&point.pcmFramesToDiscard), sizeof(point.pcmFramesToDiscard));
+        }
+        return static_cast<bool>(in);
+    }
+
+    // True if the caller should build the seek table: none is stored and
+    // nobody else is building one. Pair with storeSeekTable().
+    bool claimSeekTable(const std::string& path) {
+        std::filesystem::path file;
+        std::error_code ec;
+        if (!seekTableFile(path, file) || std::filesystem::exists(file, ec)) return false;
+        std::scoped_lock lock(mutex);
+        return pendingSeekTables.insert(path).second;
+    }
+
+    // Finish a claim; an empty table just releases it
+    void storeSeekTable(const std::string& path, const std::vector<SeekPoint>& points) {
+        std::filesystem::path file;
+        if (!points.empty() && points.size() <= MAX_SEEK_POINTS && seekTableFile(path, file)) {
+            std::error_code ec;
+            std::filesystem::create_directories(file.parent_path(), ec);
+
+            // Written aside and renamed, so a reader never sees half a table
+            std::filesystem::path temp = file;
+            temp += ".tmp";
+            {
+                std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+                uint32_t count = static_cast<uint32_t>(points.size());
+                out.write(SEEK_MAGIC, 4);
+                out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+                for (const SeekPoint& point : points) {
+                    out.write(reinterpret_cast<const char*>(&point.byteOffset), sizeof(point.byteOffset));
+                    out.write(reinterpret_cast<const char*>(&point.frame), sizeof(point.frame));
+                    out.write(reinterpret_cast<const char*>(&point.mp3FramesToDiscard), sizeof(point.mp3FramesToDiscard));
+                    out.write(reinterpret_cast<const char*>(&point.pcmFramesToDiscard), sizeof(point.pcmFramesToDiscard));
+                }
+            }
+            std::filesystem::rename(temp, file, ec);
+            if (ec) std::cerr << "Library: can't store seek table for " << path << ": " << ec.message() << "\n";
+        }
+
+        {
+            std::scoped_lock lock(mutex);
+            pendingSeekTables.erase(path);
+        }
+        seekTableStored.notify_all();
+    }
+
+    // Wait for a build claimed elsewhere to finish (returns at once if none is running)
+    void awaitSeekTable(const std::string& path) {
+        std::unique_lock lock(mutex);
+        seekTableStored.wait(lock, [&]() { return pendingSeekTables.count(path) == 0; });
+    }
+
+    // Write tracks.tsv if anything changed, at most every SAVE_INTERVAL
+    // unless forced. Called from the engine's housekeeping tick. False if
+    // the file couldn't be written.
+    bool saveIfDirty(bool force = false) {
+        std::string text;
+        {
+            std::scoped_lock lock(mutex);
+            auto now = std::chrono::steady_clock::now();
+            if (!dirty || (!force && now - lastSave < SAVE_INTERVAL)) return true;
+            dirty = false;
+            lastSave = now;
+
+            for (const auto& entry : tracks) {
+                const TrackInfo& info = *entry.second;
+                text += escapeField(info.path) + "\t" + std::to_string(info.size) + "\t" + std::to_string(info.mtime);
+                text += "\t" + escapeField(info.tags.title) + "\t" + escapeField(info.tags.artist) + "\t" + escapeField(info.tags.album) + "\t";
+                for (size_t i = 0; i < info.tags.chapters.size(); i++) {
+                    const Tags::Chapter& chapter = info.tags.chapters[i];
+                    if (i > 0) text += ";";
+                    text += std::to_string(chapter.start) + "," + std::to_string(chapter.end) + "," + escapeField(chapter.title);
+                }
+                if (info.analysed) {
+                    const Beat::Grid& grid = info.beats;
+                    text += "\t" + std::to_string(grid.bpm) + "\t" + std::to_string(grid.firstBeat) + "\t" + std::to_string(grid.firstDownbeat);
+                    text += "\t" + std::to_string(grid.confidence) + "\t" + std::to_string(grid.duration);
+                } else {
+                    text += "\t\t\t\t\t";
+                }
+                text += "\t" + (info.tags.rating >= 0 ? std::to_string(info.tags.rating) : std::string());
+                text += "\t" + std::to_string(info.plays) + "\t" + std::to_string(info.lastPlayed);
+                text += "\n";
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        std::filesystem::path file = directory / "tracks.tsv";
+        std::filesystem::path temp = directory / "tracks.tsv.tmp";
+        bool written;
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            out << text;
+            out.close();
+            written = static_cast<bool>(out);
+        }
+        if (written) std::filesystem::rename(temp, file, ec);
+        if (!written || ec) {
+            std::cerr << "Library: can't save " << file.u8string() << (ec ? ": " + ec.message() : "") << "\n";
+            std::scoped_lock lock(mutex);
+            dirty = true; // Try again on a later tick
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() {
+        std::scoped_lock lock(mutex);
+        loadOnce();
+        return tracks.size();
+    }
+
+    // Approximate memory the loaded index takes (the map and what it owns)
+    size_t bytes() {
+        std::scoped_lock lock(mutex);
+        size_t total = 0;
+        for (const auto& entry : tracks) {
+            const TrackInfo& info = *entry.second;
+            total += MAP_NODE_BYTES + sizeof(TrackInfo) + entry.first.capacity() + info.path.capacity();
+            total += info.tags.title.capacity() + info.tags.artist.capacity() + info.tags.album.capacity();
+            for (const auto& chapter : info.tags.chapters) total += sizeof(chapter) + chapter.title.capacity();
+        }
+        return total;
+    }
+
+    // Save and forget the loaded tracks, to be read back from tracks.tsv on
+    // next use (the memory governor's last resort). Returns the bytes
+    // released: 0 if the save failed or changes came in during it.
+    size_t unload() {
+        size_t held = bytes();
+        if (held == 0 || !saveIfDirty(true)) return 0;
+        std::scoped_lock lock(mutex);
+        if (dirty) return 0;
+        tracks.clear();
+        loaded = false;
+        return held;
+    }
+
+private:
+    static constexpr const char* SEEK_MAGIC = "LSK1";
+    static constexpr uint32_t MAX_SEEK_POINTS = 1 << 20;
+    static constexpr std::chrono::seconds SAVE_INTERVAL{5};
+    static constexpr size_t MAP_NODE_BYTES = 64; // std::map node and shared_ptr control block
+
+    std::filesystem::path directory;
+    std::mutex mutex;
+    bool loaded = false;
+    bool dirty = false;
+    std::chrono::steady_clock::time_point lastSave{};
+    std::map<std::string, std::shared_ptr<const TrackInfo>> tracks;
+    std::set<std::string> pendingSeekTables;
+    std::condition_variable seekTableStored;
+
+    // Seek tables are named after the path and the file version, so an
+    // edited file never picks up a table for its old contents
+    bool seekTableFile(const std::string& path, std::filesystem::path& file) const {
+        uint64_t size;
+        int64_t mtime;
+        if (!stamp(path, size, mtime)) return false;
+
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        for (unsigned char c : path) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        char name[80];
+        std::snprintf(name, sizeof(name), "%016llx-%llx-%llx.bin", static_cast<unsigned long long>(hash),
+                      static_cast<unsigned long long>(size), static_cast<unsigned long long>(mtime));
+        file = directory / "seek" / name;
+        return true;
+    }
+
+    // Read tracks.tsv the first time the index is used (mutex held). Lines
+    // from before beat analysis have the first 7 fields only, lines from
+    // before ratings and play counts the first 12.
+    void loadOnce() {
+        if (loaded) return;
+        loaded = true;
+
+        std::ifstream in(directory / "tracks.tsv", std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields = split(line, '\t');
+            if (fields.size() != 7 && fields.size() != 12 && fields.size() != 15) continue;
+
+            auto info = std::make_shared<TrackInfo>();
+            info->path = unescapeField(fields[0]);
+            info->size = std::strtoull(fields[1].c_str(), nullptr, 10);
+            info->mtime = std::strtoll(fields[2].c_str(), nullptr, 10);
+            info->tags.title = unescapeField(fields[3]);
+            info->tags.artist = unescapeField(fields[4]);
+            info->tags.album = unescapeField(fields[5]);
+            if (!fields[6].empty()) {
+                for (const auto& item : split(fields[6], ';')) {
+                    std::vector<std::string> parts = split(item, ',');
+                    if (parts.size() != 3) continue;
+                    Tags::Chapter chapter;
+                    chapter.start = std::strtod(parts[0].c_str(), nullptr);
+                    chapter.end = std::strtod(parts[1].c_str(), nullptr);
+                    chapter.title = unescapeField(parts[2]);
+                    info->tags.chapters.push_back(chapter);
+                }
+            }
+            if (fields.size() >= 12 && !fields[7].empty()) {
+                info->analysed = true;
+                info->beats.bpm = std::strtod(fields[7].c_str(), nullptr);
+                info->beats.firstBeat = std::strtod(fields[8].c_str(), nullptr);
+                info->beats.firstDownbeat = std::strtod(fields[9].c_str(), nullptr);
+                info->beats.confidence = std::strtof(fields[10].c_str(), nullptr);
+                info->beats.duration = std::strtod(fields[11].c_str(), nullptr);
+            }
+            if (fields.size() == 15) {
+                if (!fields[12].empty()) info->tags.rating = std::strtof(fields[12].c_str(), nullptr);
+                info->plays = static_cast<uint32_t>(std::strtoul(fields[13].c_str(), nullptr, 10));
+                info->lastPlayed = std::strtoll(fields[14].c_str(), nullptr, 10);
+            }
+            tracks[info->path] = info;
+        }
+    }
+};
+
+// library.index_dir from loud.ini (read once), or loud-index in the temp directory
+inline Index& index() {
+    // Never destroyed: background jobs on the worker pool may still be
+    // storing seek tables while static destructors run
+    static Index* instance = []() {
+        std::string directory = Config::current().indexDir;
+        if (directory.empty()) {
+            std::error_code ec;
+            directory = (std::filesystem::temp_directory_path(ec) / "loud-index").u8string();
+        }
+        Index* created = new Index(directory);
+        Memory::governor().add("index", Memory::PRIORITY_INDEX,
+                               [created]() { return created->bytes(); },
+                               [created](size_t) { return created->unload(); });
+        return created;
+    }();
+    return *instance;
+}
+
+} // namespace Library
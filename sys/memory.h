@@ -0,0 +1,221 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#ifdef _WIN32
+#include <windows.h> // For CreateMemoryResourceNotification
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>  // For malloc_trim
+#endif
+#include "metrics.h"
+#include "config.h"
+
+// One memory budget for the whole daemon. Subsystems that keep rebuildable
+// data in memory (archive directories, the library index, ...) register it
+// here with a priority, a way to measure it and a way to drop some of it.
+// About once a second the governor compares the resident size with
+// memory.budget_mb and, when over it, asks caches to shrink, lowest priority
+// first, until the excess is covered. Memory pressure from the system
+// counts too: past memory.pressure_percent of stalled time (Linux PSI, from
+// the daemon's cgroup when it has one) or on Windows' low memory signal, a
+// quarter of what the caches hold is dropped on each check, whatever the
+// budget says.
+//
+// Usage per cache is in /status ("memory") and /metrics.
+namespace Memory {
+
+// Lower priorities are shrunk first. Cheap to rebuild = low.
+constexpr int PRIORITY_ARCHIVES = 10;  // ZIP central directories (sys/zip.h)
+constexpr int PRIORITY_INDEX = 90;     // Library index, reloaded from tracks.tsv
+
+class Governor {
+public:
+    // Approximate bytes the cache holds
+    using Usage = std::function<size_t()>;
+    // Drop about `bytes` (more is fine), return how many were dropped.
+    // Runs on the thread calling poll(); must not call back into the governor.
+    using Shrink = std::function<size_t(size_t bytes)>;
+
+    static constexpr std::chrono::milliseconds CHECK_INTERVAL{1000};
+    static constexpr std::chrono::milliseconds MAX_CHECK_INTERVAL{60000}; // Backoff while shrinking doesn't get under the budget
+    static constexpr double PRESSURE_SHED_FRACTION = 0.25;
+
+    Governor() {
+        #ifdef _WIN32
+        lowMemory = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+        #else
+        pressureFile = findPressureFile();
+        #endif
+        Metrics::gauge("loud_memory_budget_bytes", "Resident memory budget (memory.budget_mb), 0 = none",
+                       []() { return double(Config::current().memoryBudgetMb) * 1024 * 1024; });
+    }
+
+    // Register a cache under a unique name (shown in status and metrics)
+    void add(const std::string& name, int priority, Usage usage, Shrink shrink) {
+        std::scoped_lock lock(mutex);
+        caches.erase(std::remove_if(caches.begin(), caches.end(), [&](const Cache& c) { return c.name == name; }), caches.end());
+        caches.push_back(Cache{ name, priority, usage, shrink });
+        std::stable_sort(caches.begin(), caches.end(), [](const Cache& a, const Cache& b) { return a.priority < b.priority; });
+        Metrics::gauge("loud_memory_cache_bytes", "Approximate memory held by each registered cache", usage, "cache=\"" + name + "\"");
+    }
+
+    // For caches that go away before the process does
+    void remove(const std::string& name) {
+        std::scoped_lock lock(mutex);
+        caches.erase(std::remove_if(caches.begin(), caches.end(), [&](const Cache& c) { return c.name == name; }), caches.end());
+        Metrics::registry().removeGauge("loud_memory_cache_bytes", "cache=\"" + name + "\"");
+    }
+
+    // Housekeeping, from the host's main loop; only checks every
+    // CHECK_INTERVAL, less often while each check has to shrink again (a
+    // budget below what the daemon needs shouldn't have the index reloaded
+    // every second). Returns the bytes dropped.
+    size_t poll() {
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::scoped_lock lock(mutex);
+            if (now - lastCheck < interval) return 0;
+            lastCheck = now;
+        }
+
+        const Config::Settings& settings = Config::current();
+        double resident = Metrics::residentMemoryBytes();
+        double budget = double(settings.memoryBudgetMb) * 1024 * 1024;
+        bool pressure = underPressure(settings.memoryPressurePercent);
+
+        size_t excess = budget > 0 && resident > budget ? static_cast<size_t>(resident - budget) : 0;
+        if (pressure) excess = std::max(excess, static_cast<size_t>(double(tracked()) * PRESSURE_SHED_FRACTION));
+
+        std::string from;
+        size_t freed = excess > 0 ? shrink(excess, from) : 0;
+        {
+            std::scoped_lock lock(mutex);
+            interval = excess > 0 ? std::min(interval * 2, MAX_CHECK_INTERVAL) : CHECK_INTERVAL;
+        }
+        if (freed > 0) {
+            static auto& shrunk = Metrics::counter("loud_memory_shrinks_total", "Times the memory governor made caches drop data");
+            static auto& dropped = Metrics::counter("loud_memory_dropped_bytes_total", "Bytes the memory governor made caches drop");
+            shrunk.add();
+            dropped.add(freed);
+            #if defined(__GLIBC__)
+            malloc_trim(0); // Hand the freed pages back, or the resident size won't show it
+            #endif
+            std::cout << "Memory: dropped " << (freed + 1023) / 1024 << " KB (" << from << ")"
+                      << (pressure ? ", system under memory pressure" : "")
+                      << (budget > 0 && resident > budget ? ", " + std::to_string(static_cast<uint64_t>(resident / 1048576)) + " MB resident" : "")
+                      << "\n";
+        }
+        return freed;
+    }
+
+    // Shrink caches, lowest priority first, until `bytes` are dropped.
+    // `from` lists the caches that gave something up.
+    size_t shrink(size_t bytes, std::string& from) {
+        std::scoped_lock lock(mutex);
+        size_t freed = 0;
+        for (Cache& cache : caches) {
+            if (freed >= bytes) break;
+            size_t got = cache.shrink(bytes - freed);
+            if (got == 0) continue;
+            freed += got;
+            if (!from.empty()) from += ", ";
+            from += cache.name;
+        }
+        return freed;
+    }
+
+    // Bytes held by all registered caches
+    size_t tracked() {
+        std::scoped_lock lock(mutex);
+        size_t total = 0;
+        for (const Cache& cache : caches) total += cache.usage();
+        return total;
+    }
+
+    // {"resident":..,"budget":..,"caches":[{"name":..,"priority":..,"bytes":..}]}
+    // for /status
+    std::string json() {
+        std::string out = "{\"resident\":" + std::to_string(static_cast<uint64_t>(Metrics::residentMemoryBytes()));
+        out += ",\"budget\":" + std::to_string(uint64_t(Config::current().memoryBudgetMb) * 1024 * 1024);
+        out += ",\"caches\":[";
+        std::scoped_lock lock(mutex);
+        for (size_t i = 0; i < caches.size(); i++) {
+            if (i > 0) out += ",";
+            out += "{\"name\":\"" + caches[i].name + "\",\"priority\":" + std::to_string(caches[i].priority);
+            out += ",\"bytes\":" + std::to_string(caches[i].usage()) + "}";
+        }
+        out += "]}";
+        return out;
+    }
+
+private:
+    struct Cache {
+        std::string name;
+        int priority;
+        Usage usage;
+        Shrink shrink;
+    };
+
+    std::mutex mutex;
+    std::vector<Cache> caches;  // By priority
+    std::chrono::steady_clock::time_point lastCheck{};
+    std::chrono::milliseconds interval = CHECK_INTERVAL;
+
+    #ifdef _WIN32
+    HANDLE lowMemory = NULL;
+    #else
+    std::string pressureFile;
+
+    // memory.pressure of the cgroup v2 the process runs in, else the
+    // system-wide PSI file; "" if the kernel has neither
+    static std::string findPressureFile() {
+        std::ifstream cgroups("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(cgroups, line)) {
+            if (line.rfind("0::", 0) != 0) continue;
+            std::string file = "/sys/fs/cgroup" + line.substr(3) + "/memory.pressure";
+            if (std::ifstream(file)) return file;
+        }
+        return std::ifstream("/proc/pressure/memory") ? "/proc/pressure/memory" : "";
+    }
+    #endif
+
+    // The system (or our cgroup) is short of memory
+    bool underPressure(uint32_t percent) {
+        if (percent == 0) return false;
+        #ifdef _WIN32
+        (void)percent; // Windows only says low or not
+        BOOL low = FALSE;
+        return lowMemory && QueryMemoryResourceNotification(lowMemory, &low) && low;
+        #else
+        // "some avg10=1.23 avg60=... total=...": share of the last 10 s in
+        // which some task waited on memory
+        if (pressureFile.empty()) return false;
+        std::ifstream in(pressureFile);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.rfind("some ", 0) != 0) continue;
+            size_t at = line.find("avg10=");
+            return at != std::string::npos && std::strtod(line.c_str() + at + 6, nullptr) >= percent;
+        }
+        return false;
+        #endif
+    }
+};
+
+// Never destroyed: caches register from static singletons of their own
+inline Governor& governor() {
+    static Governor* instance = new Governor();
+    return *instance;
+}
+
+} // namespace Memory
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h> // For resident memory (K32GetProcessMemoryInfo)
+#else
+#include <unistd.h>
+#endif
+
+// Prometheus-style counters, gauges and histograms.
+// Every metric is split into per-thread shards on separate cache lines, so
+// hot paths (audio callback, decoder, receivers) only ever touch their own
+// shard with a relaxed atomic add and never contend with each other or with
+// the scraper, which sums the shards when rendering.
+namespace Metrics {
+
+constexpr size_t SHARDS = 16;
+constexpr size_t MAX_BUCKETS = 16;
+
+// Shard used by the calling thread
+inline size_t shardIndex() {
+    static std::atomic<size_t> nextShard{0};
+    thread_local size_t index = nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return index;
+}
+
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        cells[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& cell : cells) total += cell.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> value{0};
+    };
+    Cell cells[SHARDS];
+};
+
+// Distribution of durations (or any non-negative value) in fixed buckets
+class Histogram {
+public:
+    explicit Histogram(std::vector<double> upperBounds) : bounds(upperBounds) {
+        if (bounds.size() > MAX_BUCKETS) bounds.resize(MAX_BUCKETS);
+    }
+
+    void observe(double value) {
+        size_t bucket = 0;
+        while (bucket < bounds.size() && value > bounds[bucket]) bucket++;
+
+        Shard& shard = shards[shardIndex()];
+        shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.sumNanos.fetch_add(static_cast<uint64_t>(value * 1e9), std::memory_order_relaxed);
+    }
+
+    const std::vector<double>& upperBounds() const { return bounds; }
+
+    // Per-bucket counts (last entry is +Inf), not cumulative
+    std::vector<uint64_t> counts() const {
+        std::vector<uint64_t> result(bounds.size() + 1, 0);
+        for (const auto& shard : shards) {
+            for (size_t i = 0; i < result.size(); ++i) result[i] += shard.counts[i].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    double sum() const {
+        uint64_t nanos = 0;
+        for (const auto& shard : shards) nanos += shard.sumNanos.load(std::memory_order_relaxed);
+        return nanos / 1e9;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counts[MAX_BUCKETS + 1] = {};
+        std::atomic<uint64_t> sumNanos{0};
+    };
+
+    std::vector<double> bounds;
+    Shard shards[SHARDS];
+};
+
+// Observes the lifetime of the scope into a histogram, in seconds
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        histogram.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    Histogram& histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Default buckets for things measured in seconds, from 10 us to 10 s
+inline std::vector<double> durationBuckets() {
+    return { 0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 10.0 };
+}
+
+// Resident set size of this process in bytes
+inline double residentMemoryBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<double>(counters.WorkingSetSize);
+    }
+    return 0;
+#else
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    if (statm >> pages >> resident) return static_cast<double>(resident) * sysconf(_SC_PAGESIZE);
+    return 0;
+#endif
+}
+
+// All metrics of the process. Registration takes a lock; the returned
+// references stay valid for the life of the program, so hot paths look a
+// metric up once (e.g. into a function-local static) and then only add.
+class Registry {
+public:
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+        std::scoped_lock lock(mutex);
+        Family& family = getFamily(name, help, "counter");
+        auto& slot = family.counters[labels];
+        if (!slot) slot = std::make_unique<Counter>();
+        return *slot;
+    }
+
+    Histogram& histogram(const std::string& name, const std::string& help,
+                         std::vector<double> upperBounds = durationBuckets(), const std::string& labels = "") {
+        std::scoped_lock lock(mutex);
+        Family& family = getFamily(name, help, "histogram");
+        auto& slot = family.histograms[labels];
+        if (!slot) slot = std::make_unique<Histogram>(upperBounds);
+        return *slot;
+    }
+
+    // Gauges are sampled at scrape time
+    void gauge(const std::string& name, const std::string& help, std::function<double()> read, const std::string& labels = "") {
+        std::scoped_lock lock(mutex);
+        Family& family = getFamily(name, help, "gauge");
+        family.gauges[labels] = read;
+    }
+
+    // For gauges whose data source goes away before the process does
+    void removeGauge(const std::string& name, const std::string& labels = "") {
+        std::scoped_lock lock(mutex);
+        auto it = families.find(name);
+        if (it != families.end()) it->second.gauges.erase(labels);
+    }
+
+    // Text exposition format
+    std::string render() {
+        std::scoped_lock lock(mutex);
+        std::string out;
+        char number[64];
+
+        for (const auto& name : order) {
+            const Family& family = families[name];
+            out += "# HELP " + name + " " + family.help + "\n";
+            out += "# TYPE " + name + " " + family.type + "\n";
+
+            for (const auto& [labels, counter] : family.counters) {
+                out += name + wrap(labels) + " " + std::to_string(counter->value()) + "\n";
+            }
+
+            for (const auto& [labels, read] : family.gauges) {
+                std::snprintf(number, sizeof(number), "%.17g", read());
+                out += name + wrap(labels) + " " + number + "\n";
+            }
+
+            for (const auto& [labels, histogram] : family.histograms) {
+                std::vector<uint64_t> counts = histogram->counts();
+                const auto& bounds = histogram->upperBounds();
+                std::string prefix = labels.empty() ? "" : labels + ",";
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < counts.size(); ++i) {
+                    cumulative += counts[i];
+                    if (i < bounds.size()) std::snprintf(number, sizeof(number), "%g", bounds[i]);
+                    else std::snprintf(number, sizeof(number), "+Inf");
+                    out += name + "_bucket{" + prefix + "le=\"" + number + "\"} " + std::to_string(cumulative) + "\n";
+                }
+                std::snprintf(number, sizeof(number), "%.9g", histogram->sum());
+                out += name + "_sum" + wrap(labels) + " " + number + "\n";
+                out += name + "_count" + wrap(labels) + " " + std::to_string(cumulative) + "\n";
+            }
+        }
+
+        return out;
+    }
+
+private:
+    struct Family {
+        std::string help;
+        std::string type;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+        std::map<std::string, std::function<double()>> gauges;
+    };
+
+    Family& getFamily(const std::string& name, const std::string& help, const char* type) {
+        auto it = families.find(name);
+        if (it == families.end()) {
+            order.push_back(name);
+            it = families.emplace(name, Family{help, type, {}, {}, {}}).first;
+        }
+        return it->second;
+    }
+
+    static std::string wrap(const std::string& labels) {
+        return labels.empty() ? std::string() : "{" + labels + "}";
+    }
+
+    std::mutex mutex;
+    std::map<std::string, Family> families;
+    std::vector<std::string> order;
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+inline Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+    return registry().counter(name, help, labels);
+}
+
+inline Histogram& histogram(const std::string& name, const std::string& help,
+                            std::vector<double> upperBounds = durationBuckets(), const std::string& labels = "") {
+    return registry().histogram(name, help, upperBounds, labels);
+}
+
+inline void gauge(const std::string& name, const std::string& help, std::function<double()> read, const std::string& labels = "") {
+    registry().gauge(name, help, read, labels);
+}
+
+} // namespace Metrics
@@ -0,0 +1,92 @@
+// miniaudio's implementation, compiled once and on its own so that changes
+// to the daemon don't rebuild ~90k lines of C. player.bat always builds this
+// file with -O2, whatever the optimization level of the rest.
+#include "miniaudio_config.h"
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
+
+#include "mp3seek.h"
+
+ma_bool32 loud_mp3_is_mp3(const ma_decoder* decoder)
+{
+    return decoder != NULL && decoder->pBackendVTable == &g_ma_decoding_backend_vtable_mp3;
+}
+
+static ma_uint32 loud_mp3_collect_seek_points(ma_dr_mp3* mp3, loud_mp3_seek_point* points, ma_uint32 capacity)
+{
+    ma_dr_mp3_seek_point* found;
+    ma_uint32 count = capacity;
+    ma_uint32 i;
+
+    found = (ma_dr_mp3_seek_point*)ma_malloc(sizeof(*found) * capacity, NULL);
+    if (found == NULL || !ma_dr_mp3_calculate_seek_points(mp3, &count, found)) {
+        count = 0;
+    }
+    for (i = 0; i < count; i++) {
+        points[i].byteOffset         = found[i].seekPosInBytes;
+        points[i].frame              = found[i].pcmFrameIndex;
+        points[i].mp3FramesToDiscard = found[i].mp3FramesToDiscard;
+        points[i].pcmFramesToDiscard = found[i].pcmFramesToDiscard;
+    }
+
+    ma_free(found, NULL);
+    return count;
+}
+
+ma_uint32 loud_mp3_build_seek_table(const char* path, const wchar_t* widePath, loud_mp3_seek_point* points, ma_uint32 capacity)
+{
+    ma_dr_mp3 mp3;
+    ma_uint32 count;
+
+    if (points == NULL || capacity == 0) {
+        return 0;
+    }
+    if (!(widePath != NULL ? ma_dr_mp3_init_file_w(&mp3, widePath, NULL) : ma_dr_mp3_init_file(&mp3, path, NULL))) {
+        return 0;
+    }
+
+    count = loud_mp3_collect_seek_points(&mp3, points, capacity);
+    ma_dr_mp3_uninit(&mp3);
+    return count;
+}
+
+ma_uint32 loud_mp3_scan_seek_table(ma_decoder* decoder, loud_mp3_seek_point* points, ma_uint32 capacity)
+{
+    if (!loud_mp3_is_mp3(decoder) || points == NULL || capacity == 0) {
+        return 0;
+    }
+    return loud_mp3_collect_seek_points(&((ma_mp3*)decoder->pBackend)->dr, points, capacity);
+}
+
+ma_bool32 loud_mp3_bind_seek_table(ma_decoder* decoder, const loud_mp3_seek_point* points, ma_uint32 count)
+{
+    ma_mp3* backend;
+    ma_dr_mp3_seek_point* table;
+    ma_uint32 i;
+
+    if (!loud_mp3_is_mp3(decoder) || points == NULL || count == 0) {
+        return MA_FALSE;
+    }
+
+    /* Stored where ma_mp3 keeps a table it generated itself, so ma_mp3_uninit frees it */
+    table = (ma_dr_mp3_seek_point*)ma_malloc(sizeof(*table) * count, &decoder->allocationCallbacks);
+    if (table == NULL) {
+        return MA_FALSE;
+    }
+    for (i = 0; i < count; i++) {
+        table[i].seekPosInBytes     = points[i].byteOffset;
+        table[i].pcmFrameIndex      = points[i].frame;
+        table[i].mp3FramesToDiscard = points[i].mp3FramesToDiscard;
+        table[i].pcmFramesToDiscard = points[i].pcmFramesToDiscard;
+    }
+
+    backend = (ma_mp3*)decoder->pBackend;
+    if (!ma_dr_mp3_bind_seek_table(&backend->dr, count, table)) {
+        ma_free(table, &decoder->allocationCallbacks);
+        return MA_FALSE;
+    }
+    ma_free(backend->pSeekPoints, &decoder->allocationCallbacks);
+    backend->pSeekPoints = table;
+    backend->seekPointCount = count;
+    return MA_TRUE;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// miniaudio build options. Included before every "miniaudio.h" include, by
+// sys/miniaudio.c (the only place the implementation is compiled) and by the
+// headers that use the API, so declarations and implementation always agree.
+
+// Output backends: WASAPI with the usual Windows fallbacks, the null device
+// for --offline runs, and the common desktop backends elsewhere
+#define MA_ENABLE_ONLY_SPECIFIC_BACKENDS
+#define MA_ENABLE_WASAPI
+#define MA_ENABLE_DSOUND
+#define MA_ENABLE_WINMM
+#define MA_ENABLE_ALSA
+#define MA_ENABLE_PULSEAUDIO
+#define MA_ENABLE_COREAUDIO
+#define MA_ENABLE_NULL
+
+// Only playback and decoding (WAV, FLAC, MP3) are used
+#define MA_NO_ENCODING
+#define MA_NO_GENERATION
+#define MA_NO_ENGINE
+#define MA_NO_NODE_GRAPH
+#define MA_NO_RESOURCE_MANAGER
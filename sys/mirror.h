@@ -0,0 +1,251 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <iostream>
+
+#include "miniaudio_config.h"
+#include "miniaudio.h"
+#include "ring.h"
+#include "metrics.h"
+#include "trace.h"
+
+namespace Audio {
+
+// Clock drift between two devices that nominally run at the same rate, as a
+// PI controller on how full the ring between them is. The output side calls
+// update() once per period with the fill it measured; the result is how many
+// input frames to consume per output frame. With the fill kept at the
+// target, the integral term ends up as the drift itself (in parts per one).
+//
+// No device or clock in here, so it can be driven by simulated clocks.
+class DriftControl {
+public:
+    DriftControl(double sampleRate, double targetFrames) : sampleRate(sampleRate), target(targetFrames) {}
+
+    // fillFrames: ring fill at the start of an output period; frames: its length
+    double update(double fillFrames, double frames) {
+        double seconds = frames / sampleRate;
+        if (!started) {
+            smoothed = fillFrames;
+            started = true;
+        } else {
+            // The fill jitters with both periods; the loop only needs its trend
+            smoothed += (fillFrames - smoothed) * (1.0 - std::exp(-seconds / SMOOTHING_SECONDS));
+        }
+
+        // Error in seconds of audio: the ring gains error/second at drift - correction
+        double error = (smoothed - target) / sampleRate;
+        integral = std::clamp(integral + KI * error * seconds, -MAX_CORRECTION, MAX_CORRECTION);
+        correction = std::clamp(KP * error + integral, -MAX_CORRECTION, MAX_CORRECTION);
+        return 1.0 + correction;
+    }
+
+    // After an underrun or a resync the fill starts over; the drift estimate stays
+    void restart() {
+        started = false;
+    }
+
+    double ratio() const { return 1.0 + correction; }
+    double driftPpm() const { return integral * 1e6; }
+    double fill() const { return smoothed; }
+    double targetFrames() const { return target; }
+
+    // Critically damped, settling in about half a minute: fast enough to
+    // follow a warming crystal, slow enough that the pitch never wobbles
+    static constexpr double KP = 0.2;               // Per second
+    static constexpr double KI = 0.01;              // Per second squared
+    static constexpr double SMOOTHING_SECONDS = 0.5;
+    static constexpr double MAX_CORRECTION = 0.005; // 5000 ppm; real crystals are within ~100
+
+private:
+    double sampleRate;
+    double target;
+    double smoothed = 0;
+    double integral = 0;
+    double correction = 0;
+    bool started = false;
+};
+
+// A second output device playing the same program as a player, e.g. the
+// main speakers plus a USB transmitter. The player's audio callback pushes
+// each period into a ring (push); this device's callback takes it out
+// through a resampler whose ratio DriftControl keeps adjusting, so the ring
+// stays at the target fill however far the two clocks drift apart: no
+// growing delay, and no dropped or repeated blocks.
+class Mirror {
+public:
+    // Open the device (the default one if id is null) in `context` at the
+    // player's rate and channel count; miniaudio converts to its native format
+    Mirror(ma_context* context, const ma_device_id* id, ma_uint32 sampleRate, ma_uint32 channels, ma_uint32 targetMs)
+        : channels(channels),
+          ring(size_t(sampleRate) * RING_MS / 1000, channels),
+          drift(sampleRate, double(sampleRate) * targetMs / 1000),
+          history(HISTORY_FRAMES * channels, 0.0f),
+          input(INPUT_CHUNK_FRAMES * channels) {
+        ma_device_config config = ma_device_config_init(ma_device_type_playback);
+        config.playback.format = ma_format_f32;
+        config.playback.channels = channels;
+        config.playback.pDeviceID = id;
+        config.sampleRate = sampleRate;
+        config.dataCallback = dataCallback;
+        config.pUserData = this;
+
+        if (ma_device_init(context, &config, &device) != MA_SUCCESS) {
+            throw std::runtime_error("Failed to initialize mirror device");
+        }
+        if (ma_device_start(&device) != MA_SUCCESS) {
+            ma_device_uninit(&device);
+            throw std::runtime_error("Failed to start mirror device");
+        }
+        std::cout << "Mirroring to " << device.playback.name << " (" << targetMs << " ms behind)\n";
+    }
+
+    ~Mirror() {
+        ma_device_uninit(&device);
+    }
+
+    Mirror(const Mirror&) = delete;
+    Mirror& operator=(const Mirror&) = delete;
+
+    // Player's audio thread: one period of its output, in its layout
+    void push(const float* frames, ma_uint32 count) {
+        size_t written = ring.write(frames, count);
+        if (written < count) overflows.add();
+        lastPushFrames.store(static_cast<ma_uint32>(written), std::memory_order_relaxed);
+        lastPushNanos.store(Trace::nanoseconds(), std::memory_order_release);
+    }
+
+    // Current estimate, for metrics and logs
+    double driftPpm() const { return driftEstimate.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr ma_uint32 RING_MS = 1000;
+    static constexpr ma_uint32 HISTORY_FRAMES = 4;      // Cubic interpolation points
+    static constexpr size_t INPUT_CHUNK_FRAMES = 256;
+    static constexpr double RESYNC_FACTOR = 4.0;        // Fill beyond this times the target is skipped
+
+    ma_uint32 channels;
+    ma_device device;
+    FrameRing ring;
+    DriftControl drift;
+
+    std::atomic<ma_uint32> lastPushFrames{0};
+    std::atomic<uint64_t> lastPushNanos{0};
+    std::atomic<double> driftEstimate{0.0};
+
+    // Mirror audio thread only
+    bool primed = false;
+    double phase = 0;                   // Between history frames 1 and 2
+    std::vector<float> history;         // Last four input frames, oldest first
+    std::vector<float> input;           // Read from the ring, not yet interpolated
+    size_t inputFrames = 0;
+    size_t inputUsed = 0;
+
+    Metrics::Counter& underruns = Metrics::counter("loud_mirror_underruns_total", "Mirror device periods that found its ring short of audio");
+    Metrics::Counter& overflows = Metrics::counter("loud_mirror_overflows_total", "Player periods that didn't fit in a mirror ring");
+    Metrics::Counter& resyncs = Metrics::counter("loud_mirror_resyncs_total", "Times a mirror skipped ahead after falling far behind");
+
+    // Frames in the ring as if the player wrote continuously instead of a
+    // period at a time: without this the fill would saw-tooth by a whole
+    // player period, sampled at the mirror's own period, and beat slowly
+    double smoothFill() const {
+        double fill = double(ring.readable()) + double(inputFrames - inputUsed);
+        uint64_t pushedAt = lastPushNanos.load(std::memory_order_acquire);
+        double ahead = lastPushFrames.load(std::memory_order_relaxed);
+        if (pushedAt) {
+            double elapsed = double(Trace::nanoseconds() - pushedAt) * 1e-9 * device.sampleRate;
+            fill -= std::max(0.0, ahead - elapsed);
+        }
+        return fill;
+    }
+
+    // Next input frame into the history; false when the ring ran dry
+    bool advance() {
+        if (inputUsed == inputFrames) {
+            bool flushed = false;
+            inputFrames = ring.read(input.data(), INPUT_CHUNK_FRAMES, flushed);
+            inputUsed = 0;
+            if (inputFrames == 0) return false;
+        }
+        std::memmove(history.data(), history.data() + channels, (HISTORY_FRAMES - 1) * channels * sizeof(float));
+        std::memcpy(history.data() + (HISTORY_FRAMES - 1) * channels, input.data() + inputUsed * channels, channels * sizeof(float));
+        inputUsed++;
+        return true;
+    }
+
+    void render(float* out, ma_uint32 frames) {
+        double fill = smoothFill();
+        double target = drift.targetFrames();
+
+        if (!primed) {
+            if (fill < target) {
+                std::memset(out, 0, size_t(frames) * channels * sizeof(float));
+                return;
+            }
+            primed = true;
+            drift.restart();
+        } else if (fill > target * RESYNC_FACTOR) {
+            // The mirror was stalled (or the player burst ahead); drop back to the target
+            std::vector<float>& skip = input;
+            size_t excess = static_cast<size_t>(fill - target);
+            inputUsed = inputFrames;
+            bool flushed = false;
+            while (excess > 0) {
+                size_t count = ring.read(skip.data(), std::min(excess, INPUT_CHUNK_FRAMES), flushed);
+                if (count == 0) break;
+                excess -= count;
+            }
+            inputFrames = inputUsed = 0;
+            resyncs.add();
+            drift.restart();
+            fill = smoothFill();
+        }
+
+        double ratio = drift.update(fill, frames);
+        driftEstimate.store(drift.driftPpm(), std::memory_order_relaxed);
+
+        const float* h = history.data();
+        for (ma_uint32 i = 0; i < frames; ++i) {
+            while (phase >= 1.0) {
+                if (!advance()) {
+                    // Ran dry: silence until the ring is back at the target
+                    std::memset(out + size_t(i) * channels, 0, size_t(frames - i) * channels * sizeof(float));
+                    underruns.add();
+                    primed = false;
+                    return;
+                }
+                phase -= 1.0;
+            }
+
+            // Catmull-Rom between history frames 1 and 2
+            float t = static_cast<float>(phase);
+            for (ma_uint32 ch = 0; ch < channels; ++ch) {
+                float y0 = h[ch], y1 = h[channels + ch], y2 = h[2 * channels + ch], y3 = h[3 * channels + ch];
+                float a = -0.5f * y0 + 1.5f * y1 - 1.5f * y2 + 0.5f * y3;
+                float b = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+                float c = -0.5f * y0 + 0.5f * y2;
+                out[size_t(i) * channels + ch] = ((a * t + b) * t + c) * t + y1;
+            }
+            phase += ratio;
+        }
+    }
+
+    static void dataCallback(ma_device* device, void* out, const void* in, ma_uint32 frames) {
+        thread_local bool traceNamed = false;
+        if (!traceNamed) {
+            TRACE_THREAD_NAME("mirror");
+            traceNamed = true;
+        }
+        TRACE_SCOPE("mirror.callback");
+        static_cast<Mirror*>(device->pUserData)->render(static_cast<float*>(out), frames);
+    }
+};
+
+} // namespace Audio
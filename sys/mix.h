@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace Audio {
+
+// Gains for spreading stereo over surround layouts (see [mix] in loud.ini)
+struct MixGains {
+    float center = 0.7f;
+    float lfe = 0.3f;
+    float rear = 0.5f;
+};
+
+// Surround channels fold into stereo at -3 dB, then the sum is scaled back
+// so a full-scale signal on every channel can't clip
+constexpr float FOLD_GAIN = 0.7071f;
+
+// Upmix/downmix interleaved float frames from the decoder's layout to the
+// output device's. Channel order is the WAVE/miniaudio default:
+// FL FR FC LFE BL BR (SL SR). Pure function of its inputs, so the same
+// frames always produce the same output whatever thread calls it.
+inline void mapChannels(const float* in, uint32_t inChannels, float* out, uint32_t outChannels,
+                        uint64_t frameCount, const MixGains& gains) {
+    if (inChannels == 0 || outChannels == 0) return;
+
+    // Same layout: nothing to mix
+    if (inChannels == outChannels) {
+        std::memcpy(out, in, frameCount * outChannels * sizeof(float));
+        return;
+    }
+
+    std::memset(out, 0, frameCount * outChannels * sizeof(float));
+
+    for (uint64_t frame = 0; frame < frameCount; frame++) {
+        const float* src = in + frame * inChannels;
+        float* dst = out + frame * outChannels;
+
+        if (inChannels == 1) {
+            // Mono to multi-channel (duplicate to all channels)
+            for (uint32_t channel = 0; channel < outChannels; channel++) {
+                dst[channel] = src[0];
+            }
+        }
+        else if (inChannels == 2 && outChannels >= 2) {
+            // Stereo to multi-channel (common case)
+            float leftSample = src[0];
+            float rightSample = src[1];
+
+            // Front left and right (first two channels)
+            dst[0] = leftSample;
+            dst[1] = rightSample;
+
+            // Handle 5.1, 7.1, etc.
+            if (outChannels >= 6) {
+                // Center = (left+right)/2 with slight attenuation to prevent clipping
+                dst[2] = (leftSample + rightSample) * gains.center;
+
+                // LFE (subwoofer) - low frequencies only, reduce volume
+                dst[3] = (leftSample + rightSample) * gains.lfe;
+
+                // Surround/rear channels - lower volume to prevent overwhelming sound
+                dst[4] = leftSample * gains.rear;
+                dst[5] = rightSample * gains.rear;
+            }
+        }
+        else if (outChannels == 1) {
+            // Anything to mono - average all channels
+            float sum = 0;
+            for (uint32_t channel = 0; channel < inChannels; channel++) {
+                sum += src[channel];
+            }
+            dst[0] = sum / inChannels;
+        }
+        else if (outChannels == 2 && inChannels >= 6) {
+            // 5.1/7.1 to stereo: centre and surrounds fold in at -3 dB, LFE is dropped
+            float left = src[0] + FOLD_GAIN * src[2];
+            float right = src[1] + FOLD_GAIN * src[2];
+            float surrounds = 0;
+            for (uint32_t channel = 4; channel + 1 < inChannels; channel += 2) {
+                left += FOLD_GAIN * src[channel];
+                right += FOLD_GAIN * src[channel + 1];
+                surrounds += FOLD_GAIN;
+            }
+            float scale = 1.0f / (1.0f + FOLD_GAIN + surrounds);
+            dst[0] = left * scale;
+            dst[1] = right * scale;
+        }
+        else {
+            // Other layouts (5.1 <-> 7.1, quad, ...): matching positions carry
+            // over, channels the output doesn't have are dropped
+            uint32_t shared = std::min(inChannels, outChannels);
+            for (uint32_t channel = 0; channel < shared; channel++) {
+                dst[channel] = src[channel];
+            }
+        }
+    }
+}
+
+} // namespace Audio
@@ -0,0 +1,39 @@
+#pragma once
+
+// MP3 seek tables for ma_decoder. miniaudio only declares its MP3 backend
+// inside the implementation, so these are compiled with it in
+// sys/miniaudio.c and only plain types cross the boundary.
+#include "miniaudio_config.h"
+#include "miniaudio.h"
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where decoding can restart inside an MP3 (same fields as ma_dr_mp3_seek_point)
+typedef struct {
+    ma_uint64 byteOffset;
+    ma_uint64 frame;              // PCM frame at the file's own sample rate
+    ma_uint16 mp3FramesToDiscard;
+    ma_uint16 pcmFramesToDiscard;
+} loud_mp3_seek_point;
+
+// True if the decoder reads through miniaudio's MP3 backend
+ma_bool32 loud_mp3_is_mp3(const ma_decoder* decoder);
+
+// Scan an MP3's frame headers (no audio is decoded) for up to capacity evenly
+// spread seek points. widePath is used instead of path when not NULL.
+// Returns the number of points written, 0 on failure.
+ma_uint32 loud_mp3_build_seek_table(const char* path, const wchar_t* widePath, loud_mp3_seek_point* points, ma_uint32 capacity);
+
+// The same scan through an open MP3 decoder, for files that aren't plain
+// paths (entries of ZIP archives). The decoder ends up where it was.
+ma_uint32 loud_mp3_scan_seek_table(ma_decoder* decoder, loud_mp3_seek_point* points, ma_uint32 capacity);
+
+// Give an MP3 decoder a seek table; it keeps its own copy, freed with the decoder
+ma_bool32 loud_mp3_bind_seek_table(ma_decoder* decoder, const loud_mp3_seek_point* points, ma_uint32 count);
+
+#ifdef __cplusplus
+}
+#endif
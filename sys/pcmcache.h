@@ -0,0 +1,325 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "library.h"
+#include "metrics.h"
+#include "config.h"
+#include "pcmpack.h"
+
+// Fully decoded copies of heavily played tracks (cache.min_plays), so a
+// rotation of the same few hundred tracks isn't decoded and resampled again
+// all day. Entries hold exactly what the decoder hands the player (float at
+// the device rate, in the file's own channel layout), and the player maps
+// one into memory and reads it through miniaudio:
+//   - packed (cache.compress, the default): losslessly compressed with
+//     sys/pcmpack.h to about half the size, on disk and in the page cache
+//     while it plays; unpacking runs hundreds of times faster than realtime.
+//   - otherwise plain 32-bit float WAV, which miniaudio reads with a memcpy
+//     from the mapping.
+//
+// Entries are named after the path, the file version and the rate, so an
+// edited file or a new device rate never picks up an old copy. They are
+// written aside and renamed, and a hit bumps the file time: when the
+// directory grows past cache.size_mb the least recently played go first.
+namespace PcmCache {
+
+// Longer tracks (books, mixes) aren't worth the disk: 30 minutes of 44.1 kHz
+// stereo is already ~635 MB
+constexpr double MAX_ENTRY_SECONDS = 1800;
+constexpr size_t WAV_HEADER_BYTES = 46;
+
+// A whole file mapped read-only
+class MappedFile {
+public:
+    // Null if the file can't be opened or mapped
+    static std::shared_ptr<MappedFile> open(const std::filesystem::path& file) {
+        auto mapped = std::shared_ptr<MappedFile>(new MappedFile());
+        #ifdef _WIN32
+        // Shared for writing and deletion, so the cache can still bump the
+        // file time, and evict the entry once this mapping is gone
+        mapped->handle = CreateFileW(file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                     NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (mapped->handle == INVALID_HANDLE_VALUE) return nullptr;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(mapped->handle, &size) || size.QuadPart == 0) return nullptr;
+        mapped->mapping = CreateFileMappingW(mapped->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapped->mapping) return nullptr;
+        mapped->view = MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!mapped->view) return nullptr;
+        mapped->length = static_cast<size_t>(size.QuadPart);
+        #else
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps the file
+        if (view == MAP_FAILED) return nullptr;
+        madvise(view, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        mapped->view = view;
+        mapped->length = static_cast<size_t>(info.st_size);
+        #endif
+        return mapped;
+    }
+
+    ~MappedFile() {
+        #ifdef _WIN32
+        if (view) UnmapViewOfFile(view);
+        if (mapping) CloseHandle(mapping);
+        if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+        #else
+        if (view) munmap(view, length);
+        #endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return static_cast<const uint8_t*>(view); }
+    size_t size() const { return length; }
+
+private:
+    MappedFile() = default;
+
+    #ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    #endif
+    void* view = nullptr;
+    size_t length = 0;
+};
+
+inline void putLittleEndian(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+// RIFF header of a float WAV with `frames` frames
+inline std::vector<uint8_t> wavHeader(uint32_t channels, uint32_t sampleRate, uint64_t frames) {
+    uint32_t dataBytes = static_cast<uint32_t>(frames * channels * sizeof(float));
+    std::vector<uint8_t> header;
+    header.insert(header.end(), { 'R', 'I', 'F', 'F' });
+    putLittleEndian(header, static_cast<uint32_t>(WAV_HEADER_BYTES - 8) + dataBytes, 4);
+    header.insert(header.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+    putLittleEndian(header, 18, 4);                          // fmt chunk size
+    putLittleEndian(header, 3, 2);                           // WAVE_FORMAT_IEEE_FLOAT
+    putLittleEndian(header, channels, 2);
+    putLittleEndian(header, sampleRate, 4);
+    putLittleEndian(header, sampleRate * channels * 4, 4);   // Bytes per second
+    putLittleEndian(header, channels * 4, 2);                // Block align
+    putLittleEndian(header, 32, 2);                          // Bits per sample
+    putLittleEndian(header, 0, 2);                           // No extension
+    header.insert(header.end(), { 'd', 'a', 't', 'a' });
+    putLittleEndian(header, dataBytes, 4);
+    return header;
+}
+
+class Cache {
+public:
+    Cache() {
+        const Config::Settings& settings = Config::current();
+        directory = settings.cacheDir.empty() ? Library::index().root() / "pcm" : std::filesystem::u8path(settings.cacheDir);
+        Metrics::gauge("loud_pcm_cache_bytes", "Size of the decoded track cache on disk", [this]() { return double(bytes.load()); });
+    }
+
+    // The decoded copy of a file at this rate, mapped; null if there's none
+    std::shared_ptr<MappedFile> open(const std::string& path, uint32_t sampleRate) {
+        static auto& hits = Metrics::counter("loud_pcm_cache_hits_total", "Tracks played from the decoded track cache");
+        static auto& misses = Metrics::counter("loud_pcm_cache_misses_total", "Tracks decoded from their file");
+        std::filesystem::path file;
+        if (!enabled() || !entryFile(path, sampleRate, file)) return nullptr;
+
+        std::error_code ec;
+        std::shared_ptr<MappedFile> mapped;
+        if (std::filesystem::exists(file, ec)) mapped = MappedFile::open(file);
+        if (!mapped || mapped->size() < WAV_HEADER_BYTES) {
+            misses.add();
+            return nullptr;
+        }
+        std::filesystem::last_write_time(file, std::filesystem::file_time_type::clock::now(), ec); // Recently used
+        hits.add();
+        return mapped;
+    }
+
+    // True if the caller should decode the file and store() it: the cache is
+    // on, the file is played often enough, and no copy exists or is being made
+    bool claim(const std::string& path, uint32_t sampleRate) {
+        std::filesystem::path file;
+        if (!enabled() || !entryFile(path, sampleRate, file)) return false;
+        auto info = Library::index().peek(path);
+        if (!info || info->plays + 1 < Config::current().cacheMinPlays) return false;
+        std::error_code ec;
+        if (std::filesystem::exists(file, ec)) return false;
+        std::scoped_lock lock(mutex);
+        return pending.insert(file.u8string()).second;
+    }
+
+    // Finish a claim: write the frames read() hands over (interleaved float,
+    // 0 at the end) as the entry, then trim the cache to its budget. read()
+    // returning more than MAX_ENTRY_SECONDS of audio abandons the entry.
+    void store(const std::string& path, uint32_t sampleRate, uint32_t channels,
+               const std::function<size_t(float* frames, size_t capacity)>& read) {
+        static auto& stores = Metrics::counter("loud_pcm_cache_stores_total", "Tracks written to the decoded track cache");
+        std::filesystem::path file;
+        if (!entryFile(path, sampleRate, file)) return;
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        std::filesystem::path temp = file;
+        temp += ".tmp";
+        const bool packed = file.extension() == PACKED_EXTENSION;
+        uint64_t frames = 0;
+        bool complete = false;
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            std::unique_ptr<PcmPack::Encoder> encoder;
+            uint64_t maxFrames = static_cast<uint64_t>(MAX_ENTRY_SECONDS * sampleRate);
+            if (packed) {
+                encoder = std::make_unique<PcmPack::Encoder>(out, channels, sampleRate);
+            } else {
+                std::vector<uint8_t> header = wavHeader(channels, sampleRate, 0);
+                out.write(reinterpret_cast<const char*>(header.data()), header.size());
+                // WAV sizes are 32-bit
+                maxFrames = std::min<uint64_t>(maxFrames, (UINT32_MAX - WAV_HEADER_BYTES) / (channels * sizeof(float)));
+            }
+
+            std::vector<float> block(BLOCK_FRAMES * channels);
+            while (out) {
+                size_t got = read(block.data(), BLOCK_FRAMES);
+                if (got == 0) {
+                    complete = frames > 0;
+                    break;
+                }
+                if (encoder) {
+                    encoder->write(block.data(), got);
+                } else {
+                    out.write(reinterpret_cast<const char*>(block.data()), got * channels * sizeof(float));
+                }
+                frames += got;
+                if (frames > maxFrames) break;
+            }
+            if (complete && encoder) {
+                complete = encoder->finish();
+            } else if (complete) {
+                std::vector<uint8_t> header = wavHeader(channels, sampleRate, frames);
+                out.seekp(0);
+                out.write(reinterpret_cast<const char*>(header.data()), header.size());
+            }
+            complete = complete && static_cast<bool>(out);
+        }
+        uint64_t stored = complete ? std::filesystem::file_size(temp, ec) : 0;
+        if (complete && !ec) std::filesystem::rename(temp, file, ec);
+        if (!complete || ec) std::filesystem::remove(temp, ec);
+        {
+            std::scoped_lock lock(mutex);
+            pending.erase(file.u8string());
+        }
+        if (complete && !ec) {
+            stores.add();
+            std::cout << "Cache: stored " << path << " (" << stored / (1024 * 1024) << " MB";
+            if (packed) std::cout << ", packed to " << 100 * stored / std::max<uint64_t>(1, frames * channels * sizeof(float)) << "%";
+            std::cout << ")\n";
+        }
+        trim();
+    }
+
+    // Remove the least recently played entries until the cache fits its budget
+    void trim() {
+        static auto& evictions = Metrics::counter("loud_pcm_cache_evictions_total", "Entries removed from the decoded track cache");
+        struct Entry {
+            std::filesystem::file_time_type time;
+            uint64_t size;
+            std::filesystem::path file;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() != ".wav" && it->path().extension() != PACKED_EXTENSION) continue;
+            std::error_code entryError;
+            Entry entry{ it->last_write_time(entryError), it->file_size(entryError), it->path() };
+            if (entryError) continue;
+            total += entry.size;
+            entries.push_back(entry);
+        }
+
+        uint64_t budget = uint64_t(Config::current().cacheSizeMb) * 1024 * 1024;
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+        for (const Entry& entry : entries) {
+            if (total <= budget) break;
+            std::error_code removeError;
+            // Fails for entries still mapped on Windows; they go next time
+            if (std::filesystem::remove(entry.file, removeError)) {
+                total -= entry.size;
+                evictions.add();
+            }
+        }
+        bytes.store(total);
+    }
+
+private:
+    static constexpr size_t BLOCK_FRAMES = 16384;
+    static constexpr const char* PACKED_EXTENSION = ".lpk";
+
+    std::filesystem::path directory;
+    std::mutex mutex;
+    std::set<std::string> pending;   // Entries being written
+    std::atomic<uint64_t> bytes{0};  // As of the last trim()
+
+    static bool enabled() {
+        return Config::current().cacheSizeMb > 0;
+    }
+
+    bool entryFile(const std::string& path, uint32_t sampleRate, std::filesystem::path& file) const {
+        uint64_t size;
+        int64_t mtime;
+        if (path.empty() || !Library::stamp(path, size, mtime)) return false;
+
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        for (unsigned char c : path) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        char name[96];
+        std::snprintf(name, sizeof(name), "%016llx-%llx-%llx-%u%s", static_cast<unsigned long long>(hash),
+                      static_cast<unsigned long long>(size), static_cast<unsigned long long>(mtime), sampleRate,
+                      Config::current().cacheCompress ? PACKED_EXTENSION : ".wav");
+        file = directory / name;
+        return true;
+    }
+};
+
+// Never destroyed: cache builds on the worker pool may outlive static destructors
+inline Cache& cache() {
+    static Cache* instance = []() {
+        Cache* created = new Cache();
+        created->trim(); // The budget may have shrunk since the last run
+        return created;
+    }();
+    return *instance;
+}
+
+} // namespace PcmCache
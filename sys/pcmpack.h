@@ -0,0 +1,567 @@
+#pragma once
+
+#include <vector>
+#include <ostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include "miniaudio_config.h"
+#include "miniaudio.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LOUD_PACK_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Lossless packing of decoded audio, for the decoded track cache
+// (sys/pcmcache.h). A small relative of FLAC, cut down to what decodes fast:
+//   - Samples are integers in steps of 2^-23 (24-bit resolution, up to
+//     +-2.0). 16- and 24-bit sources round-trip exactly; anything else
+//     (MP3, resampled audio) is kept at 24 bits, ~140 dB below full scale.
+//   - Every block of BLOCK_FRAMES is coded on its own: stereo as left and
+//     right or one of them and their difference, whichever is smaller; low
+//     bits that are always zero are dropped (8 of them for a 16-bit source);
+//     then a fixed polynomial predictor of order 0-4, which leaves the
+//     order-k difference of the samples, Rice coded in PARTITION_FRAMES runs
+//     with their own parameter.
+//   - Blocks start from silence instead of warm-up samples, so undoing an
+//     order-k predictor is just k running sums, four samples at a time with
+//     SSE2, and seeking is a lookup in the block index at the end.
+// Typical music packs to 40-60% of 32-bit float; a 16-bit rip to ~30%.
+// Decoding runs at several hundred times realtime on one core.
+namespace PcmPack {
+
+constexpr char MAGIC[4] = { 'L', 'P', 'K', '1' };
+constexpr size_t HEADER_BYTES = 32;
+constexpr uint32_t BLOCK_FRAMES = 4096;
+constexpr uint32_t PARTITION_FRAMES = 512;
+constexpr int MAX_ORDER = 4;
+constexpr int MAX_RICE = 30;
+constexpr uint32_t RICE_ESCAPE = 24;      // Quotients this big are stored as 32 raw bits
+constexpr float SCALE = 8388608.0f;       // 2^23
+constexpr int32_t SAMPLE_LIMIT = 1 << 24; // +-2.0
+
+enum Mode : uint32_t { INDEPENDENT = 0, LEFT_SIDE = 1, SIDE_RIGHT = 2 };
+
+inline void store32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = uint8_t(value >> (8 * i));
+}
+
+inline void store64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out[i] = uint8_t(value >> (8 * i));
+}
+
+inline uint32_t load32(const uint8_t* in) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) value = (value << 8) | in[i];
+    return value;
+}
+
+inline uint64_t load64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) value = (value << 8) | in[i];
+    return value;
+}
+
+inline int leadingZeros(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - int(index);
+#else
+    return __builtin_clzll(value);
+#endif
+}
+
+inline uint32_t zigzag(int32_t value) {
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value) {
+    return int32_t((value >> 1) ^ (0u - (value & 1)));
+}
+
+// Most significant bit first
+class BitWriter {
+public:
+    std::vector<uint8_t> bytes;
+
+    void put(uint32_t value, int count) {
+        if (count == 0) return;
+        if (count < 32) value &= (1u << count) - 1;
+        acc = (acc << count) | value;
+        fill += count;
+        while (fill >= 8) {
+            fill -= 8;
+            bytes.push_back(uint8_t(acc >> fill));
+        }
+    }
+
+    void rice(uint32_t value, int k) {
+        uint32_t quotient = value >> k;
+        if (quotient < RICE_ESCAPE) {
+            put(1, int(quotient) + 1); // Unary: quotient zeros, then a one
+            put(value, k);
+        } else {
+            put(1, int(RICE_ESCAPE) + 1);
+            put(value, 32);
+        }
+    }
+
+    // Pad to a whole byte
+    void align() {
+        if (fill > 0) put(0, 8 - fill);
+    }
+
+    void clear() {
+        bytes.clear();
+        acc = 0;
+        fill = 0;
+    }
+
+private:
+    uint64_t acc = 0;
+    int fill = 0;
+};
+
+// Reads past the end as zeros; the caller bounds the damage of a bad stream
+class BitReader {
+public:
+    BitReader(const uint8_t* data, const uint8_t* end) : next(data), end(end) {}
+
+    uint32_t get(int count) {
+        if (count == 0) return 0;
+        refill();
+        uint32_t value = uint32_t(buffer >> (64 - count));
+        buffer <<= count;
+        bits -= count;
+        return value;
+    }
+
+    // False on a code no encoder writes
+    bool rice(int k, uint32_t& value) {
+        refill();
+        if (buffer == 0) return false;
+        uint32_t quotient = uint32_t(leadingZeros(buffer));
+        if (quotient > RICE_ESCAPE) return false;
+        buffer <<= quotient + 1;
+        bits -= int(quotient) + 1;
+        value = quotient == RICE_ESCAPE ? get(32) : (quotient << k) | get(k);
+        return true;
+    }
+
+private:
+    const uint8_t* next;
+    const uint8_t* end;
+    uint64_t buffer = 0; // Unread bits, from the top
+    int bits = 0;
+
+    // At least 33 bits in the buffer. The fast path loads 8 bytes and keeps
+    // the whole ones that fit; the partial byte is loaded again next time.
+    void refill() {
+        if (bits > 32) return;
+        if (end - next >= 8) {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; i++) word = (word << 8) | next[i];
+            buffer |= word >> bits;
+            int taken = (63 - bits) >> 3;
+            next += taken;
+            bits += taken * 8;
+            return;
+        }
+        while (bits <= 56) {
+            uint64_t byte = next < end ? *next++ : 0;
+            buffer |= byte << (56 - bits);
+            bits += 8;
+        }
+    }
+};
+
+// In place: v[i] = v[0] + ... + v[i], wrapping like the encoder's differences
+inline void runningSum(int32_t* v, size_t count) {
+    size_t i = 0;
+#ifdef LOUD_PACK_SSE2
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+#endif
+    uint32_t sum = i > 0 ? uint32_t(v[i - 1]) : 0;
+    for (; i < count; i++) {
+        sum += uint32_t(v[i]);
+        v[i] = int32_t(sum);
+    }
+}
+
+// Interleave channels of integer samples into float frames: out = in * scale
+inline void interleave(const std::vector<std::vector<int32_t>>& in, size_t count, float scale, float* out) {
+    const size_t channels = in.size();
+    size_t i = 0;
+#ifdef LOUD_PACK_SSE2
+    const __m128 factor = _mm_set1_ps(scale);
+    if (channels == 1) {
+        for (; i + 4 <= count; i += 4) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[0].data() + i));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), factor));
+        }
+    } else if (channels == 2) {
+        for (; i + 4 <= count; i += 4) {
+            __m128 left = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in[0].data() + i))), factor);
+            __m128 right = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in[1].data() + i))), factor);
+            _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(left, right));
+            _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(left, right));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        for (size_t c = 0; c < channels; c++) out[i * channels + c] = float(in[c][i]) * scale;
+    }
+}
+
+// Streams interleaved float frames into a packed file
+class Encoder {
+public:
+    Encoder(std::ostream& out, uint32_t channels, uint32_t sampleRate)
+        : out(out), channelCount(channels), sampleRate(sampleRate), pending(channels), side(BLOCK_FRAMES) {
+        for (auto& samples : pending) samples.reserve(BLOCK_FRAMES);
+        writeHeader(); // Placeholder until finish()
+    }
+
+    void write(const float* frames, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            for (uint32_t c = 0; c < channelCount; c++) pending[c].push_back(quantise(frames[i * channelCount + c]));
+            if (pending[0].size() == BLOCK_FRAMES) flushBlock();
+        }
+    }
+
+    // Write the last block, the index and the real header; false if the stream failed
+    bool finish() {
+        if (!pending[0].empty()) flushBlock();
+        indexOffset = position;
+        std::vector<uint8_t> index(offsets.size() * 8);
+        for (size_t i = 0; i < offsets.size(); i++) store64(index.data() + 8 * i, offsets[i]);
+        out.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size()));
+        position += index.size();
+        out.seekp(0);
+        writeHeader();
+        out.seekp(std::streamoff(position));
+        return bool(out);
+    }
+
+    uint64_t frames() const { return totalFrames + pending[0].size(); }
+    uint64_t bytes() const { return position; }
+
+private:
+    // The residual of one coded channel, with how it was made
+    struct Plan {
+        int order = 0;
+        int shift = 0;
+        uint64_t cost = 0;              // Sum of |residual|, to compare plans
+        std::vector<int32_t> residual;
+    };
+
+    std::ostream& out;
+    uint32_t channelCount;
+    uint32_t sampleRate;
+    std::vector<std::vector<int32_t>> pending; // Per channel, up to a block
+    std::vector<int32_t> side;
+    std::vector<uint64_t> offsets;             // Of every block
+    uint64_t totalFrames = 0;
+    uint64_t position = 0;
+    uint64_t indexOffset = 0;
+    BitWriter bits;
+    std::vector<int32_t> work;
+
+    static int32_t quantise(float sample) {
+        if (!(sample == sample)) return 0; // NaN
+        float scaled = std::min(std::max(sample * SCALE, -float(SAMPLE_LIMIT)), float(SAMPLE_LIMIT));
+        return int32_t(std::lrint(scaled));
+    }
+
+    void writeHeader() {
+        uint8_t header[HEADER_BYTES] = {};
+        std::memcpy(header, MAGIC, 4);
+        store32(header + 4, channelCount);
+        store32(header + 8, sampleRate);
+        store32(header + 12, BLOCK_FRAMES);
+        store64(header + 16, totalFrames);
+        store64(header + 24, indexOffset);
+        out.write(reinterpret_cast<const char*>(header), HEADER_BYTES);
+        if (position == 0) position = HEADER_BYTES;
+    }
+
+    // Drop the always-zero low bits, then take differences order by order
+    // and keep the order that leaves the least
+    void plan(const int32_t* samples, size_t count, Plan& best) {
+        uint32_t bitsUsed = 0;
+        for (size_t i = 0; i < count; i++) bitsUsed |= uint32_t(samples[i]);
+        int shift = 0;
+        while (shift < 31 && bitsUsed != 0 && (bitsUsed & (1u << shift)) == 0) shift++;
+
+        work.assign(samples, samples + count);
+        for (auto& v : work) v >>= shift;
+        best.shift = shift;
+        best.order = -1;
+        for (int order = 0; order <= MAX_ORDER; order++) {
+            if (order > 0) {
+                for (size_t i = count; i-- > 1;) work[i] = int32_t(uint32_t(work[i]) - uint32_t(work[i - 1]));
+            }
+            uint64_t cost = 0;
+            for (size_t i = 0; i < count; i++) cost += uint64_t(std::abs(int64_t(work[i])));
+            if (best.order < 0 || cost < best.cost) {
+                best.order = order;
+                best.cost = cost;
+                best.residual = work;
+            }
+        }
+    }
+
+    void code(const Plan& plan, size_t count) {
+        bits.put(uint32_t(plan.order), 3);
+        bits.put(uint32_t(plan.shift), 5);
+        for (size_t start = 0; start < count; start += PARTITION_FRAMES) {
+            size_t end = std::min<size_t>(start + PARTITION_FRAMES, count);
+            uint64_t sum = 0;
+            for (size_t i = start; i < end; i++) sum += zigzag(plan.residual[i]);
+            // Rice parameter near log2 of the mean
+            int k = 0;
+            while (k < MAX_RICE && (uint64_t(end - start) << (k + 1)) <= sum) k++;
+            bits.put(uint32_t(k), 5);
+            for (size_t i = start; i < end; i++) bits.rice(zigzag(plan.residual[i]), k);
+        }
+    }
+
+    void flushBlock() {
+        const size_t count = pending[0].size();
+        bits.clear();
+        if (channelCount == 2) {
+            for (size_t i = 0; i < count; i++) side[i] = pending[0][i] - pending[1][i];
+            Plan left, right, difference;
+            plan(pending[0].data(), count, left);
+            plan(pending[1].data(), count, right);
+            plan(side.data(), count, difference);
+            const uint64_t independent = left.cost + right.cost;
+            const uint64_t leftSide = left.cost + difference.cost;
+            const uint64_t sideRight = difference.cost + right.cost;
+            if (leftSide < independent && leftSide <= sideRight) {
+                bits.put(LEFT_SIDE, 2);
+                code(left, count);
+                code(difference, count);
+            } else if (sideRight < independent) {
+                bits.put(SIDE_RIGHT, 2);
+                code(difference, count);
+                code(right, count);
+            } else {
+                bits.put(INDEPENDENT, 2);
+                code(left, count);
+                code(right, count);
+            }
+        } else {
+            bits.put(INDEPENDENT, 2);
+            Plan channel;
+            for (uint32_t c = 0; c < channelCount; c++) {
+                plan(pending[c].data(), count, channel);
+                code(channel, count);
+            }
+        }
+        bits.align();
+
+        offsets.push_back(position);
+        out.write(reinterpret_cast<const char*>(bits.bytes.data()), std::streamsize(bits.bytes.size()));
+        position += bits.bytes.size();
+        totalFrames += count;
+        for (auto& samples : pending) samples.clear();
+    }
+};
+
+// Random access to a packed buffer (typically a mapped file), block by block
+class Reader {
+public:
+    // False if the buffer isn't a whole packed file
+    bool open(const uint8_t* bytes, size_t size) {
+        if (size < HEADER_BYTES || std::memcmp(bytes, MAGIC, 4) != 0) return false;
+        data = bytes;
+        length = size;
+        channelCount = load32(bytes + 4);
+        rate = load32(bytes + 8);
+        blockFrames = load32(bytes + 12);
+        totalFrames = load64(bytes + 16);
+        indexOffset = load64(bytes + 24);
+        if (channelCount == 0 || channelCount > MA_MAX_CHANNELS || rate == 0 || blockFrames == 0 || blockFrames > (1u << 20)) return false;
+        blocks = (totalFrames + blockFrames - 1) / blockFrames;
+        if (indexOffset < HEADER_BYTES || indexOffset > size || (size - indexOffset) / 8 < blocks) return false;
+        samples.assign(channelCount, std::vector<int32_t>(blockFrames));
+        return true;
+    }
+
+    uint32_t channels() const { return channelCount; }
+    uint32_t sampleRate() const { return rate; }
+    uint64_t frames() const { return totalFrames; }
+    uint32_t framesPerBlock() const { return blockFrames; }
+
+    // Decode one block as interleaved float into out (framesPerBlock() frames
+    // of room); returns its frame count, 0 past the end or if it is damaged
+    size_t decodeBlock(uint64_t block, float* out) {
+        if (block >= blocks) return 0;
+        uint64_t offset = load64(data + indexOffset + 8 * block);
+        if (offset < HEADER_BYTES || offset >= indexOffset) return 0;
+        size_t count = size_t(std::min<uint64_t>(blockFrames, totalFrames - block * blockFrames));
+
+        BitReader bits(data + offset, data + length);
+        uint32_t mode = bits.get(2);
+        if (mode != INDEPENDENT && channelCount != 2) return 0;
+        for (uint32_t c = 0; c < channelCount; c++) {
+            int32_t* v = samples[c].data();
+            int order = int(bits.get(3));
+            int shift = int(bits.get(5));
+            if (order > MAX_ORDER) return 0;
+            for (size_t start = 0; start < count; start += PARTITION_FRAMES) {
+                size_t end = std::min<size_t>(start + PARTITION_FRAMES, count);
+                int k = int(bits.get(5));
+                for (size_t i = start; i < end; i++) {
+                    uint32_t value;
+                    if (!bits.rice(k, value)) return 0;
+                    v[i] = unzigzag(value);
+                }
+            }
+            for (int i = 0; i < order; i++) runningSum(v, count);
+            if (shift > 0) {
+                for (size_t i = 0; i < count; i++) v[i] = int32_t(uint32_t(v[i]) << shift);
+            }
+        }
+        if (mode == LEFT_SIDE) {
+            for (size_t i = 0; i < count; i++) samples[1][i] = int32_t(uint32_t(samples[0][i]) - uint32_t(samples[1][i]));
+        } else if (mode == SIDE_RIGHT) {
+            for (size_t i = 0; i < count; i++) samples[0][i] = int32_t(uint32_t(samples[0][i]) + uint32_t(samples[1][i]));
+        }
+        interleave(samples, count, 1.0f / SCALE, out);
+        return count;
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    uint32_t channelCount = 0;
+    uint32_t rate = 0;
+    uint32_t blockFrames = 0;
+    uint64_t totalFrames = 0;
+    uint64_t indexOffset = 0;
+    uint64_t blocks = 0;
+    std::vector<std::vector<int32_t>> samples; // One block, per channel
+};
+
+// miniaudio decoding backend over packed memory, so a packed file opens with
+// ma_decoder_init_memory like any other format (see backend())
+struct Source {
+    ma_data_source_base base; // First: miniaudio hands back its address
+    Reader reader;
+    std::vector<float> block;
+    uint64_t blockIndex = UINT64_MAX;
+    size_t blockLength = 0;
+    uint64_t cursor = 0;
+};
+
+inline Source* asSource(ma_data_source* dataSource) {
+    return reinterpret_cast<Source*>(dataSource);
+}
+
+inline ma_result sourceRead(ma_data_source* dataSource, void* framesOut, ma_uint64 frameCount, ma_uint64* framesRead) {
+    Source* source = asSource(dataSource);
+    const uint32_t channels = source->reader.channels();
+    const uint32_t blockFrames = source->reader.framesPerBlock();
+    float* out = static_cast<float*>(framesOut);
+    ma_uint64 done = 0;
+    while (done < frameCount && source->cursor < source->reader.frames()) {
+        uint64_t index = source->cursor / blockFrames;
+        if (index != source->blockIndex) {
+            source->blockIndex = index;
+            source->blockLength = source->reader.decodeBlock(index, source->block.data());
+        }
+        uint64_t offset = source->cursor - index * blockFrames;
+        if (offset >= source->blockLength) break; // Damaged block
+        ma_uint64 count = std::min<ma_uint64>(source->blockLength - offset, frameCount - done);
+        if (out) std::memcpy(out + done * channels, source->block.data() + offset * channels, size_t(count) * channels * sizeof(float));
+        done += count;
+        source->cursor += count;
+    }
+    if (framesRead) *framesRead = done;
+    return done == 0 && frameCount > 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+inline ma_result sourceSeek(ma_data_source* dataSource, ma_uint64 frameIndex) {
+    Source* source = asSource(dataSource);
+    if (frameIndex > source->reader.frames()) return MA_INVALID_ARGS;
+    source->cursor = frameIndex; // The block is decoded by the next read
+    return MA_SUCCESS;
+}
+
+inline ma_result sourceFormat(ma_data_source* dataSource, ma_format* format, ma_uint32* channels, ma_uint32* sampleRate,
+                              ma_channel* channelMap, size_t channelMapCap) {
+    Source* source = asSource(dataSource);
+    if (format) *format = ma_format_f32;
+    if (channels) *channels = source->reader.channels();
+    if (sampleRate) *sampleRate = source->reader.sampleRate();
+    if (channelMap) ma_channel_map_init_standard(ma_standard_channel_map_default, channelMap, channelMapCap, source->reader.channels());
+    return MA_SUCCESS;
+}
+
+inline ma_result sourceCursor(ma_data_source* dataSource, ma_uint64* cursor) {
+    *cursor = asSource(dataSource)->cursor;
+    return MA_SUCCESS;
+}
+
+inline ma_result sourceLength(ma_data_source* dataSource, ma_uint64* length) {
+    *length = asSource(dataSource)->reader.frames();
+    return MA_SUCCESS;
+}
+
+inline ma_result backendInitStream(void*, ma_read_proc, ma_seek_proc, ma_tell_proc, void*, const ma_decoding_backend_config*,
+                                   const ma_allocation_callbacks*, ma_data_source**) {
+    return MA_NOT_IMPLEMENTED; // Packed files are only ever mapped
+}
+
+inline ma_result backendInitMemory(void*, const void* data, size_t size, const ma_decoding_backend_config*,
+                                   const ma_allocation_callbacks*, ma_data_source** backend) {
+    static ma_data_source_vtable vtable = { sourceRead, sourceSeek, sourceFormat, sourceCursor, sourceLength, NULL, 0 };
+    Source* source = new (std::nothrow) Source();
+    if (!source) return MA_OUT_OF_MEMORY;
+    if (!source->reader.open(static_cast<const uint8_t*>(data), size)) {
+        delete source;
+        return MA_INVALID_FILE;
+    }
+    ma_data_source_config config = ma_data_source_config_init();
+    config.vtable = &vtable;
+    if (ma_data_source_init(&config, &source->base) != MA_SUCCESS) {
+        delete source;
+        return MA_ERROR;
+    }
+    source->block.resize(size_t(source->reader.framesPerBlock()) * source->reader.channels());
+    *backend = &source->base;
+    return MA_SUCCESS;
+}
+
+inline void backendUninit(void*, ma_data_source* backend, const ma_allocation_callbacks*) {
+    ma_data_source_uninit(backend);
+    delete asSource(backend);
+}
+
+// For ma_decoder_config::ppCustomBackendVTables. Only reads memory, and the
+// memory has to outlive the decoder (it isn't copied).
+inline ma_decoding_backend_vtable* backend() {
+    static ma_decoding_backend_vtable vtable = { backendInitStream, NULL, NULL, backendInitMemory, backendUninit };
+    return &vtable;
+}
+
+} // namespace PcmPack
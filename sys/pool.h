@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include "trace.h"
+#include "config.h"
+
+// Fixed set of worker threads shared by everything in the process that can
+// split its work into independent pieces (decoding the stems of a group, ...).
+// parallelFor() is fork-join: the caller works on the batch too and returns
+// once every item is done, so callers never deal with futures or lifetimes.
+// submit() queues fire-and-forget background work (building indexes, ...),
+// which only runs while no batch is waiting for a worker.
+namespace Work {
+
+class Pool {
+public:
+    explicit Pool(unsigned threadCount) {
+        for (unsigned i = 0; i < threadCount; i++) {
+            threads.emplace_back([this]() { this->workerLoop(); });
+        }
+    }
+
+    ~Pool() {
+        {
+            std::scoped_lock lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Worker threads, not counting callers of parallelFor()
+    size_t size() const { return threads.size(); }
+
+    // Run fn(0) .. fn(count - 1) across the workers and the calling thread.
+    // Items should be coarse (tens of microseconds or more): each one is
+    // claimed under a mutex. Batches from different callers run one at a time.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+        if (threads.empty() || count < 2) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        std::scoped_lock batchLock(batchMutex);
+        {
+            std::scoped_lock lock(mutex);
+            job = &fn;
+            jobCount = count;
+            nextItem = 0;
+            remaining = count;
+        }
+        wake.notify_all();
+
+        std::unique_lock lock(mutex);
+        runItems(lock);
+        done.wait(lock, [this]() { return remaining == 0; });
+        job = nullptr;
+    }
+
+    // Run task on a worker some time later. Tasks may take seconds, but
+    // should own everything they touch: tasks still queued when the pool goes
+    // away are dropped.
+    void submit(std::function<void()> task) {
+        {
+            std::scoped_lock lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex batchMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+
+    // Current batch (guarded by mutex)
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t nextItem = 0;
+    size_t remaining = 0;
+
+    // Background tasks (guarded by mutex)
+    std::deque<std::function<void()>> tasks;
+
+    // Claim and run items until the batch has none left (mutex held on entry and exit)
+    void runItems(std::unique_lock<std::mutex>& lock) {
+        while (job && nextItem < jobCount) {
+            size_t item = nextItem++;
+            const std::function<void(size_t)>& fn = *job; // Valid until this item is counted done
+            lock.unlock();
+            fn(item);
+            lock.lock();
+            if (--remaining == 0) done.notify_all();
+        }
+    }
+
+    void workerLoop() {
+        TRACE_THREAD_NAME("worker");
+        std::unique_lock lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return stopping || (job && nextItem < jobCount) || !tasks.empty(); });
+            if (stopping) return;
+
+            // Batch items first: somebody is waiting for them
+            if (job && nextItem < jobCount) {
+                runItems(lock);
+            } else {
+                std::function<void()> task = std::move(tasks.front());
+                tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+            }
+        }
+    }
+};
+
+// Sized by workers.threads in loud.ini; 0 leaves one core for the audio and
+// decode threads and uses the rest, but always starts one worker so
+// background tasks get to run
+inline Pool& pool() {
+    static Pool instance([]() {
+        unsigned configured = Config::current().workerThreads;
+        if (configured > 0) return configured;
+        unsigned cores = std::thread::hardware_concurrency();
+        return cores > 2 ? std::min(cores - 1, 16u) : 1u;
+    }());
+    return instance;
+}
+
+} // namespace Work
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace Audio {
+
+// Single-producer, many-reader byte ring for broadcasting the mixed output.
+// The producer (audio thread) never blocks and never waits for readers; it
+// simply overwrites the oldest data. Each reader keeps its own cursor into the
+// absolute byte stream and is expected to give up once it falls more than
+// maxLag() bytes behind, which keeps it clear of the region being overwritten.
+class BroadcastRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit BroadcastRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        data.resize(size);
+        mask = size - 1;
+    }
+
+    // Producer only
+    void write(const void* src, size_t size) {
+        uint64_t pos = writePos.load(std::memory_order_relaxed);
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+
+        size_t offset = static_cast<size_t>(pos & mask);
+        size_t first = std::min(size, data.size() - offset);
+        std::memcpy(&data[offset], bytes, first);
+        std::memcpy(&data[0], bytes + first, size - first);
+
+        writePos.store(pos + size, std::memory_order_release);
+    }
+
+    // Total bytes written so far; readers may consume up to here
+    uint64_t head() const {
+        return writePos.load(std::memory_order_acquire);
+    }
+
+    // Contiguous bytes available at cursor without wrapping (no copy)
+    const uint8_t* peek(uint64_t cursor, size_t& length) const {
+        uint64_t available = head() - cursor;
+        size_t offset = static_cast<size_t>(cursor & mask);
+        length = static_cast<size_t>(std::min<uint64_t>(available, data.size() - offset));
+        return &data[offset];
+    }
+
+    // Readers further behind than this must be dropped
+    uint64_t maxLag() const {
+        return data.size() / 2;
+    }
+
+private:
+    std::vector<uint8_t> data;
+    size_t mask = 0;
+    std::atomic<uint64_t> writePos{0};
+};
+
+// Single-producer, single-consumer ring of interleaved float frames between
+// the decode thread and the device callback. Neither side ever blocks.
+// Positions are absolute frame counts, so they never wrap in practice.
+//
+// The producer can drop everything queued so far with flush(): it only
+// publishes the position where fresh audio starts, and the consumer skips
+// ahead to it on its next read. That keeps the read position owned by the
+// consumer alone while still letting a new track replace the old one at once.
+class FrameRing {
+public:
+    static constexpr uint64_t NONE = UINT64_MAX;
+
+    // capacity is rounded up to a power of two
+    FrameRing(size_t capacityFrames, uint32_t channels) : channels(channels) {
+        size_t size = 1;
+        while (size < capacityFrames) size <<= 1;
+        data.resize(size * channels);
+        frameMask = size - 1;
+    }
+
+    size_t capacity() const { return frameMask + 1; }
+
+    // Producer: frames that can be written without touching unread data.
+    // Flushed frames the consumer hasn't skipped yet still take up room.
+    size_t writable() const {
+        uint64_t used = writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire);
+        return capacity() - static_cast<size_t>(used);
+    }
+
+    // Producer: frames queued for the current track
+    size_t buffered() const {
+        uint64_t from = std::max(readPos.load(std::memory_order_acquire), flushTo.load(std::memory_order_relaxed));
+        uint64_t to = writePos.load(std::memory_order_relaxed);
+        return to > from ? static_cast<size_t>(to - from) : 0;
+    }
+
+    // Consumer: frames the next read can return
+    size_t readable() const {
+        uint64_t end = writePos.load(std::memory_order_acquire);
+        uint64_t from = std::max(readPos.load(std::memory_order_relaxed), flushTo.load(std::memory_order_acquire));
+        return end > from ? static_cast<size_t>(end - from) : 0;
+    }
+
+    // Producer: absolute position the next written frame will get
+    uint64_t writePosition() const {
+        return writePos.load(std::memory_order_relaxed);
+    }
+
+    // Any thread: absolute position of the next frame the consumer plays
+    // (flushed frames count as played)
+    uint64_t playedPosition() const {
+        return std::max(readPos.load(std::memory_order_acquire), flushTo.load(std::memory_order_acquire));
+    }
+
+    // Producer: copies up to count frames in, returns how many fit
+    size_t write(const float* frames, size_t count) {
+        count = std::min(count, writable());
+        uint64_t pos = writePos.load(std::memory_order_relaxed);
+        size_t offset = static_cast<size_t>(pos & frameMask);
+        size_t first = std::min(count, capacity() - offset);
+        std::memcpy(&data[offset * channels], frames, first * channels * sizeof(float));
+        std::memcpy(&data[0], frames + first * channels, (count - first) * channels * sizeof(float));
+        writePos.store(pos + count, std::memory_order_release);
+        return count;
+    }
+
+    // Producer: discard everything written so far
+    void flush() {
+        endAt.store(NONE, std::memory_order_relaxed);
+        flushTo.store(writePos.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+    // Producer: take back queued frames that haven't been played yet, so they
+    // can be decoded again (e.g. with new stem gains). The next `keep` frames
+    // stay, since a callback may already be copying them; keep must be at
+    // least the largest callback. Returns how many frames were taken back.
+    size_t rewind(size_t keep) {
+        uint64_t pos = writePos.load(std::memory_order_relaxed);
+        uint64_t from = std::max(readPos.load(std::memory_order_acquire), flushTo.load(std::memory_order_relaxed)) + keep;
+        if (pos <= from) return 0;
+
+        // An end marker in the dropped part no longer holds
+        uint64_t end = endAt.load(std::memory_order_relaxed);
+        if (end != NONE && end > from) endAt.store(NONE, std::memory_order_relaxed);
+        writePos.store(from, std::memory_order_release);
+        return static_cast<size_t>(pos - from);
+    }
+
+    // Producer: the track ends after the frames written so far.
+    // Returns the end position, which the consumer reports back via reachedEnd().
+    uint64_t markEnd() {
+        uint64_t pos = writePos.load(std::memory_order_relaxed);
+        endAt.store(pos, std::memory_order_release);
+        return pos;
+    }
+
+    // Consumer: copies up to count frames out, returns how many were available.
+    // Sets flushed when stale frames were skipped first.
+    size_t read(float* out, size_t count, bool& flushed) {
+        // writePos first: the producer stores flushTo before publishing new frames
+        uint64_t end = writePos.load(std::memory_order_acquire);
+        uint64_t skipTo = flushTo.load(std::memory_order_acquire);
+        uint64_t pos = readPos.load(std::memory_order_relaxed);
+
+        flushed = skipTo > pos;
+        if (flushed) pos = skipTo;
+
+        count = static_cast<size_t>(std::min<uint64_t>(count, end - pos));
+        size_t offset = static_cast<size_t>(pos & frameMask);
+        size_t first = std::min(count, capacity() - offset);
+        std::memcpy(out, &data[offset * channels], first * channels * sizeof(float));
+        std::memcpy(out + first * channels, &data[0], (count - first) * channels * sizeof(float));
+
+        readPos.store(pos + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: end position of the track if playback has got there, else NONE
+    uint64_t reachedEnd() const {
+        uint64_t end = endAt.load(std::memory_order_acquire);
+        return end != NONE && readPos.load(std::memory_order_relaxed) >= end ? end : NONE;
+    }
+
+private:
+    std::vector<float> data;
+    uint32_t channels;
+    size_t frameMask = 0;
+    std::atomic<uint64_t> writePos{0};
+    std::atomic<uint64_t> readPos{0};
+    std::atomic<uint64_t> flushTo{0};
+    std::atomic<uint64_t> endAt{NONE};
+};
+
+} // namespace Audio
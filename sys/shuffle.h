@@ -0,0 +1,507 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include "library.h"
+#include "config.h"
+
+// Play order for folders (library.shuffle).
+//
+// "random" is a plain shuffle. "weighted" plays a folder as an endless
+// rotation instead (see Rotation below).
+//
+// "smart" keeps tracks by the same artist or from the same album apart.
+// Tracks are grouped by artist and, inside an artist, by album. An artist
+// with m of the tracks gets the positions (i + offset) / m, i = 0..m-1, with
+// a random offset per artist and a little jitter per track, so its tracks
+// are spread evenly over the whole order; its albums share out its slots
+// the same way. A heap of artists keyed by their next position hands out
+// the order one track at a time: the first track is known after a single
+// grouping pass, and each further one costs O(log artists + log albums).
+//
+// On top of that no artist or album repeats within library.shuffle_spacing
+// tracks: a track that would is held back and played as soon as it fits.
+// An artist or album with too big a share for that gets the spacing its
+// share allows (every third track for a third of the folder). When nothing
+// fits, the held track whose artist and album were heard longest ago plays.
+//
+// Artist and album come from the tags in the library index, as far as the
+// index has them; files aren't opened. Without tags, a file name like
+// "Artist - Title" still gives the artist.
+namespace Shuffle {
+
+inline std::string normalise(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos) return "";
+    size_t end = text.find_last_not_of(" \t");
+    std::string out = text.substr(start, end - start + 1);
+    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    return out;
+}
+
+// Artist and album of a file, normalised; empty when unknown
+inline void identify(const std::string& path, std::string& artist, std::string& album) {
+    artist.clear();
+    album.clear();
+    if (auto info = Library::index().peek(path)) {
+        artist = normalise(info->tags.artist);
+        album = normalise(info->tags.album);
+    }
+    if (!artist.empty()) return;
+
+    std::string stem = std::filesystem::u8path(path).stem().u8string();
+    size_t dash = stem.find(" - ");
+    if (dash == std::string::npos) return;
+    std::string prefix = normalise(stem.substr(0, dash));
+    // "01 - Intro" is a track number, not an artist
+    bool number = std::all_of(prefix.begin(), prefix.end(), [](unsigned char c) { return std::isdigit(c) || c == '.' || c == ' '; });
+    if (!number) artist = prefix;
+}
+
+class Order {
+public:
+    // Takes the tracks in any order; settings from loud.ini
+    explicit Order(std::vector<std::string> tracks)
+        : paths(std::move(tracks)), rng(std::random_device{}()) {
+        const Config::Settings& settings = Config::current();
+        spacing = settings.shuffleSpacing;
+        smart = settings.shuffle != "random"; // A one-off order of a weighted folder is spaced out too
+        if (smart) {
+            group();
+        } else {
+            std::shuffle(paths.begin(), paths.end(), rng);
+        }
+    }
+
+    // The next track; false once every track has been handed out
+    bool next(std::string& path) {
+        uint32_t track;
+        if (!smart) {
+            if (cursor == paths.size()) return false;
+            track = uint32_t(cursor++);
+        } else {
+            if (!take(track)) return false;
+            artistLast[trackArtist[track]] = emitted;
+            if (trackAlbum[track] != NO_ALBUM) albumLast[trackAlbum[track]] = emitted;
+            emitted++;
+        }
+        path = std::move(paths[track]);
+        return true;
+    }
+
+private:
+    static constexpr uint32_t NO_ALBUM = UINT32_MAX;
+    static constexpr size_t NEVER = SIZE_MAX;
+
+    // A group (artist or album) by the position of its next track
+    struct Slot {
+        double position;
+        uint32_t index;
+        bool operator>(const Slot& other) const { return position > other.position; }
+    };
+
+    // Tracks of one album of one artist (unknown albums of an artist count as
+    // one), shuffled, at members[first .. first + count)
+    struct Album {
+        uint32_t first = 0, count = 0, played = 0;
+        double offset = 0;
+    };
+
+    // Albums of one artist as a heap at albumHeap[first .. first + live)
+    struct Artist {
+        uint32_t first = 0, albums = 0, live = 0;
+        uint32_t count = 0, played = 0;
+        double offset = 0;
+        size_t spacing = 0;
+    };
+
+    std::vector<std::string> paths;
+    std::mt19937_64 rng;
+    size_t spacing = 0;
+    bool smart = false;
+    size_t cursor = 0;   // random: next index into paths
+
+    std::vector<uint32_t> trackArtist, trackAlbum;  // Per track: artist and album name ids
+    std::vector<uint32_t> members;                  // Tracks grouped by album
+    std::vector<Album> albums;
+    std::vector<Artist> artists;
+    std::vector<Slot> albumHeap;                    // Per artist heaps of albums
+    std::vector<Slot> artistHeap;
+    std::vector<size_t> albumSpacing;               // Per album name
+    std::vector<size_t> artistLast, albumLast;      // Where in the order each was last played
+    std::vector<uint32_t> held;                     // Drawn, waiting for enough spacing
+    size_t emitted = 0;
+
+    double jittered(uint32_t index, double offset, uint32_t count) {
+        std::uniform_real_distribution<double> jitter(-0.25, 0.25);
+        return (index + offset + jitter(rng)) / count;
+    }
+
+    void group() {
+        std::unordered_map<std::string, uint32_t> artistIds, albumIds;
+        std::unordered_map<uint64_t, uint32_t> groupIds;  // artist << 32 | album name
+        std::vector<uint32_t> trackGroup(paths.size());
+        std::vector<uint32_t> groupArtist;
+        uint32_t albumNames = 0;
+        trackArtist.resize(paths.size());
+        trackAlbum.resize(paths.size());
+
+        std::string artist, album;
+        for (size_t i = 0; i < paths.size(); i++) {
+            identify(paths[i], artist, album);
+            // Every track of an unknown artist is an artist of its own
+            uint32_t artistId = uint32_t(artists.size());
+            if (!artist.empty()) artistId = artistIds.emplace(artist, artistId).first->second;
+            if (artistId == artists.size()) artists.emplace_back();
+            uint32_t albumId = NO_ALBUM;
+            if (!album.empty()) albumId = albumIds.emplace(album, albumNames).first->second;
+            if (albumId == albumNames) {
+                albumNames++;
+                albumSpacing.push_back(0);
+            }
+            if (albumId != NO_ALBUM) albumSpacing[albumId]++; // Counts tracks for now
+
+            uint64_t key = (uint64_t(artistId) << 32) | albumId;
+            auto [it, added] = groupIds.emplace(key, uint32_t(albums.size()));
+            if (added) {
+                albums.emplace_back();
+                groupArtist.push_back(artistId);
+                artists[artistId].albums++;
+            }
+            trackGroup[i] = it->second;
+            trackArtist[i] = artistId;
+            trackAlbum[i] = albumId;
+            albums[it->second].count++;
+            artists[artistId].count++;
+        }
+
+        // Counting sorts: tracks by album, albums by artist
+        uint32_t next = 0;
+        for (auto& a : albums) {
+            a.first = next;
+            next += a.count;
+        }
+        members.resize(paths.size());
+        std::vector<uint32_t> filled(albums.size(), 0);
+        for (size_t i = 0; i < paths.size(); i++) {
+            Album& a = albums[trackGroup[i]];
+            members[a.first + filled[trackGroup[i]]++] = uint32_t(i);
+        }
+        next = 0;
+        for (auto& a : artists) {
+            a.first = next;
+            next += a.albums;
+        }
+        albumHeap.resize(albums.size());
+
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        for (uint32_t g = 0; g < albums.size(); g++) {
+            Album& a = albums[g];
+            std::shuffle(members.begin() + a.first, members.begin() + a.first + a.count, rng);
+            a.offset = unit(rng);
+            Artist& owner = artists[groupArtist[g]];
+            albumHeap[owner.first + owner.live++] = Slot{ jittered(0, a.offset, a.count), g };
+        }
+        artistHeap.reserve(artists.size());
+        for (uint32_t id = 0; id < artists.size(); id++) {
+            Artist& a = artists[id];
+            std::make_heap(albumHeap.begin() + a.first, albumHeap.begin() + a.first + a.live, std::greater<Slot>());
+            a.offset = unit(rng);
+            artistHeap.push_back(Slot{ jittered(0, a.offset, a.count), id });
+        }
+        std::make_heap(artistHeap.begin(), artistHeap.end(), std::greater<Slot>());
+
+        for (auto& a : artists) a.spacing = spacingFor(a.count);
+        for (auto& albumSize : albumSpacing) albumSize = spacingFor(albumSize);
+        artistLast.assign(artists.size(), NEVER);
+        albumLast.assign(albumNames, NEVER);
+    }
+
+    // library.shuffle_spacing, or as many other tracks as there are per track
+    // of a group this size
+    size_t spacingFor(size_t count) const {
+        return std::min(spacing, (paths.size() - count) / count);
+    }
+
+    // The next track in spread order, ignoring spacing
+    uint32_t draw() {
+        std::pop_heap(artistHeap.begin(), artistHeap.end(), std::greater<Slot>());
+        uint32_t artistId = artistHeap.back().index;
+        artistHeap.pop_back();
+        Artist& artist = artists[artistId];
+
+        auto begin = albumHeap.begin() + artist.first;
+        std::pop_heap(begin, begin + artist.live, std::greater<Slot>());
+        uint32_t albumId = albumHeap[artist.first + artist.live - 1].index;
+        Album& album = albums[albumId];
+        uint32_t track = members[album.first + album.played++];
+        if (album.played < album.count) {
+            albumHeap[artist.first + artist.live - 1] = Slot{ jittered(album.played, album.offset, album.count), albumId };
+            std::push_heap(begin, begin + artist.live, std::greater<Slot>());
+        } else {
+            artist.live--;
+        }
+
+        if (++artist.played < artist.count) {
+            artistHeap.push_back(Slot{ jittered(artist.played, artist.offset, artist.count), artistId });
+            std::push_heap(artistHeap.begin(), artistHeap.end(), std::greater<Slot>());
+        }
+        return track;
+    }
+
+    bool heardWithin(size_t last, size_t distance) const {
+        return last != NEVER && emitted - last <= distance;
+    }
+
+    bool fits(uint32_t track) const {
+        const Artist& artist = artists[trackArtist[track]];
+        if (heardWithin(artistLast[trackArtist[track]], artist.spacing)) return false;
+        uint32_t album = trackAlbum[track];
+        return album == NO_ALBUM || !heardWithin(albumLast[album], albumSpacing[album]);
+    }
+
+    // Most recent play of the track's artist or album, NEVER if neither
+    size_t lastHeard(uint32_t track) const {
+        size_t last = artistLast[trackArtist[track]];
+        if (trackAlbum[track] != NO_ALBUM) {
+            size_t albumPlayed = albumLast[trackAlbum[track]];
+            if (last == NEVER || (albumPlayed != NEVER && albumPlayed > last)) last = albumPlayed;
+        }
+        return last;
+    }
+
+    bool take(uint32_t& track) {
+        for (size_t i = 0; i < held.size(); i++) {
+            if (fits(held[i])) {
+                track = held[i];
+                held.erase(held.begin() + i);
+                return true;
+            }
+        }
+        // Holding more than a few spacings' worth means the rest can't fit.
+        // Even then one more is drawn, so the fallback below can pick a fresh
+        // artist rather than repeat the one just heard.
+        size_t holdLimit = std::max<size_t>(16, spacing * 4);
+        while (!artistHeap.empty()) {
+            uint32_t drawn = draw();
+            if (fits(drawn)) {
+                track = drawn;
+                return true;
+            }
+            held.push_back(drawn);
+            if (held.size() > holdLimit) break;
+        }
+        if (held.empty()) return false;
+
+        size_t best = 0;
+        for (size_t i = 1; i < held.size(); i++) {
+            if (lastHeard(held[i]) + 1 < lastHeard(held[best]) + 1) best = i; // NEVER + 1 wraps to 0
+        }
+        track = held[best];
+        held.erase(held.begin() + best);
+        return true;
+    }
+};
+
+// The whole order at once
+inline void arrange(std::vector<std::string>& paths) {
+    Order order(std::move(paths));
+    paths.clear();
+    std::string path;
+    while (order.next(path)) paths.push_back(std::move(path));
+}
+
+// Integer weights with O(log n) update, append and weighted pick (a Fenwick
+// tree of partial sums). Integers, so the sums never drift however many
+// updates there are.
+class Fenwick {
+public:
+    size_t size() const { return weights.size(); }
+    uint64_t total() const { return sum; }
+    uint64_t weight(size_t index) const { return weights[index]; }
+
+    void append(uint64_t weight) {
+        size_t node = weights.size() + 1;
+        // The new node covers (node - lowbit(node), node]
+        tree.push_back(weight + prefix(node - 1) - prefix(node - (node & (~node + 1))));
+        weights.push_back(weight);
+        sum += weight;
+    }
+
+    void set(size_t index, uint64_t weight) {
+        uint64_t delta = weight - weights[index]; // Wraps for decreases, and wraps back when added
+        weights[index] = weight;
+        sum += delta;
+        for (size_t node = index + 1; node < tree.size(); node += node & (~node + 1)) tree[node] += delta;
+    }
+
+    // The index whose weight covers target (0 <= target < total())
+    size_t find(uint64_t target) const {
+        size_t step = 1;
+        while (step * 2 <= weights.size()) step *= 2;
+        size_t node = 0;
+        for (; step > 0; step /= 2) {
+            if (node + step <= weights.size() && tree[node + step] <= target) {
+                node += step;
+                target -= tree[node];
+            }
+        }
+        return node;
+    }
+
+private:
+    std::vector<uint64_t> tree{0};  // 1-based
+    std::vector<uint64_t> weights;
+    uint64_t sum = 0;
+
+    uint64_t prefix(size_t count) const {
+        uint64_t total = 0;
+        for (; count > 0; count -= count & (~count + 1)) total += tree[count];
+        return total;
+    }
+};
+
+// Relative chance of a track in a weighted rotation, the product of:
+//   rating     0.25 (one star) .. 1 (three stars, or unrated) .. 1.75 (five)
+//   freshness  1 / sqrt(1 + plays), so rarely played tracks come up more
+//   recovery   (1 - exp(-age / recent))^2: next to none for a while after a
+//              play, 40% after library.recent_hours, 90% after three times
+inline double weightFor(float rating, uint32_t plays, double age, double recent) {
+    double ratingFactor = rating >= 0 ? 0.25 + 1.5 * rating : 1.0;
+    double freshness = 1.0 / std::sqrt(1.0 + plays);
+    double recovery = age > 0 ? 1.0 - std::exp(-age / recent) : 0.0;
+    return ratingFactor * freshness * recovery * recovery;
+}
+
+// A folder played for as long as it takes (library.shuffle = weighted): each
+// pick is random, weighted by rating and play statistics (see weightFor), and
+// tracks can come again once they have recovered. Picks and plays update one
+// weight each, in O(log n). A track recovering from a play is re-weighed
+// each time its age has grown by REFRESH_GROWTH, about 45 times until it
+// has recovered, from a heap of due times: O(log n) per pick amortised.
+// Ratings and play counts come from the library index, as far as it has them.
+class Rotation {
+public:
+    explicit Rotation(const std::vector<std::string>& paths)
+        : rng(std::random_device{}()), recent(Config::current().recentHours * 3600.0) {
+        add(paths);
+    }
+
+    // More tracks (ones already in the rotation are skipped)
+    void add(const std::vector<std::string>& paths, int64_t now = Library::unixSeconds()) {
+        for (const auto& path : paths) {
+            uint32_t index = uint32_t(tracks.size());
+            if (!byPath.emplace(path, index).second) continue;
+            Track track;
+            track.path = path;
+            if (auto info = Library::index().peek(path)) {
+                track.rating = info->tags.rating;
+                track.plays = info->plays;
+                track.lastPlayed = info->lastPlayed;
+            }
+            tracks.push_back(track);
+            weights.append(0);
+            update(index, now);
+        }
+    }
+
+    size_t size() const { return tracks.size(); }
+
+    // The next track, counted as played from now on so it doesn't come up
+    // again straight away. Empty if there are no tracks.
+    std::string pick(int64_t now = Library::unixSeconds()) {
+        refresh(now);
+        if (tracks.empty()) return "";
+        // Never the last track again while there are others, even when every
+        // weight is at its floor (a small folder skipped through quickly)
+        bool excluding = latest != NONE && tracks.size() > 1;
+        if (excluding) weights.set(latest, 0);
+        uint32_t index = uint32_t(weights.find(std::uniform_int_distribution<uint64_t>(0, weights.total() - 1)(rng)));
+        if (excluding) update(latest, now);
+        tracks[index].lastPlayed = now;
+        latest = index;
+        update(index, now);
+        return tracks[index].path;
+    }
+
+    // A track started playing (picked from here or not)
+    void played(const std::string& path, int64_t now = Library::unixSeconds()) {
+        auto it = byPath.find(path);
+        if (it == byPath.end()) return;
+        Track& track = tracks[it->second];
+        track.plays++;
+        track.lastPlayed = now;
+        latest = it->second;
+        update(it->second, now);
+    }
+
+private:
+    // Weights in fixed point, at least 1 so every track keeps some chance
+    static constexpr double WEIGHT_UNIT = 1 << 20;
+    // After this many recent_hours a track counts as recovered (99%)
+    static constexpr double RECOVERED_AFTER = 5;
+    // Re-weigh a recovering track once its age has grown this much (plus a
+    // hundredth of recent_hours), so a weight is never more than ~25% low
+    static constexpr double REFRESH_GROWTH = 1.15;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Track {
+        std::string path;
+        float rating = -1;
+        uint32_t plays = 0;
+        int64_t lastPlayed = 0;
+        int64_t refreshAt = 0;  // Due in the refresh heap, 0 = recovered
+    };
+
+    // Refresh heap entry; stale once the track's refreshAt has moved on
+    struct Due {
+        int64_t at;
+        uint32_t index;
+        bool operator>(const Due& other) const { return at > other.at; }
+    };
+
+    std::vector<Track> tracks;
+    std::unordered_map<std::string, uint32_t> byPath;
+    Fenwick weights;
+    std::vector<Due> due;  // Min-heap by time
+    uint32_t latest = NONE;  // Last picked or played
+    std::mt19937_64 rng;
+    double recent;  // Seconds
+
+    // Recompute a weight, and when the track is still recovering from a
+    // play, when to do it next
+    void update(uint32_t index, int64_t now) {
+        Track& track = tracks[index];
+        double age = track.lastPlayed > 0 ? double(now - track.lastPlayed) : recent * RECOVERED_AFTER;
+        double weight = weightFor(track.rating, track.plays, age, recent);
+        weights.set(index, std::max<uint64_t>(1, static_cast<uint64_t>(weight * WEIGHT_UNIT)));
+
+        if (age >= recent * RECOVERED_AFTER) {
+            track.refreshAt = 0;
+            return;
+        }
+        double nextAge = std::max(age, 0.0) * REFRESH_GROWTH + recent / 100;
+        track.refreshAt = track.lastPlayed + static_cast<int64_t>(std::ceil(nextAge));
+        due.push_back(Due{ track.refreshAt, index });
+        std::push_heap(due.begin(), due.end(), std::greater<Due>());
+    }
+
+    void refresh(int64_t now) {
+        while (!due.empty() && due.front().at <= now) {
+            Due next = due.front();
+            std::pop_heap(due.begin(), due.end(), std::greater<Due>());
+            due.pop_back();
+            if (tracks[next.index].refreshAt == next.at) update(next.index, now);
+        }
+    }
+};
+
+} // namespace Shuffle
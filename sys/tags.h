@@ -0,0 +1,466 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <memory>
+#include <istream>
+
+#include "zip.h"
+
+// Reads the few tags the daemon cares about (title, artist, album, rating
+// and chapter markers) straight from the file header, without a decoder:
+//   - ID3v2.3/2.4 at the start of the file (MP3, some FLAC): TIT2/TPE1/TALB,
+//     POPM, CHAP frames with their TIT2 sub-frame, ordered by a top-level CTOC
+//   - Vorbis comments in FLAC, Ogg Vorbis and Ogg Opus: TITLE/ARTIST/ALBUM,
+//     FMPS_RATING or RATING, CHAPTERxxx=HH:MM:SS.mmm and CHAPTERxxxNAME
+// The parsers work on untrusted bytes: every length is checked against the
+// buffer, and the memory-based entry points can be fed arbitrary input.
+namespace Tags {
+
+struct Chapter {
+    double start = 0;       // Seconds
+    double end = -1;        // Seconds, -1 if the file doesn't say (runs to the next chapter)
+    std::string title;
+};
+
+struct Info {
+    std::string title;
+    std::string artist;
+    std::string album;
+    float rating = -1;             // 0 (one star) .. 1 (five stars), -1 if unrated
+    std::vector<Chapter> chapters; // Sorted by start
+};
+
+// Tag blocks bigger than this (huge cover art) are skipped rather than read
+constexpr size_t MAX_TAG_BYTES = 16 * 1024 * 1024;
+
+inline uint32_t bigEndian32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+inline uint32_t littleEndian32(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+// ID3v2 sizes use 7 bits per byte
+inline uint32_t syncsafe32(const uint8_t* p) {
+    return (uint32_t(p[0] & 0x7F) << 21) | (uint32_t(p[1] & 0x7F) << 14) | (uint32_t(p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+}
+
+inline void appendUtf8(std::string& out, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        out += static_cast<char>(codepoint);
+    } else if (codepoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codepoint >> 6));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codepoint >> 12));
+        out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codepoint >> 18));
+        out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+}
+
+// First string of an ID3 text field (encoding byte + text) as UTF-8
+inline std::string id3Text(const uint8_t* data, size_t size) {
+    if (size == 0) return "";
+    uint8_t encoding = data[0];
+    data++;
+    size--;
+    std::string out;
+
+    if (encoding == 1 || encoding == 2) {
+        // UTF-16 with a byte order mark, or UTF-16BE
+        bool bigEndian = encoding == 2;
+        size_t i = 0;
+        if (encoding == 1 && size >= 2) {
+            if (data[0] == 0xFE && data[1] == 0xFF) { bigEndian = true; i = 2; }
+            else if (data[0] == 0xFF && data[1] == 0xFE) { i = 2; }
+        }
+        for (; i + 1 < size; i += 2) {
+            uint32_t unit = bigEndian ? (data[i] << 8) | data[i + 1] : data[i] | (data[i + 1] << 8);
+            if (unit == 0) break;
+            if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < size) {
+                uint32_t low = bigEndian ? (data[i + 2] << 8) | data[i + 3] : data[i + 2] | (data[i + 3] << 8);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    appendUtf8(out, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+                    i += 2;
+                    continue;
+                }
+            }
+            appendUtf8(out, unit >= 0xD800 && unit < 0xE000 ? 0xFFFD : unit);
+        }
+    } else {
+        for (size_t i = 0; i < size && data[i] != 0; i++) {
+            if (encoding == 3) out += static_cast<char>(data[i]); // Already UTF-8
+            else appendUtf8(out, data[i]);                         // ISO-8859-1
+        }
+    }
+    return out;
+}
+
+// Undo ID3 unsynchronisation (0xFF 0x00 -> 0xFF)
+inline std::vector<uint8_t> id3Resync(const uint8_t* data, size_t size) {
+    std::vector<uint8_t> out;
+    out.reserve(size);
+    for (size_t i = 0; i < size; i++) {
+        out.push_back(data[i]);
+        if (data[i] == 0xFF && i + 1 < size && data[i + 1] == 0x00) i++;
+    }
+    return out;
+}
+
+// A CHAP or CTOC frame on its way to the chapter list
+struct Id3Element {
+    std::string id;
+    Chapter chapter;
+    bool topLevel = false;
+    std::vector<std::string> children; // CTOC only
+};
+
+// Frames of a tag (or the sub-frames of a CHAP/CTOC) in data
+inline void parseId3Frames(const uint8_t* data, size_t size, int version, Info& info,
+                           std::vector<Id3Element>* chapters, std::vector<Id3Element>* tocs,
+                           Chapter* parent, int depth) {
+    size_t pos = 0;
+    while (pos + 10 <= size) {
+        const uint8_t* header = data + pos;
+        if (header[0] == 0) break; // Padding
+        std::string id(reinterpret_cast<const char*>(header), 4);
+        uint32_t frameSize = version >= 4 ? syncsafe32(header + 4) : bigEndian32(header + 4);
+        uint16_t flags = static_cast<uint16_t>((header[8] << 8) | header[9]);
+        pos += 10;
+        if (frameSize > size - pos) break;
+
+        const uint8_t* body = data + pos;
+        size_t bodySize = frameSize;
+        pos += frameSize;
+
+        // Compressed or encrypted frames aren't worth the trouble here
+        bool skip = version >= 4 ? (flags & 0x000C) != 0 : (flags & 0x00C0) != 0;
+        if (skip) continue;
+
+        std::vector<uint8_t> resynced;
+        if (version >= 4) {
+            if (flags & 0x0001) { // Data length indicator
+                if (bodySize < 4) continue;
+                body += 4;
+                bodySize -= 4;
+            }
+            if (flags & 0x0002) {
+                resynced = id3Resync(body, bodySize);
+                body = resynced.data();
+                bodySize = resynced.size();
+            }
+        }
+
+        if (id == "TIT2") {
+            std::string title = id3Text(body, bodySize);
+            if (parent) parent->title = title;
+            else info.title = title;
+        } else if (parent) {
+            continue; // Sub-frames only carry chapter titles
+        } else if (id == "TPE1") {
+            info.artist = id3Text(body, bodySize);
+        } else if (id == "TALB") {
+            info.album = id3Text(body, bodySize);
+        } else if (id == "POPM" && info.rating < 0) {
+            // Email of the rating player, then 1..255 (0 = not rated)
+            const uint8_t* end = static_cast<const uint8_t*>(std::memchr(body, 0, bodySize));
+            if (!end || end + 1 >= body + bodySize || end[1] == 0) continue;
+            info.rating = (end[1] - 1) / 254.0f;
+        } else if ((id == "CHAP" || id == "CTOC") && depth == 0 && chapters && tocs) {
+            const uint8_t* end = static_cast<const uint8_t*>(std::memchr(body, 0, bodySize));
+            if (!end) continue;
+            Id3Element element;
+            element.id.assign(reinterpret_cast<const char*>(body), end - body);
+            size_t offset = (end - body) + 1;
+
+            if (id == "CHAP") {
+                if (bodySize - offset < 16) continue;
+                element.chapter.start = bigEndian32(body + offset) / 1000.0;
+                uint32_t endMs = bigEndian32(body + offset + 4);
+                element.chapter.end = endMs == 0xFFFFFFFF ? -1 : endMs / 1000.0;
+                offset += 16;
+                parseId3Frames(body + offset, bodySize - offset, version, info, nullptr, nullptr, &element.chapter, depth + 1);
+                chapters->push_back(element);
+            } else {
+                if (bodySize - offset < 2) continue;
+                element.topLevel = (body[offset] & 0x02) != 0;
+                uint8_t count = body[offset + 1];
+                offset += 2;
+                for (int i = 0; i < count && offset < bodySize; i++) {
+                    const uint8_t* child = body + offset;
+                    const uint8_t* childEnd = static_cast<const uint8_t*>(std::memchr(child, 0, bodySize - offset));
+                    if (!childEnd) break;
+                    element.children.emplace_back(reinterpret_cast<const char*>(child), childEnd - child);
+                    offset += (childEnd - child) + 1;
+                }
+                tocs->push_back(element);
+            }
+        }
+    }
+}
+
+// ID3v2 tag at the start of data; size is how much of it is available.
+// False if there's no (supported) tag.
+inline bool parseId3(const uint8_t* data, size_t size, Info& info) {
+    if (size < 10 || data[0] != 'I' || data[1] != 'D' || data[2] != '3') return false;
+    int version = data[3];
+    if (version < 3 || version > 4) return false;
+    uint8_t flags = data[5];
+    size_t tagSize = std::min<size_t>(syncsafe32(data + 6), size - 10);
+    const uint8_t* body = data + 10;
+
+    std::vector<uint8_t> resynced;
+    if (version == 3 && (flags & 0x80)) {
+        resynced = id3Resync(body, tagSize);
+        body = resynced.data();
+        tagSize = resynced.size();
+    }
+
+    if (flags & 0x40) { // Extended header
+        if (tagSize < 4) return false;
+        size_t extended = version >= 4 ? syncsafe32(body) : bigEndian32(body) + 4;
+        if (extended > tagSize) return false;
+        body += extended;
+        tagSize -= extended;
+    }
+
+    std::vector<Id3Element> chapters, tocs;
+    parseId3Frames(body, tagSize, version, info, &chapters, &tocs, nullptr, 0);
+
+    // The top-level table of contents gives the order, otherwise start times do
+    const Id3Element* toc = nullptr;
+    for (const auto& element : tocs) {
+        if (element.topLevel) { toc = &element; break; }
+    }
+    if (toc) {
+        for (const auto& child : toc->children) {
+            for (const auto& chapter : chapters) {
+                if (chapter.id == child) { info.chapters.push_back(chapter.chapter); break; }
+            }
+        }
+    }
+    if (info.chapters.empty()) {
+        for (const auto& chapter : chapters) info.chapters.push_back(chapter.chapter);
+    }
+    std::stable_sort(info.chapters.begin(), info.chapters.end(),
+                     [](const Chapter& a, const Chapter& b) { return a.start < b.start; });
+    return true;
+}
+
+// HH:MM:SS.mmm (hours and minutes optional); false if malformed
+inline bool parseChapterTime(const std::string& text, double& seconds) {
+    seconds = 0;
+    size_t start = 0;
+    int fields = 0;
+    while (start <= text.size() && fields < 3) {
+        size_t colon = text.find(':', start);
+        std::string field = text.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+        if (field.empty() || field.find_first_not_of("0123456789.") != std::string::npos) return false;
+        seconds = seconds * 60 + std::strtod(field.c_str(), nullptr);
+        fields++;
+        if (colon == std::string::npos) return true;
+        start = colon + 1;
+    }
+    return false;
+}
+
+// FMPS_RATING is 0..1; RATING is 1..5 stars or 0..100 depending on the
+// tagger (0 means unrated). Bad values leave rating alone.
+inline void parseRating(const std::string& text, bool fraction, float& rating) {
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || !(value > 0)) return;
+    if (fraction) value = std::min(value, 1.0);
+    else if (value <= 5) value = (value - 1) / 4;
+    else value = std::min(value, 100.0) / 100;
+    rating = static_cast<float>(value);
+}
+
+// Vorbis comment block (vendor string, then KEY=value pairs), as found in
+// FLAC metadata and after the Vorbis/Opus comment packet magic
+inline void parseVorbisComments(const uint8_t* data, size_t size, Info& info) {
+    if (size < 8) return;
+    uint32_t vendorLength = littleEndian32(data);
+    if (vendorLength > size - 8) return;
+    size_t pos = 4 + vendorLength;
+    uint32_t count = littleEndian32(data + pos);
+    pos += 4;
+
+    // CHAPTERxxx and CHAPTERxxxNAME can come in any order
+    std::vector<std::pair<std::string, Chapter>> chapters;
+    auto chapterFor = [&](const std::string& number) -> Chapter& {
+        for (auto& entry : chapters) {
+            if (entry.first == number) return entry.second;
+        }
+        chapters.emplace_back(number, Chapter{-1, -1, ""});
+        return chapters.back().second;
+    };
+
+    for (uint32_t i = 0; i < count && pos + 4 <= size; i++) {
+        uint32_t length = littleEndian32(data + pos);
+        pos += 4;
+        if (length > size - pos) break;
+        std::string comment(reinterpret_cast<const char*>(data + pos), length);
+        pos += length;
+
+        size_t equals = comment.find('=');
+        if (equals == std::string::npos) continue;
+        std::string key = comment.substr(0, equals);
+        std::string value = comment.substr(equals + 1);
+        std::transform(key.begin(), key.end(), key.begin(), ::toupper);
+
+        if (key == "TITLE") info.title = value;
+        else if (key == "ARTIST") info.artist = value;
+        else if (key == "ALBUM") info.album = value;
+        else if (key == "FMPS_RATING" || (key == "RATING" && info.rating < 0)) {
+            parseRating(value, key == "FMPS_RATING", info.rating);
+        }
+        else if (key.rfind("CHAPTER", 0) == 0 && key.size() > 7) {
+            size_t digits = key.find_first_not_of("0123456789", 7);
+            std::string number = key.substr(7, digits == std::string::npos ? std::string::npos : digits - 7);
+            if (number.empty()) continue;
+            if (digits == std::string::npos) {
+                double start;
+                if (parseChapterTime(value, start)) chapterFor(number).start = start;
+            } else if (key.compare(digits, std::string::npos, "NAME") == 0) {
+                chapterFor(number).title = value;
+            }
+        }
+    }
+
+    std::vector<Chapter> found;
+    for (const auto& entry : chapters) {
+        if (entry.second.start >= 0) found.push_back(entry.second);
+    }
+    std::stable_sort(found.begin(), found.end(), [](const Chapter& a, const Chapter& b) { return a.start < b.start; });
+    if (!found.empty()) info.chapters = found;
+}
+
+// FLAC metadata blocks following the "fLaC" marker
+inline void parseFlac(std::istream& in, Info& info) {
+    uint8_t header[4];
+    while (in.read(reinterpret_cast<char*>(header), 4)) {
+        bool last = (header[0] & 0x80) != 0;
+        int type = header[0] & 0x7F;
+        uint32_t length = (uint32_t(header[1]) << 16) | (uint32_t(header[2]) << 8) | header[3];
+        if (type == 4 && length <= MAX_TAG_BYTES) {
+            std::vector<uint8_t> block(length);
+            if (!in.read(reinterpret_cast<char*>(block.data()), length)) return;
+            parseVorbisComments(block.data(), block.size(), info);
+            return;
+        }
+        if (last) return;
+        in.seekg(length, std::ios::cur);
+    }
+}
+
+// Second packet of the first Ogg stream: the Vorbis or Opus comment header
+inline void parseOgg(std::istream& in, Info& info) {
+    std::vector<uint8_t> packet;
+    int packetIndex = 0;
+    uint32_t serial = 0;
+    bool first = true;
+    uint8_t header[27];
+
+    while (in.read(reinterpret_cast<char*>(header), 27)) {
+        if (std::memcmp(header, "OggS", 4) != 0) return;
+        uint32_t pageSerial = littleEndian32(header + 14);
+        if (first) { serial = pageSerial; first = false; }
+        uint8_t segments[255];
+        if (!in.read(reinterpret_cast<char*>(segments), header[26])) return;
+
+        for (int i = 0; i < header[26]; i++) {
+            size_t oldSize = packet.size();
+            if (oldSize + segments[i] > MAX_TAG_BYTES) return;
+            packet.resize(oldSize + segments[i]);
+            if (!in.read(reinterpret_cast<char*>(packet.data() + oldSize), segments[i])) return;
+            if (pageSerial != serial) { packet.resize(oldSize); continue; } // Another stream's page
+
+            if (segments[i] < 255) {
+                // Packet complete
+                if (packetIndex == 1) {
+                    if (packet.size() >= 7 && std::memcmp(packet.data(), "\x03vorbis", 7) == 0) {
+                        parseVorbisComments(packet.data() + 7, packet.size() - 7, info);
+                    } else if (packet.size() >= 8 && std::memcmp(packet.data(), "OpusTags", 8) == 0) {
+                        parseVorbisComments(packet.data() + 8, packet.size() - 8, info);
+                    }
+                    return;
+                }
+                packetIndex++;
+                packet.clear();
+            }
+        }
+    }
+}
+
+// Tags of an open file
+inline bool read(std::istream& in, Info& info) {
+    uint8_t head[10];
+    if (!in.read(reinterpret_cast<char*>(head), 10)) return true;
+
+    if (head[0] == 'I' && head[1] == 'D' && head[2] == '3') {
+        size_t tagSize = syncsafe32(head + 6);
+        if (tagSize <= MAX_TAG_BYTES) {
+            std::vector<uint8_t> tag(10 + tagSize);
+            std::memcpy(tag.data(), head, 10);
+            in.read(reinterpret_cast<char*>(tag.data() + 10), tagSize);
+            tag.resize(10 + static_cast<size_t>(in.gcount()));
+            parseId3(tag.data(), tag.size(), info);
+        }
+
+        // FLAC files sometimes carry an ID3 tag in front of their own metadata
+        in.clear();
+        in.seekg(10 + tagSize + ((head[5] & 0x10) ? 10 : 0));
+        if (!in.read(reinterpret_cast<char*>(head), 4)) return true;
+        if (std::memcmp(head, "fLaC", 4) == 0) parseFlac(in, info);
+        return true;
+    }
+
+    if (std::memcmp(head, "fLaC", 4) == 0) {
+        in.seekg(4);
+        parseFlac(in, info);
+    } else if (std::memcmp(head, "OggS", 4) == 0) {
+        in.seekg(0);
+        parseOgg(in, info);
+    }
+    return true;
+}
+
+// Tags of a file (UTF-8 path, or an entry of a ZIP archive). False if it
+// can't be opened; a file without tags gives an empty Info.
+inline bool read(const std::string& path, Info& info) {
+    if (Zip::isEntryPath(path)) {
+        std::unique_ptr<Zip::Reader> reader = Zip::openEntry(path);
+        if (!reader) return false;
+        Zip::EntryBuf buffer(std::move(reader));
+        std::istream in(&buffer);
+        return read(in, info);
+    }
+
+    std::ifstream in(std::filesystem::u8path(path), std::ios::binary);
+    if (!in) return false;
+    return read(in, info);
+}
+
+// Chapter playing at seconds, -1 before the first one (or without chapters)
+inline int chapterAt(const std::vector<Chapter>& chapters, double seconds) {
+    auto it = std::upper_bound(chapters.begin(), chapters.end(), seconds,
+                               [](double position, const Chapter& chapter) { return position < chapter.start; });
+    return static_cast<int>(it - chapters.begin()) - 1;
+}
+
+} // namespace Tags
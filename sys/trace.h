@@ -0,0 +1,184 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAS_TSC 1
+#endif
+
+// Low-overhead scoped tracing. Each thread records complete events into its
+// own fixed-size ring (no locks, no allocation after the first event), and a
+// dump merges the recent part of every ring into Chrome trace_event JSON that
+// chrome://tracing or ui.perfetto.dev can open.
+//
+// Build with -DLOUD_NO_TRACE to compile every TRACE_SCOPE out entirely.
+namespace Trace {
+
+struct Event {
+    const char* name;       // Must be a string literal (stored by pointer)
+    uint64_t start;         // Clock ticks, see ticks()
+    uint64_t duration;      // Clock ticks
+};
+
+inline uint64_t nanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Raw timestamp for events: the TSC where available (a few ns to read),
+// otherwise the steady clock. Converted to real time only when exporting.
+inline uint64_t ticks() {
+#ifdef TRACE_HAS_TSC
+    return __rdtsc();
+#else
+    return nanoseconds();
+#endif
+}
+
+class ThreadBuffer {
+public:
+    static constexpr size_t SIZE = 1 << 14; // Events kept per thread
+
+    ThreadBuffer(uint32_t id) : id(id) {}
+
+    // Owner thread only
+    void record(const char* name, uint64_t start, uint64_t duration) {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        events[index & (SIZE - 1)] = Event{name, start, duration};
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    // Copy out the events still in the ring; entries that the owner
+    // overwrote while we were copying are discarded
+    std::vector<Event> snapshot() const {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > SIZE ? end - SIZE : 0;
+
+        std::vector<Event> copy;
+        copy.reserve(static_cast<size_t>(end - begin));
+        for (uint64_t i = begin; i < end; ++i) copy.push_back(events[i & (SIZE - 1)]);
+
+        uint64_t after = head.load(std::memory_order_acquire);
+        uint64_t firstValid = after > SIZE ? after - SIZE : 0;
+        if (firstValid > begin) {
+            copy.erase(copy.begin(), copy.begin() + static_cast<size_t>(std::min(firstValid - begin, uint64_t(copy.size()))));
+        }
+        return copy;
+    }
+
+    uint32_t id;
+    std::string name;
+
+private:
+    Event events[SIZE];
+    std::atomic<uint64_t> head{0};
+};
+
+class Registry {
+public:
+    // Buffer of the calling thread, registered on first use
+    ThreadBuffer& local() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::scoped_lock lock(mutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>(static_cast<uint32_t>(buffers.size() + 1)));
+            buffer = buffers.back().get();
+        }
+        return *buffer;
+    }
+
+    // Name shown for the calling thread in the trace viewer
+    void setThreadName(const std::string& name) {
+        ThreadBuffer& buffer = local();
+        std::scoped_lock lock(mutex);
+        buffer.name = name;
+    }
+
+    // Chrome trace_event JSON of everything recorded in the last `seconds`
+    std::string exportChrome(double seconds) {
+        // Map ticks to nanoseconds using the span since the registry was created
+        uint64_t endTicks = ticks();
+        uint64_t endNanos = nanoseconds();
+        double nanosPerTick = endTicks > originTicks ? double(endNanos - originNanos) / double(endTicks - originTicks) : 1.0;
+
+        uint64_t window = static_cast<uint64_t>(seconds * 1e9 / nanosPerTick);
+        uint64_t cutoff = endTicks > window ? endTicks - window : 0;
+
+        std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        char line[512];
+
+        std::scoped_lock lock(mutex);
+        for (const auto& buffer : buffers) {
+            if (!buffer->name.empty()) {
+                std::snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                              first ? "" : ",", buffer->id, buffer->name.c_str());
+                json += line;
+                first = false;
+            }
+
+            for (const Event& event : buffer->snapshot()) {
+                if (event.start < cutoff) continue;
+                double startMicros = (originNanos + (double(event.start) - double(originTicks)) * nanosPerTick) / 1000.0;
+                std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                              first ? "" : ",", event.name, buffer->id, startMicros, event.duration * nanosPerTick / 1000.0);
+                json += line;
+                first = false;
+            }
+        }
+
+        json += "]}";
+        return json;
+    }
+
+private:
+    uint64_t originTicks = ticks();
+    uint64_t originNanos = nanoseconds();
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers; // Never freed, so exited threads stay in the dump
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// Records one complete event covering its own lifetime
+class Scope {
+public:
+    explicit Scope(const char* name) : name(name), start(ticks()) {}
+
+    ~Scope() {
+        registry().local().record(name, start, ticks() - start);
+    }
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+} // namespace Trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef LOUD_NO_TRACE
+    #define TRACE_SCOPE(name) do {} while (0)
+    #define TRACE_THREAD_NAME(name) do {} while (0)
+#else
+    #define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+    #define TRACE_THREAD_NAME(name) Trace::registry().setThreadName(name)
+#endif
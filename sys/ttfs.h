@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Time-to-first-sound instrumentation. A run is driven by ttfs.exe, which
+// spawns play.exe with LOUD_TTFS set to its spawn time; play.exe forwards its
+// own timestamps in a "ttfs:" command just before "play:", the daemon adds
+// its marks, and the Player stamps the first callback that isn't silent.
+// Finished runs are appended to %TEMP%/loud-ttfs.csv for the driver to read.
+namespace Bench {
+
+// Microseconds on a clock shared by every process on the machine
+inline uint64_t wallMicros() {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    return ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 10;
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Phases of a run, in the order they happen
+enum Mark {
+    Spawn,          // Driver is about to create play.exe
+    ClientStart,    // play.exe entered WinMain
+    DaemonReady,    // play.exe found (or started) loud.exe
+    Sent,           // play.exe is sending the command
+    Dispatch,       // Daemon handler started
+    FsChecked,      // Daemon finished its filesystem checks
+    DecoderReady,   // Player returned from opening the track
+    FirstSound,     // First callback with non-silent output
+    MarkCount
+};
+
+inline const char* markName(int mark) {
+    static const char* names[MarkCount] = {
+        "spawn", "client_start", "daemon_ready", "sent", "dispatch", "fs_checked", "decoder_ready", "first_sound"
+    };
+    return mark >= 0 && mark < MarkCount ? names[mark] : "unknown";
+}
+
+// Environment variable the driver sets on play.exe (value: spawn time)
+const char* const SPAWN_ENV = "LOUD_TTFS";
+
+inline std::filesystem::path resultsFile() {
+    return std::filesystem::temp_directory_path() / "loud-ttfs.csv";
+}
+
+// Daemon-side record of the run in progress
+class Run {
+public:
+    static constexpr uint64_t TIMEOUT_MICROS = 10000000;
+
+    // Start a run from the client's "<spawn>,<clientStart>,<daemonReady>,<sent>"
+    bool arm(const std::string& clientMarks) {
+        for (auto& m : marks) m = 0;
+
+        std::stringstream ss(clientMarks);
+        std::string field;
+        for (int i = Spawn; i <= Sent; ++i) {
+            if (!std::getline(ss, field, ',')) return false;
+            marks[i] = std::strtoull(field.c_str(), nullptr, 10);
+        }
+
+        armedAt = wallMicros();
+        armed = true;
+        return true;
+    }
+
+    bool isArmed() const { return armed; }
+
+    void mark(Mark m, uint64_t at = 0) {
+        if (armed && marks[m] == 0) marks[m] = at ? at : wallMicros();
+    }
+
+    bool timedOut() const {
+        return armed && wallMicros() - armedAt > TIMEOUT_MICROS;
+    }
+
+    // Append the run to the results file (missing marks stay 0) and disarm
+    void finish() {
+        namespace fs = std::filesystem;
+        bool exists = fs::exists(resultsFile());
+        std::ofstream out(resultsFile(), std::ios::app);
+        if (!exists) {
+            for (int i = 0; i < MarkCount; ++i) out << (i ? "," : "") << markName(i);
+            out << "\n";
+        }
+        for (int i = 0; i < MarkCount; ++i) out << (i ? "," : "") << marks[i];
+        out << "\n";
+        armed = false;
+    }
+
+private:
+    uint64_t marks[MarkCount] = {};
+    uint64_t armedAt = 0;
+    bool armed = false;
+};
+
+} // namespace Bench
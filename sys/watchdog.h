@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include "audio.h"
+#include "trace.h"
+#include "metrics.h"
+
+namespace Audio {
+
+// Watches the Players' heartbeats from its own thread (one thread for all
+// zones of the daemon). When a device callback stops coming back, or a decode
+// thread is stuck long enough to run the ring dry, it logs which phase each
+// was in, writes the recent trace next to the temp files and can optionally
+// restart the output device.
+class Watchdog {
+public:
+    struct Options {
+        std::chrono::milliseconds stallThreshold{500};  // No callback for this long
+        std::chrono::milliseconds decoderThreshold{200}; // One decode or track change taking this long
+        std::chrono::milliseconds pollInterval{100};
+        double traceSeconds = 2.0;                       // Trace window saved with each diagnostic
+        bool restartDevice = false;
+    };
+
+    Watchdog(Player& player, Options options) : Watchdog(std::vector<std::pair<std::string, Player*>>{ { "", &player } }, options) {}
+
+    // Players by name, as reports should call them ("" for a lone player)
+    Watchdog(const std::vector<std::pair<std::string, Player*>>& players, Options options)
+        : options(options), running(true)
+    {
+        for (const auto& named : players) {
+            Watched watched;
+            watched.name = named.first;
+            watched.player = named.second;
+            watched.lastHeartbeat = watched.player->health().heartbeat;
+            watched.lastBeat = std::chrono::steady_clock::now();
+            this->players.push_back(watched);
+        }
+        worker = std::thread([this]() { this->loop(); });
+    }
+
+    ~Watchdog() {
+        running = false;
+        if (worker.joinable()) worker.join();
+    }
+
+private:
+    struct Watched {
+        std::string name;
+        Player* player = nullptr;
+        uint64_t lastHeartbeat = 0;
+        std::chrono::steady_clock::time_point lastBeat;
+        bool stallReported = false;
+        bool decoderReported = false;
+    };
+
+    void loop() {
+        TRACE_THREAD_NAME("watchdog");
+        while (running) {
+            std::this_thread::sleep_for(options.pollInterval);
+            for (Watched& watched : players) check(watched);
+        }
+    }
+
+    void check(Watched& watched) {
+        Player::Health health = watched.player->health();
+        auto now = std::chrono::steady_clock::now();
+
+        if (health.heartbeat != watched.lastHeartbeat || !health.running) {
+            // Callback is alive (or the device is intentionally stopped)
+            watched.lastHeartbeat = health.heartbeat;
+            watched.lastBeat = now;
+            watched.stallReported = false;
+        } else {
+            uint64_t stalledNanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - watched.lastBeat).count());
+            if (!watched.stallReported && stalledNanos >= nanos(options.stallThreshold)) {
+                report(watched, "audio callback stalled", health, stalledNanos);
+                watched.stallReported = true;
+
+                if (options.restartDevice) watched.player->restartDevice();
+            }
+        }
+
+        // A slow decoder starves the callback long before the callback itself stalls
+        if (health.decoderPhase != Player::Phase::Idle && health.decoderNanos >= nanos(options.decoderThreshold)) {
+            if (!watched.decoderReported) report(watched, "decode thread busy", health, health.decoderNanos);
+            watched.decoderReported = true;
+        } else {
+            watched.decoderReported = false;
+        }
+    }
+
+    void report(const Watched& watched, const char* what, const Player::Health& health, uint64_t forNanos) {
+        static auto& stalls = Metrics::counter("loud_watchdog_stalls_total", "Audio stalls detected by the watchdog");
+        stalls.add();
+
+        std::cerr << "Watchdog: " << (watched.name.empty() ? "" : "zone " + watched.name + ": ") << what << " for " << forNanos / 1000000 << " ms"
+                  << ", phase " << Player::phaseName(health.phase)
+                  << " (" << health.phaseNanos / 1000000 << " ms)"
+                  << ", decoder " << Player::phaseName(health.decoderPhase)
+                  << " (" << health.decoderNanos / 1000000 << " ms)"
+                  << ", buffered " << health.bufferedFrames << " frames"
+                  << ", heartbeat " << health.heartbeat << std::endl;
+
+        try {
+            std::filesystem::path file = std::filesystem::temp_directory_path() / ("loud-stall-" + std::to_string(++reports) + ".json");
+            std::ofstream out(file, std::ios::binary);
+            out << Trace::registry().exportChrome(options.traceSeconds);
+            std::cerr << "Watchdog: trace saved to " << file.string() << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Watchdog: could not save trace: " << e.what() << std::endl;
+        }
+    }
+
+    static uint64_t nanos(std::chrono::milliseconds ms) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ms).count());
+    }
+
+    std::vector<Watched> players;
+    Options options;
+    std::atomic<bool> running;
+    std::thread worker;
+    uint64_t reports = 0;
+};
+
+} // namespace Audio
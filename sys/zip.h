@@ -0,0 +1,866 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <streambuf>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+
+#include "miniaudio_config.h"
+#include "miniaudio.h"
+#include "config.h"
+#include "memory.h"
+
+// Playing straight out of ZIP archives (an album per file is common), with
+// no extraction: "album.zip" works like a folder and "album.zip/03 x.flac"
+// like a file, wherever paths are accepted. Entries may be stored or
+// deflated. Stored ones are read in place; deflated ones are inflated as
+// they are read, through the 32 KB window the format needs and a small
+// input buffer, with a checkpoint of the inflater every CHECKPOINT_BYTES of
+// output so a seek restarts from the nearest one instead of the beginning.
+//
+// Decoders read entries through vfs() (a miniaudio ma_vfs); everything
+// else that needs the bytes (tags) uses EntryBuf. The central directory of
+// an archive is read once and cached until the file changes.
+namespace Zip {
+
+constexpr uint64_t CHECKPOINT_BYTES = 4 * 1024 * 1024;
+constexpr size_t MAX_CACHED_ARCHIVES = 32;
+
+inline uint16_t le16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+inline uint32_t le32(const uint8_t* p) { return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+inline uint64_t le64(const uint8_t* p) { return le32(p) | (static_cast<uint64_t>(le32(p + 4)) << 32); }
+
+inline bool endsWithZip(const std::string& path, size_t end) {
+    static const char extension[] = ".zip";
+    if (end < 4) return false;
+    for (size_t i = 0; i < 4; i++) {
+        if (std::tolower(static_cast<unsigned char>(path[end - 4 + i])) != extension[i]) return false;
+    }
+    return true;
+}
+
+// A ZIP file on disk (what plays like a folder)
+inline bool isArchive(const std::string& path) {
+    std::error_code ec;
+    return endsWithZip(path, path.size()) && std::filesystem::is_regular_file(std::filesystem::u8path(path), ec);
+}
+
+// "dir/album.zip/disc 1/track.flac" -> "dir/album.zip" and "disc 1/track.flac".
+// False unless some ".zip" component of the path is an existing file.
+inline bool split(const std::string& path, std::string& archivePath, std::string& entryName) {
+    for (size_t at = 0; at < path.size(); at++) {
+        if ((path[at] == '/' || path[at] == '\\') && endsWithZip(path, at) && isArchive(path.substr(0, at))) {
+            archivePath = path.substr(0, at);
+            entryName = path.substr(at + 1);
+            std::replace(entryName.begin(), entryName.end(), '\\', '/');
+            return !entryName.empty();
+        }
+    }
+    return false;
+}
+
+inline bool isEntryPath(const std::string& path) {
+    std::string archivePath, entryName;
+    return split(path, archivePath, entryName);
+}
+
+// --- Central directory ---------------------------------------------------
+
+struct Entry {
+    std::string name;            // '/'-separated, as stored
+    uint16_t method = 0;         // 0 stored, 8 deflated
+    uint64_t compressedSize = 0;
+    uint64_t size = 0;
+    uint64_t headerOffset = 0;   // Local header; the data follows it
+};
+
+class Archive {
+public:
+    // Throws if the file isn't a readable ZIP
+    explicit Archive(const std::string& path) : archivePath(path) {
+        std::ifstream in(std::filesystem::u8path(path), std::ios::binary);
+        if (!in) throw std::runtime_error("Can't open " + path);
+        in.seekg(0, std::ios::end);
+        uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+
+        // End of central directory: 22 bytes plus a comment of up to 64 KB
+        size_t tailSize = static_cast<size_t>(std::min<uint64_t>(fileSize, 22 + 65535 + 20));
+        std::vector<uint8_t> tail(tailSize);
+        in.seekg(static_cast<std::streamoff>(fileSize - tailSize));
+        if (!in.read(reinterpret_cast<char*>(tail.data()), tailSize)) throw std::runtime_error("Can't read " + path);
+
+        size_t eocd = std::string::npos;
+        for (size_t i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0;) {
+            if (le32(&tail[i]) == 0x06054b50) {
+                eocd = i;
+                break;
+            }
+        }
+        if (eocd == std::string::npos) throw std::runtime_error("Not a ZIP file: " + path);
+
+        uint64_t count = le16(&tail[eocd + 10]);
+        uint64_t directorySize = le32(&tail[eocd + 12]);
+        uint64_t directoryOffset = le32(&tail[eocd + 16]);
+
+        // ZIP64: the real values are in a record the locator before the end record points to
+        if ((count == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) &&
+            eocd >= 20 && le32(&tail[eocd - 20]) == 0x07064b50) {
+            uint8_t record[56];
+            in.seekg(static_cast<std::streamoff>(le64(&tail[eocd - 20 + 8])));
+            if (in.read(reinterpret_cast<char*>(record), sizeof(record)) && le32(record) == 0x06064b50) {
+                count = le64(record + 32);
+                directorySize = le64(record + 40);
+                directoryOffset = le64(record + 48);
+            }
+        }
+        if (directoryOffset + directorySize > fileSize) throw std::runtime_error("Damaged ZIP file: " + path);
+
+        std::vector<uint8_t> directory(static_cast<size_t>(directorySize));
+        in.seekg(static_cast<std::streamoff>(directoryOffset));
+        if (!in.read(reinterpret_cast<char*>(directory.data()), directory.size())) throw std::runtime_error("Can't read " + path);
+
+        size_t at = 0;
+        for (uint64_t i = 0; i < count && at + 46 <= directory.size(); i++) {
+            const uint8_t* header = &directory[at];
+            if (le32(header) != 0x02014b50) break;
+            uint16_t flags = le16(header + 8);
+            size_t nameLength = le16(header + 28), extraLength = le16(header + 30), commentLength = le16(header + 32);
+            if (at + 46 + nameLength + extraLength > directory.size()) break;
+
+            Entry entry;
+            entry.method = le16(header + 10);
+            entry.compressedSize = le32(header + 20);
+            entry.size = le32(header + 24);
+            entry.headerOffset = le32(header + 42);
+            entry.name.assign(reinterpret_cast<const char*>(header + 46), nameLength);
+
+            // ZIP64 extra field: 64-bit versions of whichever fields overflowed, in this order
+            const uint8_t* extra = header + 46 + nameLength;
+            for (size_t e = 0; e + 4 <= extraLength;) {
+                uint16_t id = le16(extra + e), length = le16(extra + e + 2);
+                if (id == 0x0001) {
+                    const uint8_t* field = extra + e + 4;
+                    const uint8_t* fieldEnd = field + std::min<size_t>(length, extraLength - e - 4);
+                    if (entry.size == 0xFFFFFFFF && field + 8 <= fieldEnd) { entry.size = le64(field); field += 8; }
+                    if (entry.compressedSize == 0xFFFFFFFF && field + 8 <= fieldEnd) { entry.compressedSize = le64(field); field += 8; }
+                    if (entry.headerOffset == 0xFFFFFFFF && field + 8 <= fieldEnd) { entry.headerOffset = le64(field); }
+                }
+                e += 4 + length;
+            }
+            at += 46 + nameLength + extraLength + commentLength;
+
+            // Folders, encrypted entries and methods other than store and deflate are left out
+            bool folder = !entry.name.empty() && entry.name.back() == '/';
+            if (folder || (flags & 1) || (entry.method != 0 && entry.method != 8)) continue;
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    const std::string& path() const { return archivePath; }
+    const std::vector<Entry>& list() const { return entries; }
+
+    // Approximate memory the directory takes
+    size_t bytes() const {
+        size_t total = sizeof(*this) + archivePath.size() + entries.capacity() * sizeof(Entry);
+        for (const auto& entry : entries) total += entry.name.capacity();
+        return total;
+    }
+
+    // Exact name first, then ignoring case (paths typed on Windows)
+    const Entry* find(const std::string& name) const {
+        for (const auto& entry : entries) {
+            if (entry.name == name) return &entry;
+        }
+        for (const auto& entry : entries) {
+            if (entry.name.size() == name.size() &&
+                std::equal(name.begin(), name.end(), entry.name.begin(), [](char a, char b) {
+                    return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+                })) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    std::string archivePath;
+    std::vector<Entry> entries;
+};
+
+// Directories of recently used archives, read once per change of the file.
+// Registered with the memory governor, which can drop the least recently
+// used ones (they are read again on next use).
+class Directories {
+public:
+    Directories() {
+        Memory::governor().add("archives", Memory::PRIORITY_ARCHIVES,
+                               [this]() { return bytes(); },
+                               [this](size_t wanted) { return shrink(wanted); });
+    }
+
+    // Null if the archive can't be read
+    std::shared_ptr<const Archive> open(const std::string& path) {
+        std::error_code ec;
+        std::filesystem::path file = std::filesystem::u8path(path);
+        uint64_t size = std::filesystem::file_size(file, ec);
+        if (ec) return nullptr;
+        int64_t mtime = static_cast<int64_t>(std::filesystem::last_write_time(file, ec).time_since_epoch().count());
+        if (ec) return nullptr;
+
+        std::scoped_lock lock(mutex);
+        auto it = cache.find(path);
+        if (it != cache.end() && it->second.size == size && it->second.mtime == mtime) {
+            it->second.lastUse = ++uses;
+            return it->second.archive;
+        }
+
+        std::shared_ptr<const Archive> archive;
+        try {
+            archive = std::make_shared<const Archive>(path);
+        } catch (const std::exception& e) {
+            std::cerr << "ZIP: " << e.what() << "\n";
+            return nullptr;
+        }
+
+        if (cache.size() >= MAX_CACHED_ARCHIVES && cache.find(path) == cache.end()) dropOldest();
+        cache[path] = Cached{ size, mtime, ++uses, archive };
+        return archive;
+    }
+
+    // Approximate memory the cached directories take
+    size_t bytes() {
+        std::scoped_lock lock(mutex);
+        size_t total = 0;
+        for (const auto& entry : cache) total += entry.first.size() + entry.second.archive->bytes();
+        return total;
+    }
+
+    // Least recently used first, until `wanted` bytes are gone
+    size_t shrink(size_t wanted) {
+        std::scoped_lock lock(mutex);
+        size_t freed = 0;
+        while (freed < wanted && !cache.empty()) freed += dropOldest();
+        return freed;
+    }
+
+private:
+    struct Cached {
+        uint64_t size;
+        int64_t mtime;
+        uint64_t lastUse;
+        std::shared_ptr<const Archive> archive;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Cached> cache;
+    uint64_t uses = 0;
+
+    // Mutex held; returns the bytes released
+    size_t dropOldest() {
+        auto oldest = std::min_element(cache.begin(), cache.end(), [](const auto& a, const auto& b) { return a.second.lastUse < b.second.lastUse; });
+        size_t released = oldest->first.size() + oldest->second.archive->bytes();
+        cache.erase(oldest);
+        return released;
+    }
+};
+
+inline Directories& directories() {
+    static Directories* instance = new Directories(); // Never destroyed: the governor keeps its callbacks
+    return *instance;
+}
+
+// The archive's directory (cached). Null if it can't be read.
+inline std::shared_ptr<const Archive> open(const std::string& path) {
+    return directories().open(path);
+}
+
+// Whether a file, folder or archive entry path is there
+inline bool exists(const std::string& path) {
+    std::string archivePath, entryName;
+    if (!split(path, archivePath, entryName)) {
+        std::error_code ec;
+        return std::filesystem::exists(std::filesystem::u8path(path), ec);
+    }
+    std::shared_ptr<const Archive> archive = open(archivePath);
+    return archive && archive->find(entryName);
+}
+
+// Entry size and the archive's modification time, like Library::stamp for files
+inline bool stamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+    std::string archivePath, entryName;
+    if (!split(path, archivePath, entryName)) return false;
+    std::shared_ptr<const Archive> archive = open(archivePath);
+    const Entry* entry = archive ? archive->find(entryName) : nullptr;
+    if (!entry) return false;
+    std::error_code ec;
+    mtime = static_cast<int64_t>(std::filesystem::last_write_time(std::filesystem::u8path(archivePath), ec).time_since_epoch().count());
+    size = entry->size;
+    return !ec;
+}
+
+// Paths of the audio files in an archive (library.extensions), in name order
+inline std::vector<std::string> audioEntries(const std::string& archivePath) {
+    std::vector<std::string> paths;
+    std::shared_ptr<const Archive> archive = open(archivePath);
+    if (!archive) return paths;
+    for (const auto& entry : archive->list()) {
+        if (Config::current().isAudioFile(entry.name)) paths.push_back(archivePath + "/" + entry.name);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// --- Inflate (RFC 1951) --------------------------------------------------
+
+// Canonical Huffman code. Codes up to FAST_BITS long decode with one table
+// lookup; longer ones (rare) walk the code lengths one bit at a time.
+class HuffmanCode {
+public:
+    static constexpr unsigned FAST_BITS = 10;
+    static constexpr unsigned MAX_BITS = 15;
+
+    // False for an over-subscribed set of lengths
+    bool build(const uint8_t* lengths, size_t count) {
+        std::fill(std::begin(counts), std::end(counts), 0);
+        for (size_t i = 0; i < count; i++) counts[lengths[i]]++;
+        counts[0] = 0;
+
+        int left = 1;
+        for (unsigned len = 1; len <= MAX_BITS; len++) {
+            left <<= 1;
+            left -= counts[len];
+            if (left < 0) return false;
+        }
+
+        uint16_t offsets[MAX_BITS + 2] = {};
+        for (unsigned len = 1; len <= MAX_BITS; len++) offsets[len + 1] = offsets[len] + counts[len];
+        for (size_t i = 0; i < count; i++) {
+            if (lengths[i]) symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+        }
+
+        // Fast table, indexed by the next FAST_BITS input bits (codes are stored bit-reversed)
+        std::fill(std::begin(fast), std::end(fast), 0);
+        uint32_t code = 0;
+        size_t index = 0;
+        for (unsigned len = 1; len <= MAX_BITS; len++) {
+            for (unsigned n = 0; n < counts[len]; n++, index++, code++) {
+                if (len > FAST_BITS) continue;
+                uint32_t reversed = 0;
+                for (unsigned b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+                for (uint32_t r = reversed; r < (1u << FAST_BITS); r += 1u << len) {
+                    fast[r] = static_cast<uint16_t>((symbols[index] << 4) | len);
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    // bits: the next input bits, LSB first (at least MAX_BITS of them).
+    // Returns the symbol and sets length, or -1 for an invalid code.
+    int decode(uint64_t bits, unsigned& length) const {
+        uint16_t entry = fast[bits & ((1u << FAST_BITS) - 1)];
+        if (entry) {
+            length = entry & 15;
+            return entry >> 4;
+        }
+        int code = 0, first = 0, index = 0;
+        for (unsigned len = 1; len <= MAX_BITS; len++) {
+            code |= static_cast<int>((bits >> (len - 1)) & 1);
+            int count = counts[len];
+            if (code - count < first) {
+                length = len;
+                return symbols[index + (code - first)];
+            }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+private:
+    uint16_t counts[MAX_BITS + 1] = {};
+    uint16_t symbols[288] = {};
+    uint16_t fast[1u << FAST_BITS] = {};
+};
+
+// Deflate stream of one entry, inflated as it is read. All its state
+// between symbols fits in a Checkpoint, which is how seeks avoid starting
+// over: restore the nearest one before the target and inflate from there.
+class Inflater {
+public:
+    static constexpr size_t WINDOW = 32768;
+
+    struct Checkpoint {
+        uint64_t output = 0;        // Bytes inflated before it
+        uint64_t bitPosition = 0;   // In the compressed data
+        int mode = 0;
+        bool lastBlock = false;
+        uint32_t storedLeft = 0;
+        uint8_t lengths[320] = {};  // Literal/length then distance code lengths
+        std::vector<uint8_t> window;
+    };
+
+    Inflater(std::ifstream& file, uint64_t dataOffset, uint64_t compressedSize)
+        : file(file), dataOffset(dataOffset), compressedSize(compressedSize), input(INPUT_BYTES), window(WINDOW) {
+        checkpoints.push_back(capture()); // The start, so every seek has somewhere to go back to
+    }
+
+    // Up to `size` bytes of output; fewer only at the end of the stream or
+    // on corrupt data (failed() tells which)
+    size_t read(uint8_t* out, size_t size) {
+        size_t produced = 0;
+        while (produced < size) {
+            if (matchLeft > 0) {
+                size_t count = std::min<size_t>(matchLeft, size - produced);
+                for (size_t i = 0; i < count; i++) emit(out, produced, window[(outputPosition - matchDistance) & (WINDOW - 1)]);
+                matchLeft -= static_cast<uint32_t>(count);
+                continue;
+            }
+
+            if (mode != Done && mode != Failed && outputPosition >= checkpoints.back().output + CHECKPOINT_BYTES) {
+                checkpoints.push_back(capture());
+            }
+
+            if (mode == Header) {
+                if (lastBlock || !readHeader()) {
+                    mode = lastBlock ? Done : Failed;
+                    break;
+                }
+            } else if (mode == Stored) {
+                if (storedLeft == 0) {
+                    mode = Header;
+                    continue;
+                }
+                size_t count = std::min<size_t>(storedLeft, size - produced);
+                for (size_t i = 0; i < count; i++) {
+                    uint8_t byte;
+                    if (!bits(8, byte)) return fail(produced);
+                    emit(out, produced, byte);
+                }
+                storedLeft -= static_cast<uint32_t>(count);
+            } else if (mode == Huffman) {
+                int symbol = decode(literals);
+                if (symbol < 0) return fail(produced);
+                if (symbol < 256) {
+                    emit(out, produced, static_cast<uint8_t>(symbol));
+                } else if (symbol == 256) {
+                    mode = Header;
+                } else {
+                    symbol -= 257;
+                    if (symbol >= 29) return fail(produced);
+                    uint32_t extra;
+                    if (!bits(LENGTH_EXTRA[symbol], extra)) return fail(produced);
+                    uint32_t length = LENGTH_BASE[symbol] + extra;
+
+                    int code = decode(distances);
+                    if (code < 0 || code >= 30 || !bits(DISTANCE_EXTRA[code], extra)) return fail(produced);
+                    uint32_t distance = DISTANCE_BASE[code] + extra;
+                    if (distance > outputPosition) return fail(produced);
+                    matchLeft = length;
+                    matchDistance = distance;
+                }
+            } else {
+                break; // Done or Failed
+            }
+        }
+        return produced;
+    }
+
+    uint64_t position() const { return outputPosition; }
+    bool failed() const { return mode == Failed; }
+
+    // Continue from the last checkpoint at or before `target`, unless
+    // carrying on from here is closer
+    void rewindFor(uint64_t target) {
+        const Checkpoint* best = &checkpoints.front();
+        for (const auto& checkpoint : checkpoints) {
+            if (checkpoint.output <= target) best = &checkpoint;
+        }
+        if (outputPosition <= target && outputPosition >= best->output && mode != Failed) return;
+        restore(*best);
+    }
+
+private:
+    enum Mode { Header, Stored, Huffman, Done, Failed };
+    static constexpr size_t INPUT_BYTES = 64 * 1024;
+
+    static constexpr uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static constexpr uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static constexpr uint16_t DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static constexpr uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    std::ifstream& file;
+    uint64_t dataOffset;
+    uint64_t compressedSize;
+
+    // Compressed input: a buffered window of the file, fed into a bit buffer
+    std::vector<uint8_t> input;
+    uint64_t inputStart = 0;      // Offset (in the compressed data) of input[0]
+    size_t inputLength = 0;
+    size_t inputUsed = 0;
+    uint64_t bitBuffer = 0;
+    unsigned bitCount = 0;
+    unsigned paddingBits = 0;     // Zeros fed in past the end of the data
+
+    // Output history for back-references
+    std::vector<uint8_t> window;
+    uint64_t outputPosition = 0;
+
+    Mode mode = Header;
+    bool lastBlock = false;
+    uint32_t storedLeft = 0;
+    uint32_t matchLeft = 0;
+    uint32_t matchDistance = 0;
+    uint8_t lengths[320] = {};
+    HuffmanCode literals;
+    HuffmanCode distances;
+    std::vector<Checkpoint> checkpoints;
+
+    void emit(uint8_t* out, size_t& produced, uint8_t byte) {
+        out[produced++] = byte;
+        window[outputPosition++ & (WINDOW - 1)] = byte;
+    }
+
+    size_t fail(size_t produced) {
+        mode = Failed;
+        return produced;
+    }
+
+    bool fill() {
+        inputStart += inputLength;
+        inputUsed = 0;
+        inputLength = static_cast<size_t>(std::min<uint64_t>(INPUT_BYTES, compressedSize - std::min(inputStart, compressedSize)));
+        if (inputLength == 0) return false;
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(dataOffset + inputStart));
+        file.read(reinterpret_cast<char*>(input.data()), inputLength);
+        inputLength = static_cast<size_t>(file.gcount());
+        return inputLength > 0;
+    }
+
+    // At least `count` bits in the buffer; zeros past the end, which only
+    // a corrupt stream ever reaches (caught by bits())
+    void need(unsigned count) {
+        while (bitCount < count) {
+            uint64_t byte = 0;
+            if (inputUsed < inputLength || fill()) {
+                byte = input[inputUsed++];
+            } else {
+                paddingBits += 8;
+            }
+            bitBuffer |= byte << bitCount;
+            bitCount += 8;
+        }
+    }
+
+    template <typename T>
+    bool bits(unsigned count, T& value) {
+        need(count);
+        value = static_cast<T>(bitBuffer & ((uint64_t(1) << count) - 1));
+        bitBuffer >>= count;
+        bitCount -= count;
+        return paddingBits <= bitCount;
+    }
+
+    int decode(const HuffmanCode& code) {
+        need(HuffmanCode::MAX_BITS);
+        unsigned length = 0;
+        int symbol = code.decode(bitBuffer, length);
+        if (symbol < 0) return -1;
+        bitBuffer >>= length;
+        bitCount -= length;
+        return paddingBits <= bitCount ? symbol : -1;
+    }
+
+    bool readHeader() {
+        uint32_t last, type;
+        if (!bits(1, last) || !bits(2, type)) return false;
+        lastBlock = last != 0;
+
+        if (type == 0) {
+            // Stored: byte-aligned LEN and its complement, then the bytes
+            uint32_t skip, length, complement;
+            if (!bits(bitCount % 8, skip) || !bits(16, length) || !bits(16, complement) || (length ^ 0xFFFF) != complement) return false;
+            storedLeft = length;
+            mode = Stored;
+            return true;
+        }
+
+        if (type == 1) {
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            std::fill(lengths + 288, lengths + 320, 5);
+        } else if (type == 2) {
+            if (!readDynamicLengths()) return false;
+        } else {
+            return false;
+        }
+        if (!buildTables()) return false;
+        mode = Huffman;
+        return true;
+    }
+
+    bool readDynamicLengths() {
+        static const uint8_t ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        uint32_t literalCount, distanceCount, codeCount;
+        if (!bits(5, literalCount) || !bits(5, distanceCount) || !bits(4, codeCount)) return false;
+        literalCount += 257;
+        distanceCount += 1;
+        codeCount += 4;
+        if (literalCount > 286 || distanceCount > 30) return false;
+
+        uint8_t codeLengths[19] = {};
+        for (uint32_t i = 0; i < codeCount; i++) {
+            uint32_t length;
+            if (!bits(3, length)) return false;
+            codeLengths[ORDER[i]] = static_cast<uint8_t>(length);
+        }
+        HuffmanCode codeLengthCode;
+        if (!codeLengthCode.build(codeLengths, 19)) return false;
+
+        // Literal/length and distance lengths are one run-length coded sequence
+        uint8_t sequence[286 + 30] = {};
+        uint32_t total = literalCount + distanceCount;
+        for (uint32_t i = 0; i < total;) {
+            int symbol = decode(codeLengthCode);
+            if (symbol < 0) return false;
+            if (symbol < 16) {
+                sequence[i++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            uint32_t repeat;
+            uint8_t value = 0;
+            if (symbol == 16) {
+                if (i == 0 || !bits(2, repeat)) return false;
+                value = sequence[i - 1];
+                repeat += 3;
+            } else if (symbol == 17) {
+                if (!bits(3, repeat)) return false;
+                repeat += 3;
+            } else {
+                if (!bits(7, repeat)) return false;
+                repeat += 11;
+            }
+            if (i + repeat > total) return false;
+            std::fill(sequence + i, sequence + i + repeat, value);
+            i += repeat;
+        }
+        if (sequence[256] == 0) return false; // No end-of-block code
+
+        std::fill(lengths, lengths + 320, 0);
+        std::copy(sequence, sequence + literalCount, lengths);
+        std::copy(sequence + literalCount, sequence + total, lengths + 288);
+        return true;
+    }
+
+    bool buildTables() {
+        return literals.build(lengths, 288) && distances.build(lengths + 288, 32);
+    }
+
+    Checkpoint capture() const {
+        Checkpoint checkpoint;
+        checkpoint.output = outputPosition;
+        checkpoint.bitPosition = (inputStart + inputUsed) * 8 + paddingBits - bitCount;
+        checkpoint.mode = mode;
+        checkpoint.lastBlock = lastBlock;
+        checkpoint.storedLeft = storedLeft;
+        std::copy(lengths, lengths + 320, checkpoint.lengths);
+        checkpoint.window = window;
+        return checkpoint;
+    }
+
+    void restore(const Checkpoint& checkpoint) {
+        outputPosition = checkpoint.output;
+        mode = static_cast<Mode>(checkpoint.mode);
+        lastBlock = checkpoint.lastBlock;
+        storedLeft = checkpoint.storedLeft;
+        matchLeft = 0;
+        std::copy(checkpoint.lengths, checkpoint.lengths + 320, lengths);
+        window = checkpoint.window;
+        if (mode == Huffman) buildTables();
+
+        inputStart = checkpoint.bitPosition / 8;
+        inputLength = 0;
+        inputUsed = 0;
+        bitBuffer = 0;
+        bitCount = 0;
+        paddingBits = 0;
+        uint32_t skipped;
+        bits(static_cast<unsigned>(checkpoint.bitPosition % 8), skipped);
+    }
+};
+
+// Random access to one entry: stored entries straight from the file,
+// deflated ones through an Inflater
+class Reader {
+public:
+    // Throws if the entry's data can't be found
+    Reader(const std::string& archivePath, const Entry& entry) : entry(entry) {
+        file.open(std::filesystem::u8path(archivePath), std::ios::binary);
+        uint8_t header[30];
+        file.seekg(static_cast<std::streamoff>(entry.headerOffset));
+        if (!file || !file.read(reinterpret_cast<char*>(header), sizeof(header)) || le32(header) != 0x04034b50) {
+            throw std::runtime_error("Damaged ZIP entry " + entry.name);
+        }
+        dataOffset = entry.headerOffset + 30 + le16(header + 26) + le16(header + 28);
+        if (entry.method == 8) inflater = std::make_unique<Inflater>(file, dataOffset, entry.compressedSize);
+    }
+
+    size_t read(void* out, size_t size) {
+        size = static_cast<size_t>(std::min<uint64_t>(size, entry.size - std::min(position, entry.size)));
+        if (size == 0) return 0;
+        size_t count;
+        if (inflater) {
+            if (inflater->position() != position) skipTo(position);
+            count = inflater->read(static_cast<uint8_t*>(out), size);
+        } else {
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(dataOffset + position));
+            file.read(static_cast<char*>(out), size);
+            count = static_cast<size_t>(file.gcount());
+        }
+        position += count;
+        return count;
+    }
+
+    // Anywhere up to the end; the inflate work happens on the next read
+    bool seek(uint64_t target) {
+        if (target > entry.size) return false;
+        position = target;
+        return true;
+    }
+
+    uint64_t tell() const { return position; }
+    uint64_t size() const { return entry.size; }
+
+private:
+    Entry entry;
+    std::ifstream file;
+    uint64_t dataOffset = 0;
+    uint64_t position = 0;
+    std::unique_ptr<Inflater> inflater;
+
+    void skipTo(uint64_t target) {
+        inflater->rewindFor(target);
+        uint8_t scratch[16384];
+        while (inflater->position() < target) {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(sizeof(scratch), target - inflater->position()));
+            if (inflater->read(scratch, count) == 0) break;
+        }
+    }
+};
+
+// Reader for a "archive.zip/entry" path; null if there is no such entry
+inline std::unique_ptr<Reader> openEntry(const std::string& path) {
+    std::string archivePath, entryName;
+    if (!split(path, archivePath, entryName)) return nullptr;
+    std::shared_ptr<const Archive> archive = open(archivePath);
+    const Entry* entry = archive ? archive->find(entryName) : nullptr;
+    if (!entry) return nullptr;
+    try {
+        return std::make_unique<Reader>(archivePath, *entry);
+    } catch (const std::exception& e) {
+        std::cerr << "ZIP: " << e.what() << "\n";
+        return nullptr;
+    }
+}
+
+// std::istream access to an entry, for code that parses files itself (tags)
+class EntryBuf : public std::streambuf {
+public:
+    explicit EntryBuf(std::unique_ptr<Reader> reader) : reader(std::move(reader)) {}
+
+protected:
+    int_type underflow() override {
+        size_t count = reader->read(buffer, sizeof(buffer));
+        if (count == 0) return traits_type::eof();
+        setg(buffer, buffer, buffer + count);
+        return traits_type::to_int_type(buffer[0]);
+    }
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode) override {
+        // The reader is ahead of the get position by what's still buffered
+        int64_t current = static_cast<int64_t>(reader->tell()) - (egptr() - gptr());
+        int64_t base = direction == std::ios_base::beg ? 0 : direction == std::ios_base::cur ? current : static_cast<int64_t>(reader->size());
+        int64_t target = base + offset;
+        if (target < 0 || !reader->seek(static_cast<uint64_t>(target))) return pos_type(off_type(-1));
+        setg(buffer, buffer, buffer);
+        return pos_type(target);
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode mode) override {
+        return seekoff(off_type(position), std::ios_base::beg, mode);
+    }
+
+private:
+    std::unique_ptr<Reader> reader;
+    char buffer[4096];
+};
+
+// --- miniaudio ------------------------------------------------------------
+
+// ma_vfs over archive entries, for ma_decoder_init_vfs with an entry path
+inline ma_vfs* vfs() {
+    struct Vfs {
+        ma_vfs_callbacks callbacks;
+    };
+
+    static Vfs instance = []() {
+        Vfs v{};
+        v.callbacks.onOpen = [](ma_vfs*, const char* path, ma_uint32 mode, ma_vfs_file* file) -> ma_result {
+            if (mode & MA_OPEN_MODE_WRITE) return MA_ACCESS_DENIED;
+            std::unique_ptr<Reader> reader = openEntry(path);
+            if (!reader) return MA_DOES_NOT_EXIST;
+            *file = reader.release();
+            return MA_SUCCESS;
+        };
+        v.callbacks.onOpenW = [](ma_vfs*, const wchar_t*, ma_uint32, ma_vfs_file*) -> ma_result {
+            return MA_NOT_IMPLEMENTED; // Entry paths are always passed as UTF-8
+        };
+        v.callbacks.onClose = [](ma_vfs*, ma_vfs_file file) -> ma_result {
+            delete static_cast<Reader*>(file);
+            return MA_SUCCESS;
+        };
+        v.callbacks.onRead = [](ma_vfs*, ma_vfs_file file, void* out, size_t size, size_t* read) -> ma_result {
+            size_t count = static_cast<Reader*>(file)->read(out, size);
+            if (read) *read = count;
+            return count == 0 && size > 0 ? MA_AT_END : MA_SUCCESS;
+        };
+        v.callbacks.onWrite = [](ma_vfs*, ma_vfs_file, const void*, size_t, size_t*) -> ma_result {
+            return MA_ACCESS_DENIED;
+        };
+        v.callbacks.onSeek = [](ma_vfs*, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin) -> ma_result {
+            Reader* reader = static_cast<Reader*>(file);
+            int64_t base = origin == ma_seek_origin_start ? 0 : origin == ma_seek_origin_current ? static_cast<int64_t>(reader->tell()) : static_cast<int64_t>(reader->size());
+            int64_t target = base + offset;
+            return target >= 0 && reader->seek(static_cast<uint64_t>(target)) ? MA_SUCCESS : MA_BAD_SEEK;
+        };
+        v.callbacks.onTell = [](ma_vfs*, ma_vfs_file file, ma_int64* cursor) -> ma_result {
+            *cursor = static_cast<ma_int64>(static_cast<Reader*>(file)->tell());
+            return MA_SUCCESS;
+        };
+        v.callbacks.onInfo = [](ma_vfs*, ma_vfs_file file, ma_file_info* info) -> ma_result {
+            info->sizeInBytes = static_cast<Reader*>(file)->size();
+            return MA_SUCCESS;
+        };
+        return v;
+    }();
+    return &instance;
+}
+
+} // namespace Zip
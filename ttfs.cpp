@@ -0,0 +1,199 @@
+#include <winsock2.h>
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <shellapi.h>
+#include <tlhelp32.h>
+#include "net/udps.h"
+#include "sys/config.h"
+#include "sys/ttfs.h"
+
+// Time-to-first-sound benchmark: launches play.exe the way a double-click
+// does and breaks down where the time goes until the first audible sample.
+// The daemon runs on the null device (LOUD_OFFLINE), so no sound card is
+// needed and results are comparable between machines.
+//
+// Usage: ttfs.exe <audio file> [runs]
+// Build as a console program (no -mwindows) to see the report.
+
+bool isLoudRunning() {
+    // Use process enumeration instead of command execution
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    PROCESSENTRY32W pe32;
+    pe32.dwSize = sizeof(PROCESSENTRY32W);
+
+    if (!Process32FirstW(hSnapshot, &pe32)) {
+        CloseHandle(hSnapshot);
+        return false;
+    }
+
+    bool found = false;
+    do {
+        if (wcscmp(pe32.szExeFile, L"loud.exe") == 0) {
+            found = true;
+            break;
+        }
+    } while (Process32NextW(hSnapshot, &pe32));
+
+    CloseHandle(hSnapshot);
+    return found;
+}
+
+// Ask the daemon to quit and wait for the process to go away
+void stopLoud() {
+    if (!isLoudRunning()) return;
+
+    try {
+        UDP::Socket sock("127.0.0.1", Config::current().udpPort);
+        sock.send("q");
+    } catch (const std::exception&) {
+        // Nothing listening; fall through to waiting
+    }
+
+    for (int i = 0; i < 50 && isLoudRunning(); i++) {
+        Sleep(100);
+    }
+}
+
+// Best effort: opening a file without buffering makes Windows purge its
+// cached pages, so the next open has to go to the disk again
+void evictFromCache(const std::wstring& path) {
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+// Lines in the daemon's results file
+std::vector<std::string> readResults() {
+    std::vector<std::string> lines;
+    std::ifstream in(Bench::resultsFile());
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    return lines;
+}
+
+// Launch play.exe on the file and wait for the daemon to record the run
+bool runOnce(const std::wstring& file, std::vector<uint64_t>& marks) {
+    size_t before = readResults().size();
+
+    std::string spawn = std::to_string(Bench::wallMicros());
+    SetEnvironmentVariableA(Bench::SPAWN_ENV, spawn.c_str());
+
+    std::wstring commandLine = L"play.exe \"" + file + L"\"";
+    STARTUPINFOW si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    if (!CreateProcessW(NULL, &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+        std::cerr << "Failed to start play.exe\n";
+        return false;
+    }
+    WaitForSingleObject(pi.hProcess, 30000);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    // The daemon writes the run once the first sound is out (or after its timeout)
+    for (int i = 0; i < 150; i++) {
+        std::vector<std::string> lines = readResults();
+        if (lines.size() > before && lines.size() > 1) {
+            marks.clear();
+            std::stringstream ss(lines.back());
+            std::string field;
+            while (std::getline(ss, field, ',')) marks.push_back(std::strtoull(field.c_str(), nullptr, 10));
+            return marks.size() == Bench::MarkCount;
+        }
+        Sleep(100);
+    }
+
+    std::cerr << "No result from the daemon\n";
+    return false;
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// Milliseconds spent in each phase (index = mark that ends it), -1 if unknown
+std::vector<double> phases(const std::vector<uint64_t>& marks) {
+    std::vector<double> result(Bench::MarkCount, -1);
+    for (int i = 1; i < Bench::MarkCount; i++) {
+        if (marks[i] && marks[i - 1] && marks[i] >= marks[i - 1]) {
+            result[i] = (marks[i] - marks[i - 1]) / 1000.0;
+        }
+    }
+    if (marks[Bench::FirstSound] && marks[Bench::Spawn]) {
+        result[0] = (marks[Bench::FirstSound] - marks[Bench::Spawn]) / 1000.0;
+    }
+    return result;
+}
+
+int main() {
+    // Parse command line arguments with Unicode paths
+    int nArgs;
+    LPWSTR* szArglist = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+    if (szArglist == NULL || nArgs < 2) {
+        std::cerr << "Usage: ttfs.exe <audio file> [runs]\n";
+        return 1;
+    }
+    std::wstring file = szArglist[1];
+    int runs = nArgs > 2 ? std::max(1, _wtoi(szArglist[2])) : 5;
+    LocalFree(szArglist);
+
+    // Inherited by play.exe and from there by the loud.exe it starts
+    SetEnvironmentVariableA("LOUD_OFFLINE", "1");
+
+    std::vector<std::vector<double>> cold, warm;
+    std::vector<uint64_t> marks;
+
+    // Cold: no daemon, file evicted from the cache
+    for (int i = 0; i < runs; i++) {
+        stopLoud();
+        evictFromCache(file);
+        if (runOnce(file, marks)) cold.push_back(phases(marks));
+    }
+
+    // Warm: daemon up, file read recently
+    for (int i = 0; i < runs; i++) {
+        if (runOnce(file, marks)) warm.push_back(phases(marks));
+        Sleep(200);
+    }
+
+    stopLoud();
+
+    static const char* labels[Bench::MarkCount] = {
+        "total (launch to first sound)",
+        "client spawn",
+        "daemon detection/start",
+        "client command prep",
+        "datagram + handler dispatch",
+        "filesystem checks",
+        "decoder init",
+        "first non-silent callback"
+    };
+
+    std::printf("%-32s %12s %12s\n", "phase (median ms)", "cold", "warm");
+    for (int phase = 1; phase <= Bench::MarkCount; phase++) {
+        int index = phase % Bench::MarkCount; // Total goes last
+        std::vector<double> c, w;
+        for (auto& run : cold) if (run[index] >= 0) c.push_back(run[index]);
+        for (auto& run : warm) if (run[index] >= 0) w.push_back(run[index]);
+        std::printf("%-32s %12.2f %12.2f\n", labels[index], median(c), median(w));
+    }
+    std::printf("runs: %zu cold, %zu warm\n", cold.size(), warm.size());
+
+    return 0;
+}